@@ -1,7 +1,7 @@
 TARGET = cells
 TEMPLATE = app
 
-QT += core gui opengl
+QT += core gui opengl concurrent
 
 CONFIG += c++11
 CONFIG -= app_bundle
@@ -10,6 +10,9 @@ SOURCES += \
     src/main.cpp \
     src/ArcBallCamera.cpp \
     src/AutomataParticle.cpp \
+    src/ClusterGrid.cpp \
+    src/DepthSorter.cpp \
+    src/FrameArena.cpp \
     src/GLWindow.cpp \
     src/GrowthParticle.cpp \
     src/Helpers.cpp \
@@ -17,11 +20,18 @@ SOURCES += \
     src/LinkedParticle.cpp \
     src/Manipulator.cpp \
     src/Particle.cpp \
+    src/PixelPicker.cpp \
+    src/ParticleEngine.cpp \
+    src/ParticlePicker.cpp \
     src/ParticleSystem.cpp \
     src/GUI.cpp \
     src/PointLight.cpp \
+    src/ProgramCache.cpp \
+    src/RenderGraph.cpp \
+    src/ShaderPermutations.cpp \
     src/SkyBox.cpp \
-    src/SpotLight.cpp\
+    src/SpotLight.cpp \
+    src/UniformBuffer.cpp
 
 OBJECTS_DIR = build/obj
 MOC_DIR = build/moc
@@ -33,18 +43,31 @@ INCLUDEPATH += include
 HEADERS += \
     include/ArcBallCamera.h \
     include/AutomataParticle.h \
+    include/ClusterGrid.h \
+    include/DepthSorter.h \
+    include/FrameArena.h \
     include/GLWindow.h \
     include/GrowthParticle.h \
     include/InputManager.h \
     include/LinkedParticle.h \
     include/Manipulator.h \
     include/Particle.h \
+    include/PixelPicker.h \
+    include/ParticleEngine.h \
+    include/ParticleParameters.h \
+    include/ParticlePicker.h \
     include/ParticleSystem.h \
     include/GUI.h \
     include/PointLight.h \
+    include/ProgramCache.h \
+    include/RenderGraph.h \
+    include/ShaderPermutations.h \
     include/SkyBox.h \
+    include/SkyFile.h \
     include/SpotLight.h \
-    include/SelectableObject.h
+    include/SelectableObject.h \
+    include/UniformBlocks.h \
+    include/UniformBuffer.h
 
 win32:LIBS += opengl32.lib
 
@@ -55,8 +78,11 @@ OTHER_FILES += \
 
 DISTFILES += \
     resources/shaders/blur.frag \
+    resources/shaders/depth_copy.frag \
     resources/shaders/geom.vert \
     resources/shaders/geom.frag \
+    resources/shaders/geom_impostor.vert \
+    resources/shaders/geom_impostor.frag \
     resources/shaders/skybox.vert \
     resources/shaders/skybox.frag \
     resources/shaders/sun.vert \
@@ -66,8 +92,11 @@ DISTFILES += \
     resources/shaders/links.frag \
     resources/shaders/manip.vert \
     resources/shaders/manip.frag \
+    resources/shaders/occlusion_box.vert \
+    resources/shaders/occlusion_box.frag \
     resources/shaders/ssao.vert \
     resources/shaders/ssao.frag \
+    resources/shaders/ssao_temporal.frag \
 
 FORMS += \
     ui/GUI.ui
@@ -76,3 +105,11 @@ CONFIG(release, debug|release):DEFINES += QT_NO_DEBUG_OUTPUT
 
 RESOURCES += \
     resources.qrc
+
+# Skyboxes baked with "tools/skybaker/skybaker resources/cubemaps skies" are
+# mapped from skies/ next to the executable, so the images can be left out
+baked_skyboxes {
+  DEFINES += BAKED_SKYBOXES
+} else {
+  RESOURCES += skyboxes.qrc
+}
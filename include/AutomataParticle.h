@@ -62,13 +62,13 @@ public :
       std::vector<std::unique_ptr<Particle>> &_particleList,
       int _automataRadius,
       int _automataTime
-  ) override;
+  );
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Finds the neighbours of the particles.
   /// @param [in] _particleList List of all particles.
   //////////////////////////////////////////////////////////////////////////////
-  std::vector<uint> getNeighbours(
+  ScratchVector<uint> getNeighbours(
       std::vector<std::unique_ptr<Particle>> &_particleList
   );
 
@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ClusterGrid.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CLUSTERGRID_H
+#define CLUSTERGRID_H
+
+// Native
+#include <vector>
+
+// Qt
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QVector4D>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class ClusterGrid
+/// @brief Groups the particles in the cells of a uniform grid so that whole
+/// groups can be tested at once instead of every particle.
+///
+/// The grid is rebuilt from the packaged instance data (x, y, z and radius per
+/// particle) every time it changes. Only the occupied cells are kept, each one
+/// becomes a cluster with the bounding box of its spheres. Cell sizes are
+/// powers of two and cells are aligned to multiples of their size, so the key
+/// of a cluster names the same region of space from one build to the next as
+/// long as the cell size does not change.
+////////////////////////////////////////////////////////////////////////////////
+class ClusterGrid
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Occupied cell of the grid.
+  //////////////////////////////////////////////////////////////////////////////
+  struct Cluster
+  {
+    QVector3D min;
+    QVector3D max;
+    unsigned int first;
+    unsigned int count;
+    quint64 key;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor.
+  /// @param[in] _particlesPerCluster Average amount of particles the cells are
+  /// sized for.
+  //////////////////////////////////////////////////////////////////////////////
+  ClusterGrid(unsigned int _particlesPerCluster = 32);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Rebuilds the clusters.
+  /// @param[in] _instances Four floats per particle: position and radius.
+  //////////////////////////////////////////////////////////////////////////////
+  void build(const std::vector<float> &_instances);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Finds the clusters touching the view frustum.
+  /// @param[in] _modelViewProjection Matrix the frustum planes are taken from.
+  /// @param[out] _visibleClusters Indices of the clusters inside or crossing
+  /// the frustum.
+  //////////////////////////////////////////////////////////////////////////////
+  void cull(
+      const QMatrix4x4 &_modelViewProjection,
+      std::vector<unsigned int> &_visibleClusters) const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Collects the particles of a list of clusters.
+  /// @param[in] _clusters Indices of the clusters.
+  /// @param[out] _particles Indices of the particles, cluster after cluster.
+  //////////////////////////////////////////////////////////////////////////////
+  void gatherParticles(
+      const std::vector<unsigned int> &_clusters,
+      std::vector<unsigned int> &_particles) const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Number of clusters of the last build.
+  /// @returns The number of clusters.
+  //////////////////////////////////////////////////////////////////////////////
+  unsigned int getClusterCount() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Access to a cluster.
+  /// @param[in] _idx Index of the cluster.
+  /// @returns The cluster.
+  //////////////////////////////////////////////////////////////////////////////
+  const Cluster &getCluster(unsigned int _idx) const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particles of all the clusters, the ones of a cluster start at its
+  /// first member and there are count of them.
+  /// @returns Indices of the particles.
+  //////////////////////////////////////////////////////////////////////////////
+  const std::vector<unsigned int> &getParticles() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Size of the cells of the last build. Cluster keys of builds with
+  /// different cell sizes can not be compared.
+  /// @returns The cell size.
+  //////////////////////////////////////////////////////////////////////////////
+  float getCellSize() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Extracts the six planes of a frustum, pointing inwards, from a
+  /// projection matrix (Gribb and Hartmann).
+  /// @param[in] _matrix Matrix taking points to clip space.
+  /// @param[out] _planes Left, right, bottom, top, near and far planes.
+  //////////////////////////////////////////////////////////////////////////////
+  static void extractPlanes(const QMatrix4x4 &_matrix, QVector4D _planes[6]);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether a box is at least partly on the inner side of every plane.
+  /// @param[in] _planes Planes pointing inwards.
+  /// @param[in] _count Number of planes.
+  /// @param[in] _min Lower corner of the box.
+  /// @param[in] _max Upper corner of the box.
+  /// @returns False only if the box is fully outside of one of the planes.
+  //////////////////////////////////////////////////////////////////////////////
+  static bool boxInside(
+      const QVector4D *_planes,
+      unsigned int _count,
+      const QVector3D &_min,
+      const QVector3D &_max);
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Amount of particles the cells are sized for.
+  //////////////////////////////////////////////////////////////////////////////
+  unsigned int m_particlesPerCluster;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Size of the cells of the last build.
+  //////////////////////////////////////////////////////////////////////////////
+  float m_cellSize;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Occupied cells.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<Cluster> m_clusters;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particle indices sorted by cluster.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<unsigned int> m_particles;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Cell of every particle, kept between builds to avoid allocating.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<unsigned int> m_cellOf;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Start of every cell in m_particles while sorting.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<unsigned int> m_cellStart;
+};
+
+#endif // CLUSTERGRID_H
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file DepthSorter.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DEPTHSORTER_H
+#define DEPTHSORTER_H
+
+// Native
+#include <cstdint>
+#include <vector>
+
+// Qt
+#include <QMatrix4x4>
+#include <QVector3D>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class DepthSorter
+/// @brief Keeps the particles ordered by their distance to the camera.
+///
+/// Sorting is a radix sort over the depths turned into integer keys, split
+/// over the global thread pool when there are enough particles to pay for
+/// it. The order does not need to be exact to help the depth test or the
+/// blending, so it is only computed again once the camera has moved or turned
+/// noticeably, a particle moved noticeably, or the number of particles
+/// changed.
+////////////////////////////////////////////////////////////////////////////////
+class DepthSorter
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor.
+  //////////////////////////////////////////////////////////////////////////////
+  DepthSorter();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Sorts the particles again if the order is out of date.
+  /// @param[in] _instances Four floats per particle: position and radius.
+  /// @param[in] _modelView Matrix taking the positions to view space.
+  /// @param[in] _backToFront Whether the furthest particles go first.
+  /// @returns True if the order was computed again.
+  //////////////////////////////////////////////////////////////////////////////
+  bool update(
+      const std::vector<float> &_instances,
+      const QMatrix4x4 &_modelView,
+      bool _backToFront);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Forces the next update() to sort.
+  //////////////////////////////////////////////////////////////////////////////
+  void invalidate();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particle indices in drawing order.
+  /// @returns The order.
+  //////////////////////////////////////////////////////////////////////////////
+  const std::vector<unsigned int> &getOrder() const;
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether the order of the last sort is still good enough.
+  /// @param[in] _instances Four floats per particle: position and radius.
+  /// @param[in] _eye Camera position in model space.
+  /// @param[in] _forward Camera direction in model space.
+  /// @param[in] _backToFront Requested direction.
+  /// @returns True if there is no need to sort.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isUpToDate(
+      const std::vector<float> &_instances,
+      const QVector3D &_eye,
+      const QVector3D &_forward,
+      bool _backToFront) const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Least significant digit radix sort of m_order by m_keys, eight
+  /// bits per pass.
+  //////////////////////////////////////////////////////////////////////////////
+  void radixSort();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Sorting keys, one per particle.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint32_t> m_keys;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Keys being written by the current pass.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint32_t> m_keysScratch;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particle indices in drawing order.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<unsigned int> m_order;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Indices being written by the current pass.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<unsigned int> m_orderScratch;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Camera position of the last sort.
+  //////////////////////////////////////////////////////////////////////////////
+  QVector3D m_eye;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Camera direction of the last sort.
+  //////////////////////////////////////////////////////////////////////////////
+  QVector3D m_forward;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Distance between the nearest and furthest particle at the last
+  /// sort, to judge how much a camera move matters.
+  //////////////////////////////////////////////////////////////////////////////
+  float m_depthRange;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Direction of the last sort.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_backToFront;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particle positions at the last sort, three floats each, to measure
+  /// how far they moved since.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<float> m_positions;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether the next update() has to sort no matter what.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_invalid;
+};
+
+#endif // DEPTHSORTER_H
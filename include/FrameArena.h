@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file FrameArena.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+// Native
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class FrameArena
+/// @brief Bump allocator for scratch data that only lives during one step of
+/// the simulation.
+///
+/// Allocations just move an offset forward and are never freed one by one.
+/// Everything is released at once by reset(), which the ParticleSystem calls
+/// at the beginning of every step. When a step needed more than one block, the
+/// blocks are merged into a single bigger one on reset so that later steps of
+/// the same size do not touch the heap at all.
+////////////////////////////////////////////////////////////////////////////////
+class FrameArena
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor.
+  /// @param[in] _blockSize Size in bytes of the first block.
+  //////////////////////////////////////////////////////////////////////////////
+  FrameArena(std::size_t _blockSize = 64 * 1024);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Returns a chunk of memory valid until the next reset().
+  /// @param[in] _bytes Size of the chunk.
+  /// @param[in] _alignment Alignment of the chunk, must be a power of two.
+  /// @returns Pointer to the chunk.
+  //////////////////////////////////////////////////////////////////////////////
+  void *allocate(std::size_t _bytes, std::size_t _alignment);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Releases every allocation made since the last reset. Nothing
+  /// allocated from the arena can be used after this call.
+  //////////////////////////////////////////////////////////////////////////////
+  void reset();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Total amount of memory owned by the arena.
+  /// @returns Capacity in bytes.
+  //////////////////////////////////////////////////////////////////////////////
+  std::size_t getCapacity() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Arena of the calling thread.
+  /// @returns The arena.
+  //////////////////////////////////////////////////////////////////////////////
+  static FrameArena &local();
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Chunk of memory the allocations are carved from.
+  //////////////////////////////////////////////////////////////////////////////
+  struct Block
+  {
+    std::unique_ptr<char[]> data;
+    std::size_t size;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Appends a new block big enough for the given allocation.
+  /// @param[in] _bytes Minimum amount of memory the block needs.
+  //////////////////////////////////////////////////////////////////////////////
+  void grow(std::size_t _bytes);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Blocks owned by the arena.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<Block> m_blocks;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Block currently being filled.
+  //////////////////////////////////////////////////////////////////////////////
+  std::size_t m_current;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Offset of the first free byte in the current block.
+  //////////////////////////////////////////////////////////////////////////////
+  std::size_t m_offset;
+
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class ArenaAllocator
+/// @brief Standard allocator handing out memory from a FrameArena, so standard
+/// containers can be used for scratch data. Deallocation does nothing, memory
+/// comes back when the arena is reset.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class ArenaAllocator
+{
+
+public:
+  typedef T value_type;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor using the arena of the calling thread.
+  //////////////////////////////////////////////////////////////////////////////
+  ArenaAllocator() : m_arena(&FrameArena::local()) {}
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor.
+  /// @param[in] _arena Arena to allocate from.
+  //////////////////////////////////////////////////////////////////////////////
+  ArenaAllocator(FrameArena &_arena) : m_arena(&_arena) {}
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Rebinding constructor required by the containers.
+  /// @param[in] _other Allocator to share the arena with.
+  //////////////////////////////////////////////////////////////////////////////
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &_other) : m_arena(_other.getArena()) {}
+
+  T *allocate(std::size_t _count)
+  {
+    return static_cast<T *>(m_arena->allocate(_count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *, std::size_t) {}
+
+  FrameArena *getArena() const { return m_arena; }
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Arena the memory comes from.
+  //////////////////////////////////////////////////////////////////////////////
+  FrameArena *m_arena;
+
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &_a, const ArenaAllocator<U> &_b)
+{
+  return _a.getArena() == _b.getArena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &_a, const ArenaAllocator<U> &_b)
+{
+  return _a.getArena() != _b.getArena();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Vector living in the arena of the calling thread. Must not outlive
+/// the current simulation step.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif // FRAMEARENA_H
@@ -14,11 +14,11 @@
 // Standard
 #include <array>
 #include <random>
+#include <unordered_set>
 
 // Qt
 #include <QOpenGLBuffer>
 #include <QOpenGLFunctions_4_1_Core>
-#include <QOpenGLFramebufferObject>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLVertexArrayObject>
 #include <QMatrix4x4>
@@ -32,9 +32,16 @@
 #include <QMainWindow>
 
 // Project
+#include "ClusterGrid.h"
+#include "DepthSorter.h"
 #include "InputManager.h"
+#include "ParticlePicker.h"
 #include "ParticleSystem.h"
+#include "ProgramCache.h"
+#include "RenderGraph.h"
+#include "ShaderPermutations.h"
 #include "SkyBox.h"
+#include "UniformBuffer.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 /// @class GLWindow
@@ -70,18 +77,86 @@ public:
     newOrder = 3
   };
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Quality tiers of the ambient occlusion. Low and medium work at half
+  /// resolution with 8 and 16 samples per frame accumulated over time, high
+  /// takes the whole kernel every frame at full resolution.
+  //////////////////////////////////////////////////////////////////////////////
+  enum SSAOQuality
+  {
+    SSAO_LOW    = 0,
+    SSAO_MEDIUM = 1,
+    SSAO_HIGH   = 2
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Shape of the region being dragged to select particles. Shift
+  /// drags a box and Ctrl a lasso.
+  //////////////////////////////////////////////////////////////////////////////
+  enum RegionMode
+  {
+    REGION_NONE  = 0,
+    REGION_BOX   = 1,
+    REGION_LASSO = 2
+  };
+
 private:
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Cleans up all the textures and FBOs
+  /// @brief Cleans up the textures that depend on the size of the window.
   //////////////////////////////////////////////////////////////////////////////
   void cleanup();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Sets up the shader pipeline with all the framebuffer object and
-  /// textures needed for rendering all the types.
+  /// @brief Sets up the textures that outlive a frame and depend on the size
+  /// of the render targets, the occlusion history.
   //////////////////////////////////////////////////////////////////////////////
   void prepareSSAOPipeline();
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Generates the SSAO kernel and noise texture and points the
+  /// samplers of the SSAO programs to their units. None of it depends on the
+  /// window, so it is done once.
+  //////////////////////////////////////////////////////////////////////////////
+  void prepareSSAOKernel();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Creates the uniform buffers and points the blocks of every
+  /// program to them.
+  //////////////////////////////////////////////////////////////////////////////
+  void prepareUniformBuffers();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Points the uniform blocks of a program to the shared buffers.
+  /// @param[in] _program Linked program.
+  //////////////////////////////////////////////////////////////////////////////
+  void attachUniformBlocks(QOpenGLShaderProgram *_program);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Lighting program of the current rendering mode and SSAO quality,
+  /// built the first time it is needed.
+  /// @returns The program.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLShaderProgram *lightingProgram();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Looks up the locations of the uniforms set every frame, after the
+  /// programs are linked.
+  //////////////////////////////////////////////////////////////////////////////
+  void resolveUniformLocations();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Fills the camera block with the matrices of this frame, it is
+  /// only uploaded if the camera or the model moved.
+  //////////////////////////////////////////////////////////////////////////////
+  void updateCameraBlock();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Declares the passes of this frame in the render graph and
+  /// compiles it. The SSAO passes are culled in the modes not shading with the
+  /// occlusion.
+  //////////////////////////////////////////////////////////////////////////////
+  void buildRenderGraph();
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Sets up a VAO that hold a vertex buffer for the quad and state
   /// needed to draw a full screen quad.
@@ -128,6 +203,41 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   void drawParticles();
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Draws particles as camera facing quads, the sphere is ray cast in
+  /// the fragment shader.
+  //////////////////////////////////////////////////////////////////////////////
+  void drawImpostors();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Creates the program and the buffer texture used to draw the
+  /// bounding boxes of the clusters for the occlusion queries.
+  //////////////////////////////////////////////////////////////////////////////
+  void prepareOcclusionQueries();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Collects the results of the occlusion queries of the last frame
+  /// that are ready, without waiting for the rest.
+  //////////////////////////////////////////////////////////////////////////////
+  void readOcclusionQueries();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Draws the bounding box of every cluster in the frustum against the
+  /// depth of the gBuffer, each one inside its own occlusion query.
+  //////////////////////////////////////////////////////////////////////////////
+  void issueOcclusionQueries();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Collects the time of the last geometry pass if the GPU has it.
+  //////////////////////////////////////////////////////////////////////////////
+  void readGeometryTimer();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Prints the average time of the geometry pass since the last
+  /// report and starts counting again.
+  //////////////////////////////////////////////////////////////////////////////
+  void reportGeometryTimer();
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Draws the links on top of everything
   //////////////////////////////////////////////////////////////////////////////
@@ -141,86 +251,129 @@ private:
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Generates OpenGL vertex data for a sphere of _num_subdivisions
-  /// subdivisions. It will get stored in m_sphere_data.
+  /// subdivisions. It will get appended to m_sphere_data.
   /// @param[in] _num_subdivisions Recursion level for icosahedra subdivision.
   //////////////////////////////////////////////////////////////////////////////
   void generateSphereData(uint _num_subdivisions);
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Generates every level of detail of the sphere one after the other
+  /// in m_sphere_data, from the finest to the coarsest.
+  //////////////////////////////////////////////////////////////////////////////
+  void generateSphereLODs();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Groups the particles of m_draw_order by the level of detail they
+  /// need, judged by their radius on screen, keeping their order within each
+  /// level. The result goes to m_lod_particle_data.
+  //////////////////////////////////////////////////////////////////////////////
+  void binParticlesByLOD();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Keeps the links with an end in a cluster inside the frustum and
+  /// points them to the instances. Ends without an instance are appended
+  /// after the drawn ones, where only the links read them.
+  //////////////////////////////////////////////////////////////////////////////
+  void gatherVisibleLinks();
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Now it selects randomly a particle, it splits it and advances them.
   //////////////////////////////////////////////////////////////////////////////
   void updateParticleSystem();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Sends updated particle information to OpenGL.
+  /// @brief Collects updated particle information for OpenGL. It gets sent by
+  /// uploadInstances() at the beginning of the next frame.
   //////////////////////////////////////////////////////////////////////////////
   void sendParticleDataToOpenGL();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Updates particle system model matrix.
+  /// @brief Culls the particles against the camera of this frame and writes
+  /// the visible ones, and their links, to the buffers.
   //////////////////////////////////////////////////////////////////////////////
-  void updateModelMatrix();
+  void uploadInstances();
 
-private:
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Current rendering mode for the particle shading.
+  /// @brief Fills m_draw_order with the visible particles, ordered by depth
+  /// when depth sorting is enabled.
   //////////////////////////////////////////////////////////////////////////////
-  RenderingMode m_rendering_mode;
+  void sortVisibleParticles();
 
-  // ===========================================================================
-  // Framebuffer Objects
-  // ===========================================================================
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief FBO that will render to the world and view position and normals as
-  /// well as the links by using the Geometry program and the Links program.
+  /// @brief Makes sure every region of the instance ring can hold _count
+  /// particles, growing the buffer if it cannot.
+  /// @param[in] _count Number of particles to fit in one region.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLFramebufferObject* m_gbuffer_fbo;
+  void reserveInstanceRing(uint _count);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief FBO that will handle all the AO occlusion by using the view
-  /// position texture, view normal texture and noise texture. It will render to
-  /// the occlusion texture as a result.
+  /// @brief Blocks until the GPU has finished the draws reading from a region
+  /// of the instance ring.
+  /// @param[in] _region Index of the region.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLFramebufferObject* m_ssao_fbo;
+  void waitForInstanceRegion(uint _region);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief FBO that takes as input the occlusion texture generated by the SSAO
-  /// FBO and blurs it. The output goes to the blurred occlusion texture.
+  /// @brief Deletes the fences of all the regions of the instance ring.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLFramebufferObject* m_blur_fbo;
+  void deleteInstanceFences();
 
-  // ===========================================================================
-  // Textures
-  // ===========================================================================
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the geometry position color pass in world space coordinates.
+  /// @brief Updates particle system model matrix.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLTexture* m_world_position_texture;
+  void updateModelMatrix();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the geometry position color pass in world view coordinates.
+  /// @brief Converts a position in the window to normalized device
+  /// coordinates.
+  /// @param[in] _position Position in pixels, from the top left corner.
+  /// @returns The position from -1 to 1, y going up.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLTexture* m_view_position_texture;
+  QVector2D toNormalizedDevice(const QPoint &_position) const;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the geometry normal color pass in world space coordinates.
+  /// @brief Selects the particles under the dragged region, or the one under
+  /// the cursor if the mouse barely moved.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLTexture* m_world_normal_texture;
+  void finishRegionSelection();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the geometry normal color pass in view space coordinates.
+  /// @brief Marks the frame as out of date and starts the timer, to be called
+  /// whenever something drawn changes.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLTexture* m_view_normal_texture;
+  void requestRender();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds a single-channel occlusion factor result of the SSAO shader.
+  /// @brief Whether something changes every frame on its own: growth towards
+  /// the light, a simulation that has not settled, the camera moving with the
+  /// keys or a background loading.
+  /// @returns True if frames are needed even if nothing else changed.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLTexture* m_occlusion_texture;
+  bool isAnimating() const;
 
+private:
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the single-channel blurred SSAO factor.
+  /// @brief Current rendering mode for the particle shading.
+  //////////////////////////////////////////////////////////////////////////////
+  RenderingMode m_rendering_mode;
+
+  // ===========================================================================
+  // Render targets
+  // ===========================================================================
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Passes of the frame. Owns the gBuffer, the occlusion textures that
+  /// last a frame and every framebuffer.
+  //////////////////////////////////////////////////////////////////////////////
+  RenderGraph m_render_graph;
+
+  // ===========================================================================
+  // Textures
+  // ===========================================================================
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLTexture* m_blurred_occlusion_texture;
+  /// @brief Occlusion accumulated over the previous frames and this one, they
+  /// swap roles every frame.
+  //////////////////////////////////////////////////////////////////////////////
+  std::array<QOpenGLTexture*, 2> m_occlusion_history_textures;
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief A manually created texture initialized from random values.
@@ -235,6 +388,16 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   QOpenGLShaderProgram* m_geom_program;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Renders the particles to the gBuffer as ray cast impostors.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLShaderProgram* m_impostor_program;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Draws the cluster bounding boxes for the occlusion queries.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLShaderProgram* m_box_program;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief In charge of generating the occlusion factor.
   //////////////////////////////////////////////////////////////////////////////
@@ -246,9 +409,26 @@ private:
   QOpenGLShaderProgram* m_blur_program;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Responsible for the final composite.
+  /// @brief Blends the occlusion of this frame with the history.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLShaderProgram* m_lighting_program;
+  QOpenGLShaderProgram* m_temporal_program;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Responsible for the final composite, one program per rendering
+  /// mode and SSAO resolution.
+  //////////////////////////////////////////////////////////////////////////////
+  ShaderPermutations *m_lighting_permutations;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Builds every program, reusing the binaries of previous launches.
+  //////////////////////////////////////////////////////////////////////////////
+  ProgramCache m_program_cache;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Writes the depth texture of the gBuffer to the default framebuffer
+  /// so the overlays are hidden behind the particles.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLShaderProgram* m_depth_copy_program;
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Particle links shader program.
@@ -270,9 +450,91 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   std::vector<QVector3D> m_ssao_kernel;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uniform buffer holding the kernel, uploaded with the pipeline.
+  //////////////////////////////////////////////////////////////////////////////
+  UniformBuffer m_ssao_kernel_ubo;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uniform buffer binding point of the kernel.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr GLuint m_ssao_kernel_binding = 0;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uniform buffer with the matrices, shared by all the programs.
+  //////////////////////////////////////////////////////////////////////////////
+  UniformBuffer m_camera_ubo;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uniform buffer with the key and fill lights.
+  //////////////////////////////////////////////////////////////////////////////
+  UniformBuffer m_lights_ubo;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uniform buffer with the particle material.
+  //////////////////////////////////////////////////////////////////////////////
+  UniformBuffer m_material_ubo;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uniform buffer binding points of the camera, lights and material.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr GLuint m_camera_binding = 1;
+  static constexpr GLuint m_lights_binding = 2;
+  static constexpr GLuint m_material_binding = 3;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Quality tier of the ambient occlusion, cycled with key Q.
+  //////////////////////////////////////////////////////////////////////////////
+  SSAOQuality m_ssao_quality;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Size of the occlusion textures.
+  //////////////////////////////////////////////////////////////////////////////
+  int m_ssao_width;
+  int m_ssao_height;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Frames rendered, picks the kernel samples of each frame.
+  //////////////////////////////////////////////////////////////////////////////
+  uint m_ssao_frame;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief History texture written last.
+  //////////////////////////////////////////////////////////////////////////////
+  uint m_occlusion_history;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether the history holds a previous frame of the current
+  /// textures.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_occlusion_history_valid;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Matrix of the previous frame from model space to clip space, to
+  /// find where the history saw each point.
+  //////////////////////////////////////////////////////////////////////////////
+  QMatrix4x4 m_previous_model_view_projection;
+
   // ===========================================================================
   // Uniforms and shader routine indices
   // ===========================================================================
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Locations of the uniforms set every frame or every draw, so they
+  /// are not looked up by name each time.
+  //////////////////////////////////////////////////////////////////////////////
+  struct UniformLocations
+  {
+    GLint ssaoRadius;
+    GLint ssaoBias;
+    GLint sampleCount;
+    GLint sampleStride;
+    GLint sampleOffset;
+    GLint reprojection;
+    GLint blendFactor;
+    GLint historyValid;
+    GLint blurDirection;
+  } m_uniforms;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Float for the red ambient colour variable for the light.
   //////////////////////////////////////////////////////////////////////////////
@@ -375,40 +637,36 @@ private:
   float m_ssaoBias;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Index for the RenderPass subroutine to be called.
-  //////////////////////////////////////////////////////////////////////////////
-  GLuint m_activeRenderPassIndex;
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// @brief Index for RenderPass subroutine that draws world-space positions.
+  /// @brief Toggled with key L. If true will render the links between
+  /// particles.
   //////////////////////////////////////////////////////////////////////////////
-  GLuint m_AOIndex;
+  bool m_draw_links;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Index for RenderPass subroutine that draws depth.
+  /// @brief Toggled with key I. If true the particles are drawn as impostors
+  /// instead of sphere meshes.
   //////////////////////////////////////////////////////////////////////////////
-  GLuint m_XRayIndex;
+  bool m_impostors;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Index for RenderPass subroutine that draws diffuse.
+  /// @brief Timer query measuring the geometry pass on the GPU.
   //////////////////////////////////////////////////////////////////////////////
-  GLuint m_ADSIndex;
+  GLuint m_geometry_query;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Index for RenderPass subroutine that draws new order art style.
+  /// @brief Whether the timer query is waiting for its result.
   //////////////////////////////////////////////////////////////////////////////
-  GLuint m_NewOrderIndex;
+  bool m_geometry_query_pending;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Renders just the normals.
+  /// @brief Nanoseconds spent in the geometry pass since the last report.
   //////////////////////////////////////////////////////////////////////////////
-  GLuint m_normalIndex;
+  GLuint64 m_geometry_time;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Toggled with key L. If true will render the links between
-  /// particles.
+  /// @brief Frames measured since the last report.
   //////////////////////////////////////////////////////////////////////////////
-  bool m_draw_links;
+  uint m_geometry_frames;
 
   // ===========================================================================
   // ParticleSystem related parameters
@@ -441,16 +699,43 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   QOpenGLVertexArrayObject *m_links_vao;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief VAO that will store the state for drawing the bounding boxes.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLVertexArrayObject *m_box_vao;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief VBO buffer that stores the point data for the quad.
   //////////////////////////////////////////////////////////////////////////////
   QOpenGLBuffer m_quad_vbo;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief VBO buffer that stores the point data for the particles.
+  /// @brief VBO buffer that stores the point data for the particles. It is a
+  /// ring of m_instance_ring_regions regions, each frame writes the next one
+  /// while the GPU may still be reading the previous ones.
   //////////////////////////////////////////////////////////////////////////////
   QOpenGLBuffer m_part_vbo;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Number of regions in the instance ring.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr uint m_instance_ring_regions = 3;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief How many particles fit in one region of the instance ring.
+  //////////////////////////////////////////////////////////////////////////////
+  uint m_instance_capacity;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Region of the instance ring holding the latest particle data.
+  //////////////////////////////////////////////////////////////////////////////
+  uint m_instance_region;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Fence per region, signalled once the GPU is done drawing from it.
+  //////////////////////////////////////////////////////////////////////////////
+  std::array<GLsync, m_instance_ring_regions> m_instance_fences;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief EBO that stores the indices of the particles to draw links for.
   //////////////////////////////////////////////////////////////////////////////
@@ -461,6 +746,16 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   QOpenGLBuffer m_sphere_vbo;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Min and max corner of each box tested this frame.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLBuffer m_box_buffer;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Buffer texture the box shader reads m_box_buffer through.
+  //////////////////////////////////////////////////////////////////////////////
+  GLuint m_box_texture;
+
   // ===========================================================================
   // Vertex data to send to OpenGL
   // ===========================================================================
@@ -476,11 +771,172 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   std::vector<uint> m_links_data;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Links with an end in the frustum, pointing to their instances.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_visible_links_data;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Vertex data of the shape that will define an individual particle.
+  /// Holds all the levels of detail back to back.
   //////////////////////////////////////////////////////////////////////////////
   std::vector<GLfloat> m_sphere_data;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Number of levels of detail of the sphere.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr uint m_sphere_lods = 4;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief First vertex of each level of detail in m_sphere_data.
+  //////////////////////////////////////////////////////////////////////////////
+  std::array<GLint, m_sphere_lods> m_sphere_lod_first;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Number of vertices of each level of detail.
+  //////////////////////////////////////////////////////////////////////////////
+  std::array<GLsizei, m_sphere_lods> m_sphere_lod_count;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief First vertex of the impostor quad, stored after the spheres.
+  //////////////////////////////////////////////////////////////////////////////
+  GLint m_impostor_first;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Instance data grouped by level of detail, the order it is sent to
+  /// OpenGL in.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<GLfloat> m_lod_particle_data;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief First instance of each level of detail in m_lod_particle_data.
+  //////////////////////////////////////////////////////////////////////////////
+  std::array<GLsizei, m_sphere_lods> m_lod_instance_start;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Number of instances drawn with each level of detail.
+  //////////////////////////////////////////////////////////////////////////////
+  std::array<GLsizei, m_sphere_lods> m_lod_instance_count;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Level of detail picked for every particle, in particle order.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<unsigned char> m_particle_lod;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Where every particle ended up in m_lod_particle_data, used to
+  /// point the links to the right instances.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_instance_slot;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Slot of the particles that were culled.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr uint m_no_instance_slot = ~0u;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particles grouped in clusters for culling.
+  //////////////////////////////////////////////////////////////////////////////
+  ClusterGrid m_cluster_grid;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Clusters inside the view frustum this frame.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_visible_clusters;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particles of the visible clusters.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_visible_particles;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Toggled with key Z. If true the visible particles are drawn front
+  /// to back.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_depth_sorting;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Keeps every particle ordered by view depth.
+  //////////////////////////////////////////////////////////////////////////////
+  DepthSorter m_depth_sorter;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether each particle is in m_visible_particles.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<bool> m_particle_visible;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether each particle is in a cluster inside the frustum, drawn
+  /// or hidden by occlusion.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<bool> m_particle_in_frustum;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Visible particles in the order they are binned and drawn.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_draw_order;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Toggled with key O. If true clusters hidden behind others in the
+  /// previous frame are not drawn.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_occlusion_culling;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Clusters in the frustum and not occluded, the ones drawn.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_drawn_clusters;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Pool of occlusion query objects, one per tested cluster.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<GLuint> m_occlusion_queries;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Key of the cluster tested by each query of the last frame.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<quint64> m_occlusion_keys;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Corners of the boxes before they are uploaded, kept to reuse the
+  /// memory.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<GLfloat> m_box_data;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Keys of the clusters found to be fully hidden.
+  //////////////////////////////////////////////////////////////////////////////
+  std::unordered_set<quint64> m_occluded_clusters;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Cell size of the grid the occlusion keys belong to.
+  //////////////////////////////////////////////////////////////////////////////
+  float m_occlusion_cell_size;
+
+  // ===========================================================================
+  // Particle selection
+  // ===========================================================================
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Region being dragged, if any.
+  //////////////////////////////////////////////////////////////////////////////
+  RegionMode m_region_mode;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Corners of the box, or points of the lasso, in pixels.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<QPoint> m_region_points;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Distance in pixels under which a drag counts as a click, and
+  /// between two points of the lasso.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr int m_region_click_distance = 4;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Indices of the selected particles, for the tools working on them.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_selected_particles;
+
   // ===========================================================================
   // Miscellaneous
   // ===========================================================================
@@ -500,10 +956,41 @@ private:
   SkyBox *m_skybox;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief QTimer clocks schedule updates for repainting the scene
+  /// @brief QTimer clocks schedule updates for repainting the scene. It only
+  /// runs while something changes, see requestRender().
   //////////////////////////////////////////////////////////////////////////////
   QTimer m_timer;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Frames still drawn after the last change. The temporal occlusion
+  /// takes an eighth of the kernel per frame at low quality and the occlusion
+  /// culling lags a frame behind, both settle well within this.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr int m_settle_frames = 32;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Frames left to draw before the window goes idle.
+  //////////////////////////////////////////////////////////////////////////////
+  int m_frames_to_settle;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Restarted by every resize, the render targets follow the window
+  /// when it times out.
+  //////////////////////////////////////////////////////////////////////////////
+  QTimer m_resize_timer;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Milliseconds without resizes before the targets are reallocated.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr int m_resize_settle_time = 150;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Size of the gBuffer. While the window is being resized it lags
+  /// behind and the frame is stretched to the window.
+  //////////////////////////////////////////////////////////////////////////////
+  int m_target_width;
+  int m_target_height;
+
   // ===========================================================================
   // Event handlers
   // ===========================================================================
@@ -543,6 +1030,13 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   void wheelEvent(QWheelEvent *event);
 
+private slots:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Resizes the render targets to the window, once it stopped
+  /// changing size.
+  //////////////////////////////////////////////////////////////////////////////
+  void reallocateTargets();
+
 public slots:
 
   //////////////////////////////////////////////////////////////////////////////
@@ -587,6 +1081,12 @@ public slots:
   //////////////////////////////////////////////////////////////////////////////
   void setSSAOBias(double _bias);
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Slot for changing the ambient occlusion quality.
+  /// @param[in] _quality One of SSAOQuality.
+  //////////////////////////////////////////////////////////////////////////////
+  void setSSAOQuality(int _quality);
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Slot for changing particle type.
   /// @param[in] _type Type of particle.
@@ -67,64 +67,112 @@ public:
       QVector3D _lightPos,
       std::vector<std::unique_ptr<Particle>> &_particleList,
       std::mt19937_64 _gen,
-      bool _growToLight) override;
+      bool _growToLight);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Sets the child threshold.
+  /// @brief Sets the child threshold of this particle only.
   /// @param[in] _amount Amount of children allowed per branch.
   //////////////////////////////////////////////////////////////////////////////
   void setChildThreshold(uint _amount) override;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief sets the branch length of a branch.
+  /// @brief sets the branch length of this particle only.
   /// @param[in] _value length of the branch.
   //////////////////////////////////////////////////////////////////////////////
   void setBranchLength(float _value) override;
 
 private:
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Finds the parent according to the levels to call the recursive
-  /// collsion on it.
+  /// @brief Child threshold, either the shared one or its override.
+  /// @returns Amount of children allowed per branch.
+  //////////////////////////////////////////////////////////////////////////////
+  uint getChildThreshold() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Branch length, either the shared one or its override.
+  /// @returns Length of the branch.
+  //////////////////////////////////////////////////////////////////////////////
+  float getBranchLength() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Positions and squared collision distances of the particles a new
+  /// branch has to be tested against, stored as flat arrays so candidates can
+  /// be tested in batches. Lives in scratch memory.
+  //////////////////////////////////////////////////////////////////////////////
+  struct Neighbourhood
+  {
+    ScratchVector<float> x;
+    ScratchVector<float> y;
+    ScratchVector<float> z;
+    ScratchVector<float> minDistanceSquared;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Unit directions evenly spread over the sphere (Fibonacci lattice).
+  /// They are computed once and shared by every tip.
+  /// @returns The direction set.
+  //////////////////////////////////////////////////////////////////////////////
+  static const std::vector<QVector3D> &fibonacciDirections();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Finds the parent according to the levels and collects that parent
+  /// and all of its descendants, which are the only particles a new branch can
+  /// collide with.
   /// @param[in] _levels represents the levels of collision testing it will do.
   /// 1 level is the equivalent of one generation earlier.
-  /// @param[in] _testPosition the position that needs collision testing.
   /// @param[in] _particleList List of all particles.
-  /// @returns returns true if colliding and false if it's not colliding.
+  /// @param[out] _neighbourhood Will hold the collected particles.
   //////////////////////////////////////////////////////////////////////////////
-  bool collision(
+  void gatherNeighbourhood(
       int _levels,
-      QVector3D _testPosition,
-      std::vector<std::unique_ptr<Particle>> &_particleList);
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// @brief Tests directly for one on one collision between the particle and the
-  /// input particle position.
-  /// @param[in] _particlePos Position of the particle that is meant to be tested
-  /// against.
-  //////////////////////////////////////////////////////////////////////////////
-  bool testCollision(QVector3D _particlePos);
+      std::vector<std::unique_ptr<Particle>> &_particleList,
+      Neighbourhood &_neighbourhood);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Recursively calling on parent to run collisions on all children of
-  ///  a particle.
-  /// @param[in] _particle Parent Particle.
-  /// @param[in] _particleList List of all Particles.
+  /// @brief Tests a batch of candidate positions against the neighbourhood.
+  /// @param[in] _x X coordinates of the candidates.
+  /// @param[in] _y Y coordinates of the candidates.
+  /// @param[in] _z Z coordinates of the candidates.
+  /// @param[in] _neighbourhood Particles to test against.
+  /// @param[out] _colliding Set to true for every colliding candidate.
   //////////////////////////////////////////////////////////////////////////////
-  bool recursiveCollision(
-      QVector3D _particle,
-      std::vector<std::unique_ptr<Particle>> &_particleList) override;
+  static void testCollisionBatch(
+      const float *_x,
+      const float *_y,
+      const float *_z,
+      const Neighbourhood &_neighbourhood,
+      bool *_colliding);
 
 private:
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the threshold of how many children/branches one Particle can have.
+  /// @brief Holds the threshold of how many children/branches one Particle can
+  /// have. Only used if there are no shared parameters or it is overridden.
   //////////////////////////////////////////////////////////////////////////////
   uint m_childrenTreshold;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Length of a branches connecting to the particle
+  /// @brief Length of a branches connecting to the particle. Only used if there
+  /// are no shared parameters or it is overridden.
   //////////////////////////////////////////////////////////////////////////////
   float m_branchLength;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Set once no candidate direction is free of collisions. The tree
+  /// never moves, so a saturated tip stays saturated while its size and branch
+  /// length stay the same.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_saturated;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particle size at the time the tip got saturated.
+  //////////////////////////////////////////////////////////////////////////////
+  float m_saturatedSize;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Branch length at the time the tip got saturated.
+  //////////////////////////////////////////////////////////////////////////////
+  float m_saturatedBranchLength;
+
 };
 
 #endif // GROWTHPARTICLE_H
@@ -15,10 +15,11 @@
 #include <QMatrix4x4>
 #include <QVector3D>
 #include <QOpenGLWidget>
-#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions_4_1_Core>
 
 // Project
 #include "ArcBallCamera.h"
+#include "PixelPicker.h"
 #include "PointLight.h"
 #include "SpotLight.h"
 #include "SelectableObject.h"
@@ -55,39 +56,49 @@ public:
   void doMovement(QVector3D _rp);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Gets the unique colour at a given screen coordinate. This is the
-  /// value written with drawBackBuffer in the SelectObject.
+  /// @brief Whether a key moving the camera is held down.
+  /// @returns True while the camera moves every frame.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isMoving() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether a pick is waiting to be issued or to come back.
+  /// @returns True while picking needs more frames.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isPicking() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Asks for the unique colour at a given screen coordinate, the value
+  /// written with drawBackBuffer in the SelectObject. Requests made before the
+  /// next frame are merged into one pick at the last position.
   /// @param[in] _x X screen coordinate.
   /// @param[in] _y Y screen coordinate.
+  /// @param[in] _select Whether the object found is set to clicked, instead
+  /// of hovered.
   //////////////////////////////////////////////////////////////////////////////
-  void getUniqueColour(const int _x,
-      const int _y);
+  void requestPick(const int _x, const int _y, bool _select);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Runs getUniqueColour and compares them to the object unique
-  /// colours. Any matching object is set to clicked.
-  /// @param[in] _x Mouse screen x pos.
-  /// @param[in] _y Mouse screen y pos.
+  /// @brief Once per frame, with the context current and the manipulators
+  /// drawn. Hovers or selects with the colour picked in a previous frame and
+  /// issues the pick requested since.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  /// @returns True if a pick came back and changed the hovered or clicked
+  /// manipulator.
   //////////////////////////////////////////////////////////////////////////////
-  void doSelection(const int _x, const int _y);
+  bool updatePicking(QOpenGLFunctions_4_1_Core *_funcs);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Add another shader program to the InputManager. These are used to
-  /// calculate camera movement and to get unique colours.
-  /// @param[in] _program Shader program to add.
+  /// @brief Deletes the picking buffers.
+  /// @param[in] _funcs OpenGL functions of the current context.
   //////////////////////////////////////////////////////////////////////////////
-  void addShaderProgram(QOpenGLShaderProgram* _program);
+  void cleanupPicking(QOpenGLFunctions_4_1_Core *_funcs);
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Setup main camera.
   //////////////////////////////////////////////////////////////////////////////
   void setupCamera(float _fov, int _w, int _h, float _near, float _far);
 
-  //////////////////////////////////////////////////////////////////////////////
-  /// @brief Load projection and view matrix to shader.
-  //////////////////////////////////////////////////////////////////////////////
-  void loadLightMatricesToShader();
-
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Load the list of objects to the InputManager. These are the
   /// objects that will be considered for the InputManager calculations.
@@ -207,19 +218,27 @@ private:
   QMatrix4x4 m_projection;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Vector of shader programs.
+  /// @brief Vector of selectobjects in the scene.
   //////////////////////////////////////////////////////////////////////////////
-  std::vector<QOpenGLShaderProgram*> m_programs;
+  std::vector<std::shared_ptr<SelectableObject>> m_objectList;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Vector of selectobjects in the scene.
+  /// @brief Reads the unique colours back.
   //////////////////////////////////////////////////////////////////////////////
-  std::vector<std::shared_ptr<SelectableObject>> m_objectList;
+  PixelPicker m_picker;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Pick waiting for the next frame, and where.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_pick_requested;
+  int m_pick_x;
+  int m_pick_y;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief The light frame buffer object.
+  /// @brief Whether the pick waiting and the one on the GPU select.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLFramebufferObject* m_fbo;
+  bool m_pick_select;
+  bool m_picking_select;
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Array of bools stating which buttons are currently pressed.
@@ -74,7 +74,7 @@ public:
       int _cohesionFactor,
       int _localCohesionFactor,
       bool _particleDeath
-  ) override;
+  );
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Repulses the particles which aren't connected by links to
@@ -105,7 +105,7 @@ public:
   bool split(
       std::vector<std::unique_ptr<Particle>> &_particleList,
       std::mt19937_64 _gen
-  ) override;
+  );
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Double checks that all links go both ways, and if not, creates new
@@ -16,6 +16,8 @@
 #include <QVector3D>
 
 // Project
+#include "FrameArena.h"
+#include "ParticleParameters.h"
 #include "PointLight.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -76,6 +78,24 @@ public:
     GROWTH = 1
   };
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Flags of the parameters a particle holds its own value for
+  /// instead of using the shared ParticleParameters.
+  //////////////////////////////////////////////////////////////////////////////
+  enum ParameterOverride
+  {
+    SIZE_OVERRIDE = 1 << 0,
+    BRANCH_LENGTH_OVERRIDE = 1 << 1,
+    CHILD_THRESHOLD_OVERRIDE = 1 << 2
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Points the particle to the parameters shared by the system. Until
+  /// this is called the particle uses the values it was constructed with.
+  /// @param[in] _parameters Parameter block, must outlive the particle.
+  //////////////////////////////////////////////////////////////////////////////
+  void setParameters(const ParticleParameters *_parameters);
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Adds the velocity to the position, could be overwritten if
   /// inherited if other custom behaviours would be needed.
@@ -83,34 +103,22 @@ public:
   void advance();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Calculates the new velocity of the particle based on the forces
-  /// that act on it. This is the base method to be overriden by LinkedParticle.
-  /// @param [in] _particleList List of all particles
-  /// @param [in] _averageDistance Average distance between particles
-  /// @param [in] _cohesionFactor Controls the strength of cohesion
-  /// @param [in] _localCohesionFactor Controls the strength of local cohesion
-  /// @param [in] _particleDeath Toggles whether or not particle death is true
+  /// @brief Whether the particle has settled and can be skipped by the system.
+  /// @returns True if the particle is asleep.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isAsleep();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Puts the particle back into the simulation.
   //////////////////////////////////////////////////////////////////////////////
-  virtual void calculate(
-      std::vector<std::unique_ptr<Particle>> &_particleList,
-      QVector3D _averageDistance,
-      int _cohesionFactor,
-      int _localCohesionFactor,
-      bool _particleDeath
-  );
+  void wake();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Calculates the new velocity of the particle based on the forces
-  /// that act on it. This is the base method to be overriden by AutomataParticle.
-  /// @param [in] _particleList List of all particles
-  /// @param [in] _automataRadius Controls the radius in which automata are created
-  /// @param [in] _automataTime Controls the speed at which automata are created
+  /// @brief Called after advance(), counts how long the particle has been at
+  /// rest and puts it to sleep once it stayed still long enough.
+  /// @returns True if the particle moved during this step.
   //////////////////////////////////////////////////////////////////////////////
-  virtual void calculate(
-      std::vector<std::unique_ptr<Particle>> &_particleList,
-      int _automataRadius,
-      int _automataTime
-  );
+  bool updateSleepState();
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Moves the particles closest to the centre to create a bulge effect.
@@ -125,53 +133,19 @@ public:
   virtual void addFood(QVector3D _particleCentre);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief sets the child threshold.
-  /// only applicable for Growth particle
+  /// @brief sets the child threshold of this particle only, overriding the
+  /// shared one. Only applicable for Growth particle
   /// @param[in] _amount amount of children allowed per branch.
   //////////////////////////////////////////////////////////////////////////////
   virtual void setChildThreshold(uint _amount);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief sets the branch length of a branch.
-  /// only applicable for Growth particle
+  /// @brief sets the branch length of this particle only, overriding the
+  /// shared one. Only applicable for Growth particle
   /// @param[in] _value length of the branch.
   //////////////////////////////////////////////////////////////////////////////
   virtual void setBranchLength(float _value);
 
-  //////////////////////////////////////////////////////////////////////////////
-  /// @brief Called when particle needs to be split and creates a new branch
-  /// from that Particle. Just for GrowthParticle.
-  /// @param[in] _lightPos Light position.
-  /// @param[in] _particleList List of all particles.
-  /// @param[in] _gen Random number generator.
-  /// @param[in] _growToLight Whether they should aim the light or not.
-  //////////////////////////////////////////////////////////////////////////////
-  virtual bool split(
-      QVector3D _lightPos,
-      std::vector<std::unique_ptr<Particle>> &_particleList,
-      std::mt19937_64 _gen,
-      bool _growToLight);
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// @brief Called when particle needs to be split, Calculates which particles
-  /// are linked to the new and which to the old particle. For LinkedParticle.
-  /// @param[in] _particleList List of all particles
-  /// @param[in] _gen Random number generator.
-  //////////////////////////////////////////////////////////////////////////////
-  virtual bool split(
-      std::vector<std::unique_ptr<Particle>>& _particleList,
-      std::mt19937_64 _gen);
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// @brief Recursively calling on parent to run collisions on all children of
-  ///  a particle. For GrowthParticle.
-  /// @param[in] _particle Parent Particle.
-  /// @param[in] _particleList List of all Particles.
-  //////////////////////////////////////////////////////////////////////////////
-  virtual bool recursiveCollision(
-      QVector3D _particle,
-      std::vector<std::unique_ptr<Particle>> &_particleList);
-
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Particle position getter.
   /// @param[out] _pos Will hold the particles position
@@ -207,7 +181,7 @@ public:
   void getRadius(float &_radius);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief sets the Particles position
+  /// @brief Sets the size of this particle only, overriding the shared one.
   /// @param[in] _radius Size of the particle.
   //////////////////////////////////////////////////////////////////////////////
   void setRadius(float _radius);
@@ -246,6 +220,13 @@ public:
   //////////////////////////////////////////////////////////////////////////////
   void getConnectionsID(std::vector<uint> &_returnList);
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Writes a list including all ID that are connected to the particle
+  /// into scratch memory.
+  /// @param[out] _returnList will hold the IDs.
+  //////////////////////////////////////////////////////////////////////////////
+  void getConnectionsID(ScratchVector<uint> &_returnList);
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Writes a list with all positions of the particles connections.
   /// @param[out] _linkPos list where to write the positions.
@@ -253,7 +234,7 @@ public:
   /// existing particles.
   //////////////////////////////////////////////////////////////////////////////
   void getPosFromConnections(
-      std::vector<QVector3D> &_linkPos,
+      ScratchVector<QVector3D> &_linkPos,
       std::vector<std::unique_ptr<Particle>> &_particleList);
 
   //////////////////////////////////////////////////////////////////////////////
@@ -275,6 +256,23 @@ public:
   virtual void doubleConnect(uint _ID, std::vector<std::unique_ptr<Particle> > &_particleList);
 
 protected:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Size of the particle, either the shared one or its override.
+  /// @returns The size.
+  //////////////////////////////////////////////////////////////////////////////
+  float getSize() const
+  {
+    if (m_parameters == nullptr || (m_overrides & SIZE_OVERRIDE)) return m_size;
+    return m_parameters->particleSize;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Makes a newly created particle share the parameters and the
+  /// overrides of this one.
+  /// @param[out] _child The new particle.
+  //////////////////////////////////////////////////////////////////////////////
+  void shareParameters(Particle &_child) const;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Particle position.
   //////////////////////////////////////////////////////////////////////////////
@@ -292,7 +290,8 @@ protected:
   bool m_foodLevel;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Particle size or radius.
+  /// @brief Particle size or radius. Only used if there are no shared
+  /// parameters or the size is overridden, use getSize() to read it.
   //////////////////////////////////////////////////////////////////////////////
   float m_size;
 
@@ -320,6 +319,27 @@ protected:
   /// @brief holds IDs of all particles connected to this particle.
   //////////////////////////////////////////////////////////////////////////////
   std::vector<uint> m_connectedParticles;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Set when the particle has been at rest for a while. Sleeping
+  /// particles are not calculated nor advanced.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_asleep;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Number of consecutive steps the particle has not moved.
+  //////////////////////////////////////////////////////////////////////////////
+  uint m_restSteps;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Parameters shared by all the particles of the system.
+  //////////////////////////////////////////////////////////////////////////////
+  const ParticleParameters *m_parameters;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Combination of ParameterOverride flags.
+  //////////////////////////////////////////////////////////////////////////////
+  uint m_overrides;
 };
 
 #endif // PARTICLE_H
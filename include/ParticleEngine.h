@@ -0,0 +1,264 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ParticleEngine.h
+/// @author Carola Gille
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PARTICLEENGINE_H
+#define PARTICLEENGINE_H
+
+// Project
+#include "ParticleSystem.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class ParticleEngineBase
+/// @brief Runs the steps of a ParticleSystem for one particle model.
+///
+/// The ParticleSystem picks the engine once in reset(), afterwards it only
+/// calls through this interface, so there is one virtual call per step rather
+/// than one per particle.
+////////////////////////////////////////////////////////////////////////////////
+class ParticleEngineBase
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Virtual destructor.
+  //////////////////////////////////////////////////////////////////////////////
+  virtual ~ParticleEngineBase() {}
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Creates the initial particles.
+  /// @param[in] _system System to fill.
+  /// @param[in] _amount How many particles to create.
+  //////////////////////////////////////////////////////////////////////////////
+  virtual void fill(ParticleSystem &_system, unsigned int _amount) = 0;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Calculates the forces on the awake particles and moves them.
+  /// @param[in] _system System to advance.
+  //////////////////////////////////////////////////////////////////////////////
+  virtual void advance(ParticleSystem &_system) = 0;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Calculates the forces on the awake particles without moving them.
+  /// @param[in] _system System to calculate.
+  //////////////////////////////////////////////////////////////////////////////
+  virtual void calculate(ParticleSystem &_system) = 0;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether the particles of this model can be split at all.
+  /// @returns True if they can.
+  //////////////////////////////////////////////////////////////////////////////
+  virtual bool canSplit() const = 0;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether the particles of this model ever go to sleep.
+  /// @returns True if they can.
+  //////////////////////////////////////////////////////////////////////////////
+  virtual bool canSleep() const = 0;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Splits a particle.
+  /// @param[in] _system System the particle belongs to.
+  /// @param[in] _idx Index of the particle.
+  /// @returns True if a new particle was created.
+  //////////////////////////////////////////////////////////////////////////////
+  virtual bool split(ParticleSystem &_system, unsigned int _idx) = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @struct LinkedModel
+/// @brief Model policy for LinkedParticle: surface growth held by links.
+////////////////////////////////////////////////////////////////////////////////
+struct LinkedModel
+{
+  typedef LinkedParticle ParticleType;
+
+  static const bool canSleep = true;
+  static const bool canSplit = true;
+
+  static void fill(ParticleSystem &_system, unsigned int _amount);
+
+  static void calculate(ParticleSystem &_system, LinkedParticle &_particle, unsigned int _idx)
+  {
+    Q_UNUSED(_idx);
+    _particle.LinkedParticle::calculate(
+          _system.m_particles,
+          _system.m_averageDistance,
+          _system.m_cohesion,
+          _system.m_localCohesion,
+          _system.m_particleDeath);
+  }
+
+  static bool split(ParticleSystem &_system, LinkedParticle &_particle)
+  {
+    return _particle.LinkedParticle::split(_system.m_particles, _system.m_gen);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @struct GrowthModel
+/// @brief Model policy for GrowthParticle: branching trees. There are no forces,
+/// the particles never move once placed.
+////////////////////////////////////////////////////////////////////////////////
+struct GrowthModel
+{
+  typedef GrowthParticle ParticleType;
+
+  static const bool canSleep = true;
+  static const bool canSplit = true;
+
+  static void fill(ParticleSystem &_system, unsigned int _amount);
+
+  static void calculate(ParticleSystem &_system, GrowthParticle &_particle, unsigned int _idx)
+  {
+    Q_UNUSED(_system);
+    Q_UNUSED(_particle);
+    Q_UNUSED(_idx);
+  }
+
+  static bool split(ParticleSystem &_system, GrowthParticle &_particle)
+  {
+    return _particle.GrowthParticle::split(
+          _system.m_lightPos,
+          _system.m_particles,
+          _system.m_gen,
+          _system.m_GP_growtoLight);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @struct AutomataModel
+/// @brief Model policy for AutomataParticle: Conway's Game of Life. Particles
+/// have to be evaluated every step, they never sleep.
+////////////////////////////////////////////////////////////////////////////////
+struct AutomataModel
+{
+  typedef AutomataParticle ParticleType;
+
+  static const bool canSleep = false;
+  static const bool canSplit = false;
+
+  static void fill(ParticleSystem &_system, unsigned int _amount);
+
+  static void calculate(ParticleSystem &_system, AutomataParticle &_particle, unsigned int _idx)
+  {
+    _particle.AutomataParticle::calculate(
+          _system.m_particles,
+          _system.m_automataRadius,
+          _system.m_automataTime);
+
+    // Dead particles are deleted once the step is over
+    if (_particle.AutomataParticle::isAlive() == false)
+    {
+      _system.m_iterID.push_back(_idx);
+    }
+  }
+
+  static bool split(ParticleSystem &_system, AutomataParticle &_particle)
+  {
+    Q_UNUSED(_system);
+    Q_UNUSED(_particle);
+    return false;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class ParticleEngine
+/// @brief Engine specialised for one model. The loops are compiled once per
+/// model and call the model with the concrete particle type, so there are no
+/// virtual calls nor type checks inside them.
+/// @tparam Model One of LinkedModel, GrowthModel or AutomataModel.
+////////////////////////////////////////////////////////////////////////////////
+template <typename Model>
+class ParticleEngine : public ParticleEngineBase
+{
+
+public:
+  typedef typename Model::ParticleType ModelParticle;
+
+  void fill(ParticleSystem &_system, unsigned int _amount) override
+  {
+    Model::fill(_system, _amount);
+  }
+
+  void advance(ParticleSystem &_system) override
+  {
+    collectActive(_system);
+
+    for (unsigned int i : _system.m_activeParticles)
+    {
+      Model::calculate(_system, get(_system, i), i);
+    }
+
+    for (unsigned int i : _system.m_activeParticles)
+    {
+      _system.m_particles[i]->advance();
+    }
+
+    if (Model::canSleep)
+    {
+      _system.updateSleepStates();
+    }
+
+    // Deleting after the loops so the indices above stay valid
+    _system.deleteParticle();
+  }
+
+  void calculate(ParticleSystem &_system) override
+  {
+    collectActive(_system);
+
+    for (unsigned int i : _system.m_activeParticles)
+    {
+      Model::calculate(_system, get(_system, i), i);
+    }
+  }
+
+  bool canSplit() const override
+  {
+    return Model::canSplit;
+  }
+
+  bool canSleep() const override
+  {
+    return Model::canSleep;
+  }
+
+  bool split(ParticleSystem &_system, unsigned int _idx) override
+  {
+    return Model::split(_system, get(_system, _idx));
+  }
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief All the particles of the system are of the model type.
+  /// @param[in] _system System holding the particle.
+  /// @param[in] _idx Index of the particle.
+  /// @returns The particle.
+  //////////////////////////////////////////////////////////////////////////////
+  static ModelParticle &get(ParticleSystem &_system, unsigned int _idx)
+  {
+    return static_cast<ModelParticle &>(*_system.m_particles[_idx]);
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Fills the active list with the particles taking part in the step.
+  /// @param[in] _system System to collect from.
+  //////////////////////////////////////////////////////////////////////////////
+  static void collectActive(ParticleSystem &_system)
+  {
+    _system.m_activeParticles.clear();
+    for (unsigned int i = 0; i < _system.m_particles.size(); ++i)
+    {
+      if (!Model::canSleep || !_system.m_particles[i]->isAsleep())
+      {
+        _system.m_activeParticles.push_back(i);
+      }
+    }
+  }
+};
+
+#endif // PARTICLEENGINE_H
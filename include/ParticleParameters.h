@@ -0,0 +1,55 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ParticleParameters.h
+/// @author Carola Gille
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PARTICLEPARAMETERS_H
+#define PARTICLEPARAMETERS_H
+
+// Qt
+#include <QtGlobal>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @struct ParticleParameters
+/// @brief Parameters shared by every particle of a ParticleSystem.
+///
+/// The system owns the block and the particles only keep a pointer to it, so
+/// changing a value does not need to visit the particles. Particles that need
+/// a value of their own store it separately as an override.
+////////////////////////////////////////////////////////////////////////////////
+struct ParticleParameters
+{
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Default constructor with the values the GUI starts with.
+  //////////////////////////////////////////////////////////////////////////////
+  ParticleParameters()
+    : particleSize(2.0f)
+    , branchLength(1.0f)
+    , childThreshold(3)
+    , version(0)
+  {}
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Particle size or radius.
+  //////////////////////////////////////////////////////////////////////////////
+  float particleSize;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Length of the branches, for GrowthParticle.
+  //////////////////////////////////////////////////////////////////////////////
+  float branchLength;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief How many children one particle can have, for GrowthParticle.
+  //////////////////////////////////////////////////////////////////////////////
+  uint childThreshold;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Increased every time any of the values changes.
+  //////////////////////////////////////////////////////////////////////////////
+  uint version;
+};
+
+#endif // PARTICLEPARAMETERS_H
@@ -0,0 +1,129 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ParticlePicker.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PARTICLEPICKER_H
+#define PARTICLEPICKER_H
+
+// Native
+#include <vector>
+
+// Qt
+#include <QMatrix4x4>
+#include <QVector2D>
+#include <QVector3D>
+#include <QVector4D>
+
+// Project
+#include "ClusterGrid.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class ParticlePicker
+/// @brief Finds particles under the cursor or inside a region of the screen
+/// on the CPU, without going through the GPU.
+///
+/// Both work on the packaged instance data (x, y, z and radius per particle)
+/// and the cluster grid built from it. Whole clusters are rejected with their
+/// bounding boxes first, so only the particles of the few clusters touching
+/// the ray or the region are tested one by one. Screen points are given in
+/// normalized device coordinates.
+////////////////////////////////////////////////////////////////////////////////
+class ParticlePicker
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Finds the closest particle under a point of the screen.
+  /// @param[in] _grid Clusters of the instances.
+  /// @param[in] _instances Four floats per particle: position and radius.
+  /// @param[in] _modelViewProjection Matrix the particles were drawn with.
+  /// @param[in] _point Point of the screen.
+  /// @returns Index of the particle, or -1 if the ray hits nothing.
+  //////////////////////////////////////////////////////////////////////////////
+  static int pick(
+      const ClusterGrid &_grid,
+      const std::vector<float> &_instances,
+      const QMatrix4x4 &_modelViewProjection,
+      const QVector2D &_point);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Finds the particles whose centres are inside a rectangle of the
+  /// screen, between the near and far planes.
+  /// @param[in] _grid Clusters of the instances.
+  /// @param[in] _instances Four floats per particle: position and radius.
+  /// @param[in] _modelViewProjection Matrix the particles were drawn with.
+  /// @param[in] _corner A corner of the rectangle.
+  /// @param[in] _opposite The opposite corner.
+  /// @param[out] _particles Indices of the particles.
+  //////////////////////////////////////////////////////////////////////////////
+  static void selectBox(
+      const ClusterGrid &_grid,
+      const std::vector<float> &_instances,
+      const QMatrix4x4 &_modelViewProjection,
+      const QVector2D &_corner,
+      const QVector2D &_opposite,
+      std::vector<unsigned int> &_particles);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Finds the particles whose centres are inside a closed polygon of
+  /// the screen, between the near and far planes.
+  /// @param[in] _grid Clusters of the instances.
+  /// @param[in] _instances Four floats per particle: position and radius.
+  /// @param[in] _modelViewProjection Matrix the particles were drawn with.
+  /// @param[in] _lasso Points of the polygon, the last joins the first.
+  /// @param[out] _particles Indices of the particles.
+  //////////////////////////////////////////////////////////////////////////////
+  static void selectLasso(
+      const ClusterGrid &_grid,
+      const std::vector<float> &_instances,
+      const QMatrix4x4 &_modelViewProjection,
+      const std::vector<QVector2D> &_lasso,
+      std::vector<unsigned int> &_particles);
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Collects the particles projecting inside a rectangle, and inside
+  /// a polygon if there is one.
+  /// @param[in] _grid Clusters of the instances.
+  /// @param[in] _instances Four floats per particle: position and radius.
+  /// @param[in] _modelViewProjection Matrix the particles were drawn with.
+  /// @param[in] _min Lower corner of the rectangle.
+  /// @param[in] _max Upper corner of the rectangle.
+  /// @param[in] _lasso Polygon inside the rectangle, may be null.
+  /// @param[out] _particles Indices of the particles.
+  //////////////////////////////////////////////////////////////////////////////
+  static void selectRegion(
+      const ClusterGrid &_grid,
+      const std::vector<float> &_instances,
+      const QMatrix4x4 &_modelViewProjection,
+      const QVector2D &_min,
+      const QVector2D &_max,
+      const std::vector<QVector2D> *_lasso,
+      std::vector<unsigned int> &_particles);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Planes, pointing inwards, of the part of the frustum behind a
+  /// rectangle of the screen.
+  /// @param[in] _matrix Matrix taking points to clip space.
+  /// @param[in] _min Lower corner of the rectangle.
+  /// @param[in] _max Upper corner of the rectangle.
+  /// @param[out] _planes Left, right, bottom, top, near and far planes.
+  //////////////////////////////////////////////////////////////////////////////
+  static void regionPlanes(
+      const QMatrix4x4 &_matrix,
+      const QVector2D &_min,
+      const QVector2D &_max,
+      QVector4D _planes[6]);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Even-odd test of a point against a polygon.
+  /// @param[in] _polygon Points of the polygon.
+  /// @param[in] _point The point.
+  /// @returns True if the point is inside.
+  //////////////////////////////////////////////////////////////////////////////
+  static bool insidePolygon(const std::vector<QVector2D> &_polygon, const QVector2D &_point);
+};
+
+#endif // PARTICLEPICKER_H
@@ -10,6 +10,7 @@
 #define PARTICLESYSTEM_H
 
 // Native
+#include <memory>
 #include <vector>
 
 // Custom
@@ -18,6 +19,8 @@
 #include "AutomataParticle.h"
 #include "PointLight.h"
 
+class ParticleEngineBase;
+
 ////////////////////////////////////////////////////////////////////////////////
 /// @class ParticleSystem
 /// @brief Wraps particle system functionality.
@@ -44,11 +47,23 @@ public:
   //////////////////////////////////////////////////////////////////////////////
   ParticleSystem(char _particleType);
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Destructor, defined where the engine is a complete type.
+  //////////////////////////////////////////////////////////////////////////////
+  ~ParticleSystem();
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Steps all the particles in the system .
   //////////////////////////////////////////////////////////////////////////////
   void advance();
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether the next steps would leave the particles as they are. Not
+  /// true of models that never sleep, automata follow the clock.
+  /// @returns True if nothing changes until a parameter does.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isSettled() const;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Populates the system with this amount of particles.
   /// @param[in] _amount Number of particles to initialize the system with.
@@ -72,7 +87,7 @@ public:
   /// @brief Gets the nearest particle to the point light
   /// @returns Index of nearest particle to point light
   //////////////////////////////////////////////////////////////////////////////
-  unsigned int getNearestParticle(std::vector<uint> _toSplit);
+  unsigned int getNearestParticle(const ScratchVector<uint> &_toSplit);
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Selects a particle randomly and splits it. Useful for debugging.
@@ -111,7 +126,7 @@ public:
   QVector3D calculateAverageDistanceFromCentre();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief This will delete a particle and all the connections to it.
+  /// @brief Sets the size of all the particles, applied before the next step.
   /// @param[in] _size The new size.
   //////////////////////////////////////////////////////////////////////////////
   void setParticleSize(double _size);
@@ -169,7 +184,8 @@ public:
   void setLightPos(QVector3D _lightPos);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Sets the branch length for Growth Particles.
+  /// @brief Sets the branch length for Growth Particles, applied before the
+  /// next step.
   /// @param[in] _amount length of a branch.
   //////////////////////////////////////////////////////////////////////////////
   void setBranchLength(float _amount);
@@ -182,7 +198,8 @@ public:
   void reset(char _particleType);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Sets the child threshold for Growth Particles.
+  /// @brief Sets the child threshold for Growth Particles, applied before the
+  /// next step.
   /// @param[in] _value amount of children per particle.
   //////////////////////////////////////////////////////////////////////////////
   void setChildThreshold(int _value);
@@ -206,6 +223,45 @@ public:
   void setGrowToLight(bool _state);
 
 private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief The engine and the models run the steps on the internals.
+  //////////////////////////////////////////////////////////////////////////////
+  template <typename Model> friend class ParticleEngine;
+  friend struct LinkedModel;
+  friend struct GrowthModel;
+  friend struct AutomataModel;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Updates the sleep state of the particles that took part in the
+  /// step and wakes up the ones linked to a particle that moved.
+  //////////////////////////////////////////////////////////////////////////////
+  void updateSleepStates();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Wakes up the sleeping particles within the repulsion range of the
+  /// particles that moved, found through a spatial hash of all of them.
+  /// @param[in] _moving Indices of the particles that moved this step.
+  //////////////////////////////////////////////////////////////////////////////
+  void wakeNeighbours(const ScratchVector<uint> &_moving);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Wakes up a particle and every particle linked to it.
+  /// @param[in] _idx Index of the particle.
+  //////////////////////////////////////////////////////////////////////////////
+  void wakeLinked(unsigned int _idx);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Wakes up every particle, used when a parameter affecting all of
+  /// them changes.
+  //////////////////////////////////////////////////////////////////////////////
+  void wakeAll();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Makes the pending parameters the ones used by the particles if
+  /// any of them changed.
+  //////////////////////////////////////////////////////////////////////////////
+  void applyParameters();
+
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Stores the state of the forces
@@ -238,11 +294,9 @@ private:
   int m_automataTime;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Stores the particle Type like a flag,
-  /// G stands for GrowthParticle
-  /// L stands for LinkedParticle
+  /// @brief Runs the steps for the current particle model, chosen in reset().
   //////////////////////////////////////////////////////////////////////////////
-  char m_particleType;
+  std::unique_ptr<ParticleEngineBase> m_engine;
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Stores the list of particles in the system.
@@ -284,10 +338,22 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   std::vector<uint> m_iterID;
 
-  ////////////////////////////////////////////////////////////////////////////
-  /// @brief m_currentParticleSize stores size of particles
-  ////////////////////////////////////////////////////////////////////////////
-  float m_currentParticleSize;
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Indices of the particles taking part in the current step, the
+  /// ones that are asleep are left out.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<uint> m_activeParticles;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Parameters shared by all the particles, they keep a pointer to it.
+  //////////////////////////////////////////////////////////////////////////////
+  ParticleParameters m_parameters;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Parameters set through the setters, copied over m_parameters
+  /// between steps.
+  //////////////////////////////////////////////////////////////////////////////
+  ParticleParameters m_pendingParameters;
 
   ///////////////////////////////////////////////////////////////////////////
   /// @brief m_nearestParticle states if the splitting calculation will take
@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file PixelPicker.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PIXELPICKER_H
+#define PIXELPICKER_H
+
+// Native
+#include <functional>
+
+// Qt
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions_4_1_Core>
+#include <QVector3D>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class PixelPicker
+/// @brief Reads the unique colour under a pixel without stalling.
+///
+/// The objects are drawn with a scissor around the pixel, so nothing else is
+/// rasterized, and the pixel is copied to a pixel buffer object behind a
+/// fence. The colour is collected by resolve() once the GPU got there,
+/// usually on the next frame.
+////////////////////////////////////////////////////////////////////////////////
+class PixelPicker
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor, the buffers are made by the first pick.
+  //////////////////////////////////////////////////////////////////////////////
+  PixelPicker();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Sets the size of the window picked from.
+  /// @param[in] _w Width.
+  /// @param[in] _h Height.
+  //////////////////////////////////////////////////////////////////////////////
+  void resize(int _w, int _h);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Deletes the buffers.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  //////////////////////////////////////////////////////////////////////////////
+  void destroy(QOpenGLFunctions_4_1_Core *_funcs);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether a pick has not been resolved yet.
+  /// @returns True while waiting on the GPU.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isBusy() const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Draws a pixel and starts reading it back.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  /// @param[in] _x Window x coordinate.
+  /// @param[in] _y Window y coordinate, from the top.
+  /// @param[in] _draw Draws the objects in their unique colours.
+  /// @returns False if the pixel is outside the window.
+  //////////////////////////////////////////////////////////////////////////////
+  bool pick(
+      QOpenGLFunctions_4_1_Core *_funcs,
+      int _x,
+      int _y,
+      const std::function<void()> &_draw);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Collects the colour of the last pick if the GPU is done with it.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  /// @param[out] _colour The colour, from 0 to 255.
+  /// @returns True if there was a colour.
+  //////////////////////////////////////////////////////////////////////////////
+  bool resolve(QOpenGLFunctions_4_1_Core *_funcs, QVector3D &_colour);
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Framebuffer of the size of the window drawn into.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLFramebufferObject *m_fbo;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Pixel buffer object the pixel is copied to.
+  //////////////////////////////////////////////////////////////////////////////
+  GLuint m_pbo;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Signalled once the copy landed in the buffer.
+  //////////////////////////////////////////////////////////////////////////////
+  GLsync m_fence;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Size of the window.
+  //////////////////////////////////////////////////////////////////////////////
+  int m_width;
+  int m_height;
+};
+
+#endif // PIXELPICKER_H
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ProgramCache.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+// Qt
+#include <QByteArray>
+#include <QOpenGLFunctions_4_1_Core>
+#include <QOpenGLShaderProgram>
+#include <QString>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class ProgramCache
+/// @brief Builds shader programs, keeping the linked binaries on disk so the
+/// next launch does not have to compile them.
+///
+/// A binary is stored under the cache location of the application with a
+/// name hashed from the sources, the driver and the OpenGL version, so any
+/// change to them just misses the cache. Binaries the driver rejects are
+/// compiled from the sources again and replaced.
+////////////////////////////////////////////////////////////////////////////////
+class ProgramCache
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor, nothing is cached until initialize().
+  //////////////////////////////////////////////////////////////////////////////
+  ProgramCache();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Reads the driver strings and prepares the cache directory.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  //////////////////////////////////////////////////////////////////////////////
+  void initialize(QOpenGLFunctions_4_1_Core *_funcs);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Links a program from a vertex and a fragment shader file.
+  /// @param[in] _program Program without shaders.
+  /// @param[in] _vertex Path of the vertex shader.
+  /// @param[in] _fragment Path of the fragment shader.
+  /// @returns True if the program is linked.
+  //////////////////////////////////////////////////////////////////////////////
+  bool build(
+      QOpenGLShaderProgram *_program,
+      const QString &_vertex,
+      const QString &_fragment);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Links a program from the sources of a vertex and a fragment
+  /// shader.
+  /// @param[in] _program Program without shaders.
+  /// @param[in] _vertex Vertex shader source.
+  /// @param[in] _fragment Fragment shader source.
+  /// @returns True if the program is linked.
+  //////////////////////////////////////////////////////////////////////////////
+  bool buildFromSource(
+      QOpenGLShaderProgram *_program,
+      const QByteArray &_vertex,
+      const QByteArray &_fragment);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Reads a shader from a file or the resources.
+  /// @param[in] _path Path of the shader.
+  /// @returns The source, empty if it could not be read.
+  //////////////////////////////////////////////////////////////////////////////
+  static QByteArray readSource(const QString &_path);
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Tries to load the binary of a program.
+  /// @param[in] _program Program to load it into.
+  /// @param[in] _path File of the binary.
+  /// @returns True if the driver took it.
+  //////////////////////////////////////////////////////////////////////////////
+  bool load(QOpenGLShaderProgram *_program, const QString &_path);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Writes the binary of a linked program.
+  /// @param[in] _program Linked program.
+  /// @param[in] _path File of the binary.
+  //////////////////////////////////////////////////////////////////////////////
+  void save(QOpenGLShaderProgram *_program, const QString &_path);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief OpenGL functions of the context the programs belong to.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLFunctions_4_1_Core *m_funcs;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Vendor, renderer and version strings, part of every key.
+  //////////////////////////////////////////////////////////////////////////////
+  QByteArray m_driver;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Directory of the binaries, empty if they are not cached.
+  //////////////////////////////////////////////////////////////////////////////
+  QString m_directory;
+};
+
+#endif // PROGRAMCACHE_H
@@ -0,0 +1,277 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file RenderGraph.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+// Native
+#include <functional>
+#include <map>
+#include <vector>
+
+// Qt
+#include <QOpenGLFunctions_4_1_Core>
+#include <QOpenGLTexture>
+#include <QString>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class RenderGraph
+/// @brief Passes of a frame declared with the textures they read and write, so
+/// that the framebuffers and the intermediate textures are worked out here.
+///
+/// The graph is declared again every frame. compile() drops the passes whose
+/// outputs nobody reads, the ones that end up on the screen are always kept,
+/// and gives the transient textures of the passes left a texture from a pool.
+/// A texture goes back to the pool after its last reader, so later passes of
+/// the same frame reuse it. execute() binds a framebuffer with the outputs of
+/// each pass, sized like them, and runs it.
+////////////////////////////////////////////////////////////////////////////////
+class RenderGraph
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Handle of a texture in the graph.
+  //////////////////////////////////////////////////////////////////////////////
+  typedef size_t Resource;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Handle of a pass in the graph.
+  //////////////////////////////////////////////////////////////////////////////
+  typedef size_t Pass;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief What a transient texture has to be, textures alike are shared.
+  //////////////////////////////////////////////////////////////////////////////
+  struct TextureDescription
+  {
+    int width;
+    int height;
+    QOpenGLTexture::TextureFormat format;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor, nothing is allocated until a frame is compiled.
+  //////////////////////////////////////////////////////////////////////////////
+  RenderGraph();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Sets the functions used for the framebuffers.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  //////////////////////////////////////////////////////////////////////////////
+  void initialize(QOpenGLFunctions_4_1_Core *_funcs);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Deletes the pooled textures and the framebuffers, the context has
+  /// to be current.
+  //////////////////////////////////////////////////////////////////////////////
+  void releaseTextures();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Deletes the framebuffers an imported texture is attached to, to
+  /// call before deleting it.
+  /// @param[in] _texture The texture.
+  //////////////////////////////////////////////////////////////////////////////
+  void forgetTexture(const QOpenGLTexture *_texture);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Forgets the passes and resources of the previous frame.
+  //////////////////////////////////////////////////////////////////////////////
+  void reset();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Declares a texture that only lives during the frame.
+  /// @param[in] _name Name for the logs.
+  /// @param[in] _description Size and format.
+  /// @returns The handle.
+  //////////////////////////////////////////////////////////////////////////////
+  Resource createTexture(const QString &_name, const TextureDescription &_description);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Declares a texture owned outside, that outlives the frame.
+  /// @param[in] _name Name for the logs.
+  /// @param[in] _texture The texture.
+  /// @returns The handle.
+  //////////////////////////////////////////////////////////////////////////////
+  Resource importTexture(const QString &_name, QOpenGLTexture *_texture);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Declares the framebuffer shown on screen, passes writing to it are
+  /// never culled.
+  /// @param[in] _framebuffer Framebuffer object name.
+  /// @param[in] _width Width of the framebuffer.
+  /// @param[in] _height Height of the framebuffer.
+  /// @returns The handle.
+  //////////////////////////////////////////////////////////////////////////////
+  Resource importBackbuffer(GLuint _framebuffer, int _width, int _height);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Adds a pass after the ones already added.
+  /// @param[in] _name Name for the logs.
+  /// @param[in] _execute Draws the pass, its outputs are already bound.
+  /// @returns The handle.
+  //////////////////////////////////////////////////////////////////////////////
+  Pass addPass(const QString &_name, const std::function<void()> &_execute);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Declares that a pass samples a texture.
+  /// @param[in] _pass The pass.
+  /// @param[in] _resource The texture.
+  //////////////////////////////////////////////////////////////////////////////
+  void read(Pass _pass, Resource _resource);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Declares that a pass draws to a texture. Outputs are attached in
+  /// the order they are declared, depth formats to the depth attachment.
+  /// @param[in] _pass The pass.
+  /// @param[in] _resource The texture.
+  //////////////////////////////////////////////////////////////////////////////
+  void write(Pass _pass, Resource _resource);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Culls the passes not needed and assigns the transient textures.
+  //////////////////////////////////////////////////////////////////////////////
+  void compile();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Runs the passes left by compile() in order.
+  //////////////////////////////////////////////////////////////////////////////
+  void execute();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Texture behind a handle, only valid while the frame executes.
+  /// @param[in] _resource The handle.
+  /// @returns The texture.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLTexture *texture(Resource _resource) const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether compile() dropped a pass.
+  /// @param[in] _pass The pass.
+  /// @returns True if it will not run.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isCulled(Pass _pass) const;
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief A texture declared in the frame.
+  //////////////////////////////////////////////////////////////////////////////
+  struct ResourceNode
+  {
+    QString name;
+    TextureDescription description;
+    QOpenGLTexture *texture;
+    GLuint framebuffer;
+    bool imported;
+    bool backbuffer;
+    bool needed;
+    size_t firstUse;
+    size_t lastUse;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief A pass declared in the frame.
+  //////////////////////////////////////////////////////////////////////////////
+  struct PassNode
+  {
+    QString name;
+    std::function<void()> execute;
+    std::vector<Resource> reads;
+    std::vector<Resource> writes;
+    bool culled;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief A texture of the pool.
+  //////////////////////////////////////////////////////////////////////////////
+  struct PooledTexture
+  {
+    QOpenGLTexture *texture;
+    TextureDescription description;
+    bool busy;
+    unsigned lastFrame;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Takes a free pooled texture like the description, or makes one.
+  /// @param[in] _description Size and format.
+  /// @returns The texture.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLTexture *acquire(const TextureDescription &_description);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Gives a texture back to the pool.
+  /// @param[in] _texture The texture.
+  //////////////////////////////////////////////////////////////////////////////
+  void release(QOpenGLTexture *_texture);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Deletes the pooled textures unused for a while, and their
+  /// framebuffers.
+  //////////////////////////////////////////////////////////////////////////////
+  void trim();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Binds the framebuffer and the viewport of the outputs of a pass.
+  /// @param[in] _pass The pass.
+  //////////////////////////////////////////////////////////////////////////////
+  void bindOutputs(const PassNode &_pass);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Finds or creates the framebuffer with some textures attached.
+  /// @param[in] _colours Colour attachments, in order.
+  /// @param[in] _depth Depth attachment, may be null.
+  /// @returns The framebuffer object name.
+  //////////////////////////////////////////////////////////////////////////////
+  GLuint framebuffer(const std::vector<QOpenGLTexture*> &_colours, QOpenGLTexture *_depth);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether a format goes to the depth attachment.
+  /// @param[in] _format The format.
+  /// @returns True for depth formats.
+  //////////////////////////////////////////////////////////////////////////////
+  static bool isDepthFormat(QOpenGLTexture::TextureFormat _format);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Frames a pooled texture stays around unused before it is deleted,
+  /// so going back and forth between modes does not allocate every time.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr unsigned m_max_idle_frames = 120;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief OpenGL functions of the context.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLFunctions_4_1_Core *m_funcs;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Passes and resources of this frame.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<PassNode> m_passes;
+  std::vector<ResourceNode> m_resources;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Transient textures, kept from frame to frame. Going back to a
+  /// window size soon after leaving it finds its textures still here.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<PooledTexture> m_pool;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Framebuffers by the texture ids attached, depth last.
+  //////////////////////////////////////////////////////////////////////////////
+  std::map<std::vector<GLuint>, GLuint> m_framebuffers;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Frames compiled.
+  //////////////////////////////////////////////////////////////////////////////
+  unsigned m_frame;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Passes that ran last time, to log when it changes.
+  //////////////////////////////////////////////////////////////////////////////
+  QString m_live_passes;
+};
+
+#endif // RENDERGRAPH_H
@@ -0,0 +1,104 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ShaderPermutations.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHADERPERMUTATIONS_H
+#define SHADERPERMUTATIONS_H
+
+// Native
+#include <functional>
+#include <map>
+#include <memory>
+
+// Qt
+#include <QOpenGLShaderProgram>
+#include <QString>
+#include <QStringList>
+
+// Project
+#include "ProgramCache.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class ShaderPermutations
+/// @brief Builds specialised programs out of the same pair of shaders.
+///
+/// Each permutation is the shaders compiled with a set of #define lines right
+/// after their #version line, so the preprocessor removes the branches a
+/// permutation does not take instead of choosing them at run time. Programs
+/// are built the first time their permutation is asked for and kept.
+////////////////////////////////////////////////////////////////////////////////
+class ShaderPermutations
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Called on every program right after linking it, to set what the
+  /// sources cannot: sampler units, uniform block bindings...
+  //////////////////////////////////////////////////////////////////////////////
+  typedef std::function<void(QOpenGLShaderProgram*)> LinkCallback;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor, reads the sources.
+  /// @param[in] _cache Builds the programs.
+  /// @param[in] _vertex Path of the vertex shader.
+  /// @param[in] _fragment Path of the fragment shader.
+  /// @param[in] _onLink Setup of every linked program.
+  //////////////////////////////////////////////////////////////////////////////
+  ShaderPermutations(
+      ProgramCache *_cache,
+      const QString &_vertex,
+      const QString &_fragment,
+      LinkCallback _onLink);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Program of a permutation, built if it is the first time. Needs a
+  /// current OpenGL context.
+  /// @param[in] _defines Macros to define, in any order.
+  /// @returns The program.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLShaderProgram *get(QStringList _defines);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Deletes every program built so far. Needs a current OpenGL
+  /// context.
+  //////////////////////////////////////////////////////////////////////////////
+  void clear();
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Inserts the defines after the #version line.
+  /// @param[in] _source Shader source.
+  /// @param[in] _defines Macros to define.
+  /// @returns The specialised source.
+  //////////////////////////////////////////////////////////////////////////////
+  static QByteArray specialise(const QByteArray &_source, const QStringList &_defines);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Builds the programs.
+  //////////////////////////////////////////////////////////////////////////////
+  ProgramCache *m_cache;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Vertex shader source.
+  //////////////////////////////////////////////////////////////////////////////
+  QByteArray m_vertex_source;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Fragment shader source.
+  //////////////////////////////////////////////////////////////////////////////
+  QByteArray m_fragment_source;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Setup of every linked program.
+  //////////////////////////////////////////////////////////////////////////////
+  LinkCallback m_on_link;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Programs built so far, by their sorted defines.
+  //////////////////////////////////////////////////////////////////////////////
+  std::map<QString, std::unique_ptr<QOpenGLShaderProgram>> m_programs;
+};
+
+#endif // SHADERPERMUTATIONS_H
@@ -13,9 +13,17 @@
 #ifndef SKYBOX_H
 #define SKYBOX_H
 
+// Native
+#include <list>
+#include <map>
+#include <memory>
+
 // Qt
+#include <QFile>
+#include <QFuture>
+#include <QImage>
+#include <QStringList>
 #include <QOpenGLBuffer>
-#include <QOpenGLFramebufferObject>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
 #include <QOpenGLVertexArrayObject>
@@ -23,10 +31,23 @@
 
 // Project
 #include "InputManager.h"
+#include "ProgramCache.h"
+#include "SkyFile.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 /// @class SkyBox
 /// @brief Wraps all the code related to the sky environment.
+///
+/// The background is blurred by sampling a lower level of the mip chain of the
+/// cube map, built once every time the background changes.
+///
+/// The faces are decoded on the global thread pool and uploaded by update()
+/// on the rendering thread. Uploaded cube maps are kept, up to a budget, so
+/// going back to a background is immediate.
+///
+/// A background baked by tools/skybaker into skies/<name>.sky, next to the
+/// executable, is used instead of the images. It is mapped and uploaded
+/// straight from the mapping with its mip levels, nothing is decoded.
 ////////////////////////////////////////////////////////////////////////////////
 class SkyBox
 {
@@ -44,11 +65,36 @@ public:
   ~SkyBox();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Changes the skybox map.
+  /// @brief Changes the skybox map. If it is not cached the current one stays
+  /// until the new one is decoded. Needs no OpenGL context.
   /// \param _name Name of the skybox from the resource file.
   //////////////////////////////////////////////////////////////////////////////
   void setBackground(QString _name);
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Starts decoding every background not cached yet that fits in the
+  /// budget without evicting anything.
+  //////////////////////////////////////////////////////////////////////////////
+  void prefetch();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uploads at most one decoded background, to be called every frame
+  /// with the context current.
+  //////////////////////////////////////////////////////////////////////////////
+  void update();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether some background is still being decoded.
+  /// @return True while decoding.
+  //////////////////////////////////////////////////////////////////////////////
+  bool isLoading() const {return !m_pending.empty();}
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Names of the bundled backgrounds, in the order of the interface.
+  /// @return The names.
+  //////////////////////////////////////////////////////////////////////////////
+  static QStringList backgrounds();
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief How many iterations to blur the image.
   /// \param _value Number of iterations.
@@ -56,12 +102,11 @@ public:
   void setBlurIterations(uint _value);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Sets up the pipeline of textures and FBOs for the sky map.
-  /// @param _width Width of the viewport.
-  /// @param _height Height of the viewport.
+  /// @brief Sets up the geometry, shader and cube map for the sky map.
   /// @param _funcs OpenGL functions extracted from the right OpenGL context.
+  /// @param _cache Builds the sky program.
   //////////////////////////////////////////////////////////////////////////////
-  void prepare(int _width, int _height, QOpenGLFunctions_4_1_Core *_funcs);
+  void prepare(QOpenGLFunctions_4_1_Core *_funcs, ProgramCache &_cache);
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Draws the sky map to the default framebuffer.
@@ -71,10 +116,17 @@ public:
 
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Getter of the cube map for external use.
-  /// @return The cube map texture.
+  /// @return The cube map texture, null until the first one is uploaded.
   //////////////////////////////////////////////////////////////////////////////
   QOpenGLTexture *getCubeMapTexture() {return m_cubemap_texture;}
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Getter of the sky program, to point its camera block to the
+  /// shared uniform buffer.
+  /// @return The sky program.
+  //////////////////////////////////////////////////////////////////////////////
+  QOpenGLShaderProgram *getProgram() {return m_sky_program;}
+
 private:
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Paired InputManager
@@ -86,6 +138,22 @@ private:
   //////////////////////////////////////////////////////////////////////////////
   uint m_blur_iterations;
 
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Mip level of the cube map giving about the same blur as the
+  /// iterations did.
+  //////////////////////////////////////////////////////////////////////////////
+  float m_blur_level;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Location of the BlurLevel uniform.
+  //////////////////////////////////////////////////////////////////////////////
+  GLint m_blur_level_location;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Width in texels of a face of the cube map.
+  //////////////////////////////////////////////////////////////////////////////
+  int m_face_size;
+
   //////////////////////////////////////////////////////////////////////////////
   /// @brief Holds the vertex data for a big cube.
   //////////////////////////////////////////////////////////////////////////////
@@ -102,34 +170,137 @@ private:
   QOpenGLShaderProgram *m_sky_program;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Cubemap texture where it will sample.
+  /// @brief Cubemap texture where it will sample, owned by m_cubemaps.
   //////////////////////////////////////////////////////////////////////////////
   QOpenGLTexture *m_cubemap_texture;
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Screen drawing of the scene. It will get blurred many times.
+  /// @brief An uploaded background.
+  //////////////////////////////////////////////////////////////////////////////
+  struct Cubemap
+  {
+    QOpenGLTexture *texture;
+    int faceSize;
+    size_t bytes;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief A background being decoded, one result per face, or a baked one
+  /// mapped and ready to upload.
+  //////////////////////////////////////////////////////////////////////////////
+  struct Decode
+  {
+    QFuture<QImage> faces;
+    std::shared_ptr<QFile> baked;
+    const uchar *data;
+    SkyFileHeader header;
+    bool prefetch;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uploaded backgrounds by name.
+  //////////////////////////////////////////////////////////////////////////////
+  std::map<QString, Cubemap> m_cubemaps;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Names in m_cubemaps, most recently shown first.
+  //////////////////////////////////////////////////////////////////////////////
+  std::list<QString> m_recent;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Backgrounds being decoded by name.
+  //////////////////////////////////////////////////////////////////////////////
+  std::map<QString, Decode> m_pending;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Background asked for last, shown as soon as it is uploaded.
+  //////////////////////////////////////////////////////////////////////////////
+  QString m_requested;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Bytes taken by m_cubemaps, mip levels included.
+  //////////////////////////////////////////////////////////////////////////////
+  size_t m_cache_bytes;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Bytes of cube maps kept before evicting the least recently shown.
+  /// All the bundled 512 texel backgrounds fit, the 2048 texel one does not.
+  //////////////////////////////////////////////////////////////////////////////
+  static constexpr size_t m_cache_budget = 64 << 20;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Starts decoding a background on the thread pool.
+  /// @param _name Background name.
+  /// @param _prefetch Whether nobody asked for it yet.
+  //////////////////////////////////////////////////////////////////////////////
+  void decode(const QString &_name, bool _prefetch);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Maps the baked file of a background.
+  /// @param _name Background name.
+  /// @param _decode Filled with the mapping if there is a valid file.
+  /// @return True if the background is baked.
+  //////////////////////////////////////////////////////////////////////////////
+  static bool mapBaked(const QString &_name, Decode &_decode);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Where the baked file of a background would be.
+  /// @param _name Background name.
+  /// @return The path, next to the executable.
+  //////////////////////////////////////////////////////////////////////////////
+  static QString bakedPath(const QString &_name);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Reads the face size of a background without decoding it.
+  /// @param _name Background name.
+  /// @return Width of a face, or -1 if it can not be read.
+  //////////////////////////////////////////////////////////////////////////////
+  static int faceSize(const QString &_name);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Decodes a face, runs on a worker thread.
+  /// @param _path Resource of the face.
+  /// @return The face in RGB888.
+  //////////////////////////////////////////////////////////////////////////////
+  static QImage decodeFace(const QString &_path);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Memory taken by a cube map.
+  /// @param _size Width of a face.
+  /// @return Bytes, mip levels included.
+  //////////////////////////////////////////////////////////////////////////////
+  static size_t cubemapBytes(int _size);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Uploads decoded faces into a new cube map.
+  /// @param _faces The six faces.
+  /// @return The cube map, with a null texture if a face failed.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLTexture* m_painted_sky;
+  Cubemap upload(const QList<QImage> &_faces);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief FBO for the blurring.
+  /// @brief Uploads every level of a mapped baked file into a new cube map.
+  /// @param _decode The mapping.
+  /// @return The cube map.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLFramebufferObject *m_fbo;
+  Cubemap uploadBaked(const Decode &_decode);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the state of quad geometry.
+  /// @brief Starts showing a cached background.
+  /// @param _name Background name.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLVertexArrayObject *m_quad_vao;
+  void show(const QString &_name);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Holds the vertex data of quad geometry.
+  /// @brief Deletes the least recently shown cube maps until the cache is
+  /// within budget. The one on screen stays.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLBuffer m_quad_vbo;
+  void evict();
 
   //////////////////////////////////////////////////////////////////////////////
-  /// @brief Does the blurring on the texture that's fed in.
+  /// @brief Works out m_blur_level from the iterations and the face size.
   //////////////////////////////////////////////////////////////////////////////
-  QOpenGLShaderProgram *m_blur_program;
+  void updateBlurLevel();
 
 };
 
@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file SkyFile.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SKYFILE_H
+#define SKYFILE_H
+
+// Native
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Layout of the .sky files written by tools/skybaker and mapped by SkyBox.
+//
+// A header, then every mip level from the largest down to 1x1 texel. Each
+// level holds the six faces in cube map order (+x +y +z -x -y -z), each face
+// tightly packed RGB8 rows. Everything is in the byte order of the machine
+// that baked it, files are meant to be baked where they are used.
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Start of a .sky file.
+////////////////////////////////////////////////////////////////////////////////
+struct SkyFileHeader
+{
+  char magic[4];     ///< Always "SKY1"
+  uint32_t faceSize; ///< Width and height of the faces of level 0
+  uint32_t levels;   ///< Mip levels stored
+  uint32_t format;   ///< Pixel format of the faces, only SKY_FORMAT_RGB8 so far
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Tightly packed 8 bit RGB faces.
+////////////////////////////////////////////////////////////////////////////////
+static const uint32_t SKY_FORMAT_RGB8 = 0;
+
+static_assert(sizeof(SkyFileHeader) == 16, "SkyFileHeader must not be padded");
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Width of a face at a mip level.
+/// @param _faceSize Width of level 0.
+/// @param _level Mip level.
+/// @return The width, at least one.
+////////////////////////////////////////////////////////////////////////////////
+inline uint32_t skyLevelSize(uint32_t _faceSize, uint32_t _level)
+{
+  return std::max(_faceSize >> _level, 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes of one face at a mip level.
+/// @param _faceSize Width of level 0.
+/// @param _level Mip level.
+/// @return The size in bytes.
+////////////////////////////////////////////////////////////////////////////////
+inline size_t skyFaceBytes(uint32_t _faceSize, uint32_t _level)
+{
+  const size_t size = skyLevelSize(_faceSize, _level);
+  return size * size * 3;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes of a whole file.
+/// @param _header Its header.
+/// @return The size in bytes.
+////////////////////////////////////////////////////////////////////////////////
+inline size_t skyFileBytes(const SkyFileHeader &_header)
+{
+  size_t bytes = sizeof(SkyFileHeader);
+  for (uint32_t level = 0; level < _header.levels; ++level)
+  {
+    bytes += 6 * skyFaceBytes(_header.faceSize, level);
+  }
+  return bytes;
+}
+
+#endif // SKYFILE_H
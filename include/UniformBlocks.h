@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file UniformBlocks.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+// Qt
+#include <QOpenGLFunctions_4_1_Core>
+#include <QVector3D>
+
+// Mirrors of the uniform blocks of the shaders in std140 layout. Every vec3
+// starts on 16 bytes, a following float can take the last four, and structs
+// are padded to multiples of 16. Matrices are column major like QMatrix4x4.
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief CameraBlock, binding 1. Used by nearly every program.
+////////////////////////////////////////////////////////////////////////////////
+struct CameraBlock
+{
+  GLfloat model[16];
+  GLfloat view[16];
+  GLfloat projection[16];
+  GLfloat inverseProjection[16];
+  GLfloat inverseModelView[16];
+
+  // mat3, one vec4 per column. Takes the normals of the G-buffer from view
+  // space to world space.
+  GLfloat worldNormal[12];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief LightsBlock, binding 2. Key and fill lights of the lighting pass.
+////////////////////////////////////////////////////////////////////////////////
+struct LightsBlock
+{
+  // Light light
+  GLfloat position[3];
+  GLfloat pad0;
+  GLfloat ambient[3];
+  GLfloat pad1;
+  GLfloat diffuse[3];
+  GLfloat pad2;
+  GLfloat specular[3];
+  GLfloat linear;
+  GLfloat quadratic;
+  GLfloat pad3[3];
+
+  // FillLight fillLight
+  GLfloat fillPosition[3];
+  GLfloat pad4;
+  GLfloat fillAmbient[3];
+  GLfloat pad5;
+  GLfloat fillDiffuse[3];
+  GLfloat pad6;
+  GLfloat fillSpecular[3];
+  GLfloat pad7;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief MaterialBlock, binding 3. Surface of the particles.
+////////////////////////////////////////////////////////////////////////////////
+struct MaterialBlock
+{
+  GLfloat ambient[3];
+  GLfloat pad0;
+  GLfloat diffuse[3];
+  GLfloat pad1;
+  GLfloat specular[3];
+  GLfloat shininess;
+  GLfloat attenuation;
+  GLfloat pad2[3];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Writes a vector into a vec3 member of a block.
+/// @param[in] _v Vector to copy.
+/// @param[out] _out First of the three floats of the member.
+////////////////////////////////////////////////////////////////////////////////
+inline void copyVector(const QVector3D &_v, GLfloat *_out)
+{
+  _out[0] = _v.x();
+  _out[1] = _v.y();
+  _out[2] = _v.z();
+}
+
+static_assert(sizeof(CameraBlock) == 368, "CameraBlock does not match std140");
+static_assert(sizeof(LightsBlock) == 144, "LightsBlock does not match std140");
+static_assert(sizeof(MaterialBlock) == 64, "MaterialBlock does not match std140");
+
+#endif // UNIFORMBLOCKS_H
@@ -0,0 +1,104 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file UniformBuffer.h
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef UNIFORMBUFFER_H
+#define UNIFORMBUFFER_H
+
+// Native
+#include <vector>
+
+// Qt
+#include <QOpenGLFunctions_4_1_Core>
+#include <QOpenGLShaderProgram>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class UniformBuffer
+/// @brief Uniform buffer object bound to a fixed binding point, shared by every
+/// program declaring the block.
+///
+/// A copy of the contents is kept on the CPU. Setting data equal to the copy
+/// does nothing, so the buffer can be fed every frame and it only reaches
+/// OpenGL when something changed.
+////////////////////////////////////////////////////////////////////////////////
+class UniformBuffer
+{
+
+public:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Constructor, no OpenGL work happens until create().
+  //////////////////////////////////////////////////////////////////////////////
+  UniformBuffer();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Allocates the buffer, filled with zeros, and binds it.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  /// @param[in] _binding Uniform buffer binding point.
+  /// @param[in] _size Size in bytes of the block, std140 layout.
+  //////////////////////////////////////////////////////////////////////////////
+  void create(QOpenGLFunctions_4_1_Core *_funcs, GLuint _binding, GLsizeiptr _size);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Deletes the buffer.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  //////////////////////////////////////////////////////////////////////////////
+  void destroy(QOpenGLFunctions_4_1_Core *_funcs);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Points a block of a program to the binding of this buffer. Does
+  /// nothing if the program has no such block.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  /// @param[in] _program Linked program.
+  /// @param[in] _block Name of the block in the shaders.
+  //////////////////////////////////////////////////////////////////////////////
+  void attach(
+      QOpenGLFunctions_4_1_Core *_funcs,
+      QOpenGLShaderProgram *_program,
+      const char *_block) const;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Replaces the contents, marking them for upload if they differ.
+  /// @param[in] _data Block with the std140 layout.
+  /// @param[in] _size Size in bytes, up to the size given to create().
+  //////////////////////////////////////////////////////////////////////////////
+  void setData(const void *_data, GLsizeiptr _size);
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Replaces the contents with a struct mirroring the block.
+  /// @param[in] _block The struct.
+  //////////////////////////////////////////////////////////////////////////////
+  template <typename T>
+  void setData(const T &_block) { setData(&_block, sizeof(T)); }
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Sends the contents to OpenGL if they changed since the last time.
+  /// @param[in] _funcs OpenGL functions of the current context.
+  /// @returns True if the buffer was written.
+  //////////////////////////////////////////////////////////////////////////////
+  bool upload(QOpenGLFunctions_4_1_Core *_funcs);
+
+private:
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief OpenGL buffer name.
+  //////////////////////////////////////////////////////////////////////////////
+  GLuint m_buffer;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Binding point the buffer is bound to.
+  //////////////////////////////////////////////////////////////////////////////
+  GLuint m_binding;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Copy of the contents.
+  //////////////////////////////////////////////////////////////////////////////
+  std::vector<char> m_data;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// @brief Whether m_data has not been uploaded yet.
+  //////////////////////////////////////////////////////////////////////////////
+  bool m_dirty;
+};
+
+#endif // UNIFORMBUFFER_H
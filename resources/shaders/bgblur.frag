@@ -1,46 +0,0 @@
-#version 410 core
-
-out vec3 fColor;
-
-in vec2 vTexCoords;
-
-uniform sampler2D tInputBG;
-
-
-const float offset = 1.0 / 300;  
-
-void main() {
-  vec2 offsets[9] = vec2[](
-        vec2(-offset, offset),  // top-left
-        vec2(0.0f,    offset),  // top-center
-        vec2(offset,  offset),  // top-right
-        vec2(-offset, 0.0f),    // center-left
-        vec2(0.0f,    0.0f),    // center-center
-        vec2(offset,  0.0f),    // center-right
-        vec2(-offset, -offset), // bottom-left
-        vec2(0.0f,    -offset), // bottom-center
-        vec2(offset,  -offset)  // bottom-right    
-    );
-
-    float kernel[9] = float[](
-        1.0 / 16, 2.0 / 16, 1.0 / 16,
-        2.0 / 16, 4.0 / 16, 2.0 / 16,
-        1.0 / 16, 2.0 / 16, 1.0 / 16  
-    );
-
-    vec3 sampleTex[9];
-
-    for(int i = 0; i < 9; i++)
-    {
-        sampleTex[i] = vec3(texture(tInputBG, vTexCoords.st + offsets[i]));
-    }
-
-    vec3 col = vec3(0.0, 0.0, 0.0);
-    for(int i = 0; i < 9; i++)
-    {
-        col += kernel[i] * sampleTex[i];
-    }
-
-
-  fColor = col.rgb;
-}
@@ -1,29 +1,39 @@
 #version 410 core
 
-out float fColor;
+out vec2 fColor;
 
 in vec2 vTexCoords;
 
-uniform sampler2D tInputSSAO;
+uniform sampler2D tInputSSAO; // Occlusion and linear depth
+uniform vec2 Direction;       // (1, 0) for the horizontal pass, (0, 1) vertical
 
-int blurAmount = 2; // uniform int blurAmount;
+// Gaussian weights from the centre outwards
+const int Radius = 4;
+const float Weights[5] = float[](0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
 
+// Neighbours further than this fraction of the depth are another surface
+const float DepthTolerance = 0.05;
+
+// Separable bilateral blur, run once along each axis. Texels across a depth
+// edge are left out so the occlusion does not bleed onto the background.
 void main() {
     vec2 texelSize = 1.0 / vec2(textureSize(tInputSSAO, 0));
-    float result = 0.0;
+    vec2 centre = texture(tInputSSAO, vTexCoords).rg;
+
+    float result = centre.r * Weights[0];
+    float total = Weights[0];
 
-    if (blurAmount > 1) {
-        for (int x = -blurAmount; x < blurAmount; ++x)
+    for (int i = 1; i <= Radius; ++i)
+    {
+        for (int side = -1; side <= 1; side += 2)
         {
-            for (int y = -blurAmount; y < blurAmount; ++y) {
-                vec2 offset = vec2(float(x), float(y)) * texelSize;
-                result += texture(tInputSSAO, vTexCoords + offset).r;
-            }
+            vec2 offset = Direction * texelSize * float(i * side);
+            vec2 neighbour = texture(tInputSSAO, vTexCoords + offset).rg;
+            float weight = Weights[i] * step(abs(neighbour.g - centre.g), DepthTolerance * centre.g);
+            result += neighbour.r * weight;
+            total += weight;
         }
-        result /= float(blurAmount*blurAmount*blurAmount*blurAmount);
-    } else {
-        result += texture(tInputSSAO, vTexCoords).r;
     }
 
-    fColor = result;
+    fColor = vec2(result / total, centre.g);
 }
@@ -0,0 +1,11 @@
+#version 410 core
+
+in vec2 vTexCoords;
+
+uniform sampler2D tDepth;
+
+// Copies the depth of the gBuffer to the bound framebuffer. Nothing else is
+// written, the colour has to be masked while drawing.
+void main() {
+    gl_FragDepth = texture(tDepth, vTexCoords).r;
+}
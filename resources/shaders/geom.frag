@@ -1,18 +1,23 @@
 #version 410 core
 
-in vec3 vWorldPosition;
-in vec3 vViewPosition;
-in vec3 vWorldNormal;
+in vec3 vViewNormal;
 
-layout (location = 0) out vec4 gWorldPositionPass; // GL_COLOR_ATTACHMENT0
-layout (location = 1) out vec4 gViewPositionPass;  // GL_COLOR_ATTACHMENT1
-layout (location = 2) out vec4 gWorldNormalPass;   // GL_COLOR_ATTACHMENT2
+layout (location = 0) out vec4 gViewNormalPass; // GL_COLOR_ATTACHMENT0
 
-// We export each pass with alphas for the XRay shader to work. In the actual
-// textures no alpha is gonna be stored. It is just for the OpenGL blending
+// Octahedral encoding: the unit sphere folded onto a square, two components
+// are enough to store a normal. Positions come from the depth buffer.
+vec2 signNotZero(vec2 v) {
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+}
+
+// We export the pass with alpha for the XRay shader to work. In the actual
+// texture no alpha is gonna be stored. It is just for the OpenGL blending
 // and OpenGL culling to work properly.
 void main() {
-    gWorldPositionPass = vec4(vWorldPosition, 1.0);
-    gViewPositionPass = vec4(vViewPosition, 1.0);
-    gWorldNormalPass = vec4(vWorldNormal, 1.0);
+    gViewNormalPass = vec4(encodeNormal(normalize(vViewNormal)), 0.0, 1.0);
 }
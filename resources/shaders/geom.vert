@@ -1,24 +1,28 @@
 #version 410 core
 
 // Uniforms
-uniform mat4 ProjectionMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 ModelMatrix;
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
 
 // Ins
-in vec3 position;
-in vec4 instances; // Each instance will have x,y,z and w (radius)
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec4 instances; // Each instance will have x,y,z and w (radius)
 
 // Outs
-out vec3 vWorldPosition;
-out vec3 vViewPosition;
-out vec3 vWorldNormal;
+out vec3 vViewNormal;
 
 void main(void)
 {
-    vWorldPosition = instances.w * position + instances.xyz;
-    vViewPosition = vec4(ViewMatrix * ModelMatrix * vec4(vWorldPosition, 1.0)).xyz;
-    vWorldNormal = normalize(position);
+    mat4 modelView = ViewMatrix * ModelMatrix;
+    vec3 worldPosition = instances.w * position + instances.xyz;
+    vViewNormal = mat3(modelView) * normalize(position);
 
-    gl_Position = ProjectionMatrix * vec4(vViewPosition, 1.0);
+    gl_Position = ProjectionMatrix * modelView * vec4(worldPosition, 1.0);
 }
@@ -0,0 +1,50 @@
+#version 410 core
+
+// Uniforms
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
+
+in vec3 vViewPosition;
+flat in vec3 vViewCentre;
+flat in float vRadius;
+
+layout (location = 0) out vec4 gViewNormalPass; // GL_COLOR_ATTACHMENT0
+
+vec2 signNotZero(vec2 v) {
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+}
+
+// Same outputs as geom.frag, but the sphere is ray cast against the quad
+// instead of being rasterised from triangles.
+void main() {
+    // The camera sits at the origin of view space
+    vec3 direction = normalize(vViewPosition);
+
+    float b = dot(direction, vViewCentre);
+    float c = dot(vViewCentre, vViewCentre) - vRadius * vRadius;
+    float h = b * b - c;
+    if (h < 0.0) discard;
+
+    // Nearest of the two hits
+    vec3 viewPosition = direction * (b - sqrt(h));
+    vec3 viewNormal = (viewPosition - vViewCentre) / vRadius;
+
+    // Depth of the hit instead of the depth of the quad
+    vec4 clip = ProjectionMatrix * vec4(viewPosition, 1.0);
+    float ndcDepth = clip.z / clip.w;
+    gl_FragDepth = (gl_DepthRange.diff * ndcDepth + gl_DepthRange.near + gl_DepthRange.far) * 0.5;
+
+    gViewNormalPass = vec4(encodeNormal(viewNormal), 0.0, 1.0);
+}
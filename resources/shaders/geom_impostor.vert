@@ -0,0 +1,42 @@
+#version 410 core
+
+// Uniforms
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
+
+// Ins
+layout (location = 0) in vec3 position;  // Corner of the quad, from -1 to 1 in x and y
+layout (location = 1) in vec4 instances; // Each instance will have x,y,z and w (radius)
+
+// Outs
+out vec3 vViewPosition;
+flat out vec3 vViewCentre;
+flat out float vRadius;
+
+void main(void)
+{
+    vViewCentre = vec4(ViewMatrix * ModelMatrix * vec4(instances.xyz, 1.0)).xyz;
+    vRadius = instances.w;
+
+    // The quad lies on the plane through the centre perpendicular to the ray
+    // from the camera, so it faces the camera anywhere on screen. On that
+    // plane the cone of rays touching the sphere is a circle larger than the
+    // radius, grow the quad so that it is covered.
+    float d2 = dot(vViewCentre, vViewCentre);
+    float scale = sqrt(d2 / max(d2 - vRadius * vRadius, 1e-4));
+
+    vec3 axis = vViewCentre / sqrt(max(d2, 1e-8));
+    vec3 up = abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 right = normalize(cross(up, axis));
+    up = cross(axis, right);
+
+    vViewPosition = vViewCentre + (position.x * right + position.y * up) * vRadius * scale;
+    gl_Position = ProjectionMatrix * vec4(vViewPosition, 1.0);
+}
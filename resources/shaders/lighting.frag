@@ -1,5 +1,12 @@
 #version 410 core
 
+// Built once per render mode with one of RENDER_ADS, RENDER_XRAY, RENDER_AO or
+// RENDER_NEW_ORDER defined. SSAO_FULL_RESOLUTION skips the depth aware
+// upsampling when the occlusion is as big as the screen.
+#if !defined(RENDER_ADS) && !defined(RENDER_XRAY) && !defined(RENDER_AO) && !defined(RENDER_NEW_ORDER)
+#define RENDER_ADS
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Inputs & Outputs
 ////////////////////////////////////////////////////////////////////////////////
@@ -38,44 +45,93 @@ struct FillLight {
 ////////////////////////////////////////////////////////////////////////////////
 /// Textures
 ////////////////////////////////////////////////////////////////////////////////
-uniform sampler2D tWorldPosition;   //Real position in 3D space
-uniform sampler2D tWorldNormal;
-uniform sampler2D tSSAO;
+uniform sampler2D tDepth;      // Positions are rebuilt from it
+uniform sampler2D tViewNormal; // Octahedral encoded
+uniform sampler2D tSSAO;       // Occlusion and linear depth, maybe half size
 uniform samplerCube tSkyBox; // Cubemap
 
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Uniforms
 ////////////////////////////////////////////////////////////////////////////////
-uniform Material material;
-uniform Light light;
-uniform FillLight fillLight;
-uniform bool drawLinks;
+layout (std140) uniform LightsBlock
+{
+    Light light;
+    FillLight fillLight;
+};
+
+layout (std140) uniform MaterialBlock
+{
+    Material material;
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 ///Matricies
 ////////////////////////////////////////////////////////////////////////////////
-uniform mat4 ModelMatrix;
-uniform mat4 ViewMatrix;
-mat3 normalMatrix = transpose(inverse(mat3(ViewMatrix * ModelMatrix)));
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix; // From view space normals to world space
+};
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Globals
 ////////////////////////////////////////////////////////////////////////////////
-vec3 WorldPosition = texture(tWorldPosition, vTexCoords).xyz;
-vec3 ViewPosition  = vec3(ViewMatrix * ModelMatrix * vec4(WorldPosition, 1.0)).xyz;
-vec3 WorldNormal = normalize(texture(tWorldNormal, vTexCoords).xyz);
-vec3 ViewNormal  = normalize(normalMatrix * WorldNormal);
-float Occlusion = texture(tSSAO, vTexCoords).r;
+vec3 decodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
+vec3 viewPositionFromDepth(float depth)
+{
+    vec4 position = InverseProjectionMatrix * vec4(vec3(vTexCoords, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
 
-////////////////////////////////////////////////////////////////////////////////
-/// Subroutine definition
-////////////////////////////////////////////////////////////////////////////////
-subroutine vec4 RenderType();
-subroutine uniform RenderType RenderTypeSelection;
+// Filled in by main() with what the render mode needs
+vec3 ViewPosition;
+vec3 ViewNormal;
+vec3 WorldPosition;
+vec3 WorldNormal;
+float Occlusion;
+
+// Bilinear upsampling of the occlusion that favours the texels at the depth of
+// this pixel, so that the occlusion does not leak across silhouettes.
+float upsampleOcclusion()
+{
+#ifdef SSAO_FULL_RESOLUTION
+    return texture(tSSAO, vTexCoords).r;
+#else
+    float depth = -ViewPosition.z;
+    ivec2 size = textureSize(tSSAO, 0);
+    vec2 coord = vTexCoords * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(coord));
+    vec2 f = fract(coord);
+
+    float result = 0.0;
+    float total = 0.0;
+    for (int y = 0; y < 2; ++y)
+    {
+        for (int x = 0; x < 2; ++x)
+        {
+            vec2 texel = texelFetch(tSSAO, clamp(base + ivec2(x, y), ivec2(0), size - 1), 0).rg;
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            float weight = bilinear / (1e-3 + abs(texel.g - depth) / max(depth, 1e-3));
+            result += texel.r * weight;
+            total += weight;
+        }
+    }
+    return total > 0.0 ? result / total : 1.0;
+#endif
+}
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -90,7 +146,6 @@ subroutine uniform RenderType RenderTypeSelection;
 /// [online] Learnopengl.com. Available from:
 /// https://learnopengl.com/#!Lighting/Materials [Accessed 21 Feb. 2017].
 ////////////////////////////////////////////////////////////////////////////////
-subroutine (RenderType)
 vec4 ADSRender()
 {
     //Finding the direction of the light.
@@ -143,7 +198,6 @@ vec4 ADSRender()
 /// Available from: http://www.tinysg.de/techGuides/tg2_xray.html
 /// [Accessed 14 Mar. 2017].
 ////////////////////////////////////////////////////////////////////////////////
-subroutine (RenderType)
 vec4 XRayRender()
 {
     //Setting colour to white (we want the edges to be white)
@@ -171,7 +225,6 @@ vec4 XRayRender()
 /// Modern OpenGL. [online] Learnopengl.com. Available from:
 /// https://learnopengl.com/#!Advanced-Lighting/SSAO [Accessed 21 Feb. 2017].
 ////////////////////////////////////////////////////////////////////////////////
-subroutine (RenderType)
 vec4 AORender()
 {
     return vec4(vec3(Occlusion), 1.0);
@@ -182,7 +235,6 @@ vec4 AORender()
 /// NEW ORDER ARTSTYLE
 /// Inspired by Peter Saville and New Order: Technique (Facotry, 1989)
 //////////////////////////////////////////////////////////////////////////////
-subroutine (RenderType)
 vec4 NewOrderRender()
 {
     //Starting with normal view colours.
@@ -197,12 +249,29 @@ vec4 NewOrderRender()
 }
 
 void main() {
-    //Colour set depending on the subroutine selected.
-    vec4 color = RenderTypeSelection();
-
-    //Creating a mask to make background visible.
-    float alpha = WorldPosition.r == 0.0 ? 0.0 : 1.0;
-
-    color *= vec4(alpha);
-    fColor = color ;
+    //Creating a mask to make background visible, nothing was drawn there.
+    float depth = texture(tDepth, vTexCoords).r;
+    if (depth == 1.0)
+    {
+        fColor = vec4(0.0);
+        return;
+    }
+
+    ViewPosition = viewPositionFromDepth(depth);
+    ViewNormal = decodeNormal(texture(tViewNormal, vTexCoords).rg);
+
+    //Colour set depending on the permutation built.
+#if defined(RENDER_ADS)
+    WorldPosition = vec3(InverseModelViewMatrix * vec4(ViewPosition, 1.0));
+    WorldNormal = normalize(WorldNormalMatrix * ViewNormal);
+    fColor = ADSRender();
+#elif defined(RENDER_XRAY)
+    Occlusion = upsampleOcclusion();
+    fColor = XRayRender();
+#elif defined(RENDER_AO)
+    Occlusion = upsampleOcclusion();
+    fColor = AORender();
+#else
+    fColor = NewOrderRender();
+#endif
 }
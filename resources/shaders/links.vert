@@ -1,9 +1,15 @@
 
 #version 410 core
 
-uniform mat4 ProjectionMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 ModelMatrix;
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
 
 in vec3 position;
 
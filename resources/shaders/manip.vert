@@ -8,8 +8,16 @@ out vec3 vNorm;
 out vec3 vPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
 
 uniform float lightScale;
 
@@ -21,9 +29,9 @@ void main()
 
 
     float scaleModifier = lightScale; // change value to match resolution.    = (2 * ObjectSizeOnscreenInPixels / ScreenWidthInPixels)
-    float w = (projection * view * model * vec4(0,0,0,1)).w;
+    float w = (ProjectionMatrix * ViewMatrix * model * vec4(0,0,0,1)).w;
     w *= scaleModifier;
 
-    gl_Position = projection * view * model * vec4(posAttr*w, 1.0f);
+    gl_Position = ProjectionMatrix * ViewMatrix * model * vec4(posAttr*w, 1.0f);
 
 }
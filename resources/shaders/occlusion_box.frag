@@ -0,0 +1,6 @@
+#version 410 core
+
+// Only depth testing matters, the occlusion query counts the samples passing
+// it. Colour and depth writes are disabled while boxes are drawn.
+void main() {
+}
@@ -0,0 +1,34 @@
+#version 410 core
+
+// Uniforms
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
+
+// Textures
+uniform samplerBuffer tBoxes; // Min and max corner of every box, in turn
+
+// Corners of a unit cube, two triangles per face. Bit 0 is x, 1 is y, 2 is z.
+const int Cube[36] = int[36](
+    0, 1, 3, 3, 2, 0,   4, 6, 7, 7, 5, 4,   0, 4, 5, 5, 1, 0,
+    2, 3, 7, 7, 6, 2,   0, 2, 6, 6, 4, 0,   1, 5, 7, 7, 3, 1
+);
+
+void main(void)
+{
+    // Box k is drawn from vertex 36 * k, so no uniform changes between boxes
+    int box = gl_VertexID / 36;
+    int vertex = Cube[gl_VertexID % 36];
+    vec3 position = vec3(vertex & 1, (vertex >> 1) & 1, (vertex >> 2) & 1);
+
+    vec3 boxMin = texelFetch(tBoxes, 2 * box).xyz;
+    vec3 boxMax = texelFetch(tBoxes, 2 * box + 1).xyz;
+    vec3 corner = mix(boxMin, boxMax, position);
+    gl_Position = ProjectionMatrix * ViewMatrix * ModelMatrix * vec4(corner, 1.0);
+}
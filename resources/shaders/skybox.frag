@@ -4,8 +4,9 @@ in vec3 TexCoords;
 out vec4 fColor;
 
 uniform samplerCube tSkyBox; // Cubemap
+uniform float BlurLevel;     // Mip level, the higher the blurrier
 
 void main() {
     // fColor = vec4(TexCoords, 1.0);
-    fColor = texture(tSkyBox,TexCoords);
+    fColor = textureLod(tSkyBox, TexCoords, BlurLevel);
 }
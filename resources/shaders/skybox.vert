@@ -1,11 +1,19 @@
 #version 410 core
 
 in vec3 pos;
-uniform mat4 Projection;
-uniform mat4 View;
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
 out vec3 TexCoords;
 
 void main() {
-  gl_Position = Projection * View * vec4(20.0 * pos, 1.0);
+  // Just the rotation part of the camera view matrix
+  gl_Position = ProjectionMatrix * mat4(mat3(ViewMatrix)) * vec4(20.0 * pos, 1.0);
   TexCoords = pos;
 }
@@ -1,30 +1,62 @@
 #version 410 core
 
-out float fColor;
+out vec2 fColor; // Occlusion and linear depth
 
 in vec2 vTexCoords;
 
-uniform sampler2D tViewPosition;
+uniform sampler2D tDepth;
 uniform sampler2D tViewNormal;
 uniform sampler2D tTexNoise;
 
-uniform vec3 samples[64];
-uniform mat4 ProjectionMatrix;
-uniform int width;
-uniform int height;
+// Uploaded once, std140 pads every sample to a vec4
+layout (std140) uniform SSAOKernel
+{
+    vec4 samples[64];
+};
+
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
+
+// This frame takes SampleCount samples, every SampleStride starting at
+// SampleOffset, so that consecutive frames cover the whole kernel.
+uniform int SampleCount;
+uniform int SampleStride;
+uniform int SampleOffset;
 
 uniform float Radius;
 uniform float Bias;
-int KernelSize = 64;
 
-void main() {
-    // Calculate noise scale to repeat
-    vec2 noiseScale = vec2(width/4.0, height/4.0); 
+vec3 decodeNormal(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
+// View space position of the surface seen through a texel
+vec3 viewPosition(vec2 uv) {
+    float depth = texture(tDepth, uv).r;
+    vec4 position = InverseProjectionMatrix * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
+// Only its z, solved straight from the projection
+float viewDepth(vec2 uv) {
+    float ndcDepth = texture(tDepth, uv).r * 2.0 - 1.0;
+    return -ProjectionMatrix[3][2] / (ndcDepth + ProjectionMatrix[2][2]);
+}
+
+void main() {
     // Get the needed inputs
-    vec3 position = texture(tViewPosition, vTexCoords).rgb;
-    vec3 normal = texture(tViewNormal, vTexCoords).rgb;
-    vec3 randomVector = normalize(texture(tTexNoise, vTexCoords * noiseScale).xyz);
+    vec3 position = viewPosition(vTexCoords);
+    vec3 normal = decodeNormal(texture(tViewNormal, vTexCoords).rg);
+    vec3 randomVector = normalize(texture(tTexNoise, gl_FragCoord.xy / 4.0).xyz);
 
     // TBN change-of-basis matrix: Change from tangent-space to view-space
     vec3 tangent = normalize(randomVector - normal * dot(randomVector, normal));
@@ -33,10 +65,10 @@ void main() {
 
     // Iterate over sample kernel and calculate occlusion factor
     float occlusion = 0.0;
-    for (int i = 0; i < KernelSize; ++i)
+    for (int i = 0; i < SampleCount; ++i)
     {
         // Get sample position
-        vec3 _sample = TBN * samples[i];
+        vec3 _sample = TBN * samples[i * SampleStride + SampleOffset].xyz;
         _sample = position + _sample * Radius;
 
         // Project sample position (to sample texture) (to get position on screen/texture)
@@ -46,13 +78,13 @@ void main() {
         offset.xyz = offset.xyz * 0.5 + 0.5;  // transform to range 0.0 - 1.0
 
         // Get sample depth
-        float sampleDepth = texture(tViewPosition, offset.xy).z;
+        float sampleDepth = viewDepth(offset.xy);
 
         // Range check and accumulate
         float rangeCheck = smoothstep(0.0, 1.0, Radius / abs(position.z - sampleDepth));
         occlusion += (sampleDepth >= _sample.z + Bias ? 1.0 : 0.0) * rangeCheck;
     }
 
-    occlusion = 1.0 - (occlusion / KernelSize);
-    fColor = occlusion;
+    occlusion = 1.0 - (occlusion / SampleCount);
+    fColor = vec2(occlusion, -position.z);
 }
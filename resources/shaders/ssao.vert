@@ -1,7 +1,8 @@
 #version 410 core
 
-in vec3 position;
-in vec2 uv;
+// Fixed so that the quad VAO works with every program using this shader
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec2 uv;
 
 out vec2 vTexCoords;
 
@@ -0,0 +1,48 @@
+#version 410 core
+
+out vec2 fColor;
+
+in vec2 vTexCoords;
+
+uniform sampler2D tDepth;
+uniform sampler2D tCurrent; // Occlusion and linear depth of this frame
+uniform sampler2D tHistory; // Accumulated the same way up to last frame
+
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
+uniform mat4 Reprojection; // From view space to last frame's clip space
+uniform float BlendFactor; // Share of this frame in the result
+uniform bool HistoryValid;
+
+// History seeing a surface further than this fraction away is another one
+const float DepthTolerance = 0.05;
+
+// Exponential moving average of the occlusion. Each frame takes a different
+// part of the kernel, so after a few frames the whole kernel is averaged.
+void main() {
+    vec2 current = texture(tCurrent, vTexCoords).rg;
+
+    // Where this point was on screen last frame
+    float depth = texture(tDepth, vTexCoords).r;
+    vec4 position = InverseProjectionMatrix * vec4(vec3(vTexCoords, depth) * 2.0 - 1.0, 1.0);
+    vec4 previous = Reprojection * vec4(position.xyz / position.w, 1.0);
+    vec2 uv = previous.xy / previous.w * 0.5 + 0.5;
+
+    float alpha = 1.0;
+    vec2 history = current;
+    if (HistoryValid && all(greaterThanEqual(uv, vec2(0.0))) && all(lessThanEqual(uv, vec2(1.0))))
+    {
+        // Clip space w is the linear depth in the previous view
+        history = texture(tHistory, uv).rg;
+        if (abs(history.g - previous.w) < DepthTolerance * previous.w) alpha = BlendFactor;
+    }
+
+    fColor = vec2(mix(history.r, current.r, alpha), current.g);
+}
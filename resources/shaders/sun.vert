@@ -10,8 +10,16 @@ out vec3 vNorm;
 out vec3 vPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout (std140) uniform CameraBlock
+{
+    mat4 ModelMatrix;
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    mat4 InverseProjectionMatrix;
+    mat4 InverseModelViewMatrix;
+    mat3 WorldNormalMatrix;
+};
 
 void main()
 {
@@ -19,6 +27,6 @@ void main()
     vNorm=normAttr;
     vPos=posAttr;
 
-    gl_Position = projection * view * model * vec4(posAttr, 1.0f);
+    gl_Position = ProjectionMatrix * ViewMatrix * model * vec4(posAttr, 1.0f);
 
 }
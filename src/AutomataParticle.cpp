@@ -58,7 +58,7 @@ void AutomataParticle::calculate(
     std::vector<unsigned int> newAutoParticles;
     newAutoParticles.push_back(m_ID);
 
-    int rad = m_size*_automataRadius;
+    int rad = getSize()*_automataRadius;
 
     std::uniform_real_distribution<float> distributionX (-(rad), rad);
     std::uniform_real_distribution<float> distributionY (-(rad), rad);
@@ -78,19 +78,20 @@ void AutomataParticle::calculate(
           x, y, z, newAutoParticles
         ))
     );
+    shareParameters(*_particleList[_particleList.size() - 1]);
   }
 
   // Function call to particleRules
   particleRules(_particleList);
 }
 
-std::vector<unsigned int> AutomataParticle::getNeighbours(
+ScratchVector<uint> AutomataParticle::getNeighbours(
     std::vector<std::unique_ptr<Particle>> &_particleList)
 {
   //Finds the number of neighbours for the current particle
   QVector3D neighbourPos;
   QVector3D distance;
-  std::vector<uint> neighbours;
+  ScratchVector<uint> neighbours;
 
   for (uint i = 0; i < _particleList.size(); i++)
   {
@@ -100,7 +101,7 @@ std::vector<unsigned int> AutomataParticle::getNeighbours(
       distance = m_pos - neighbourPos;
       float length = distance.length();
 
-      if (length <= m_size * 4)
+      if (length <= getSize() * 4)
       {
          neighbours.push_back(_particleList[i]->getID());
       }
@@ -114,10 +115,8 @@ std::vector<unsigned int> AutomataParticle::getNeighbours(
 void AutomataParticle::particleRules(
     std::vector<std::unique_ptr<Particle> > &_particleList)
 {
-  std::vector<unsigned int> neighbours;
-
   // Function call to getNeighbours
-  neighbours = getNeighbours(_particleList);
+  ScratchVector<uint> neighbours = getNeighbours(_particleList);
 
   unsigned int neighbourCount = neighbours.size();
   unsigned int particleCount = _particleList.size();
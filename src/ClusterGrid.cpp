@@ -0,0 +1,230 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ClusterGrid.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <algorithm>
+#include <cmath>
+
+// Project
+#include "ClusterGrid.h"
+
+ClusterGrid::ClusterGrid(unsigned int _particlesPerCluster)
+  : m_particlesPerCluster(std::max(_particlesPerCluster, 1u))
+  , m_cellSize(0.0f)
+{
+}
+
+void ClusterGrid::build(const std::vector<float> &_instances)
+{
+  // Keeps the grid small enough to walk every cell on each build
+  const unsigned int maxCellsPerAxis = 64;
+
+  m_clusters.clear();
+  m_particles.clear();
+
+  const unsigned int count = _instances.size() / 4;
+  if (count == 0) return;
+
+  // Bounds of the centres and biggest radius
+  QVector3D lo(_instances[0], _instances[1], _instances[2]);
+  QVector3D hi = lo;
+  float maxRadius = 0.0f;
+
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    const float *p = &_instances[i * 4];
+    lo.setX(std::min(lo.x(), p[0])); hi.setX(std::max(hi.x(), p[0]));
+    lo.setY(std::min(lo.y(), p[1])); hi.setY(std::max(hi.y(), p[1]));
+    lo.setZ(std::min(lo.z(), p[2])); hi.setZ(std::max(hi.z(), p[2]));
+    maxRadius = std::max(maxRadius, p[3]);
+  }
+
+  // Cells of the size that would hold m_particlesPerCluster particles if they
+  // were spread evenly, never smaller than a particle. Rounded up to a power of
+  // two so the size only changes when the organism changes a lot.
+  const QVector3D extent = hi - lo;
+  const float volume =
+      std::max(extent.x(), 1e-3f) *
+      std::max(extent.y(), 1e-3f) *
+      std::max(extent.z(), 1e-3f);
+  const float wanted = std::max(
+        std::cbrt(volume * m_particlesPerCluster / count),
+        std::max(2.0f * maxRadius, 1e-3f));
+
+  float cellSize = std::exp2(std::ceil(std::log2(wanted)));
+  const float largest = std::max(extent.x(), std::max(extent.y(), extent.z()));
+  while (largest / cellSize >= maxCellsPerAxis - 1) cellSize *= 2.0f;
+  m_cellSize = cellSize;
+
+  // Origin aligned to the cell size, so cells stay in place between builds
+  int origin[3];
+  unsigned int dims[3];
+  for (unsigned int axis = 0; axis < 3; ++axis)
+  {
+    origin[axis] = int(std::floor(lo[axis] / cellSize));
+    dims[axis] = int(std::floor(hi[axis] / cellSize)) - origin[axis] + 1;
+  }
+
+  // Counting sort of the particles by cell
+  const unsigned int cells = dims[0] * dims[1] * dims[2];
+  m_cellStart.assign(cells + 1, 0);
+  m_cellOf.resize(count);
+
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    const float *p = &_instances[i * 4];
+    unsigned int c[3];
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+      const int cell = int(std::floor(p[axis] / cellSize)) - origin[axis];
+      c[axis] = std::min(unsigned(std::max(cell, 0)), dims[axis] - 1);
+    }
+
+    m_cellOf[i] = c[0] + dims[0] * (c[1] + dims[1] * c[2]);
+    m_cellStart[m_cellOf[i] + 1]++;
+  }
+
+  for (unsigned int cell = 0; cell < cells; ++cell)
+  {
+    m_cellStart[cell + 1] += m_cellStart[cell];
+  }
+
+  m_particles.resize(count);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    m_particles[m_cellStart[m_cellOf[i]]++] = i;
+  }
+
+  // Every start was moved to the end of its cell, walk them again to create
+  // a cluster per occupied cell.
+  unsigned int first = 0;
+  for (unsigned int cell = 0; cell < cells; ++cell)
+  {
+    const unsigned int last = m_cellStart[cell];
+    if (last == first) continue;
+
+    Cluster cluster;
+    cluster.first = first;
+    cluster.count = last - first;
+
+    // Absolute cell coordinates, 21 bits each
+    const unsigned int x = cell % dims[0];
+    const unsigned int y = (cell / dims[0]) % dims[1];
+    const unsigned int z = cell / (dims[0] * dims[1]);
+    cluster.key =
+        (quint64((origin[0] + int(x)) & 0x1fffff)) |
+        (quint64((origin[1] + int(y)) & 0x1fffff) << 21) |
+        (quint64((origin[2] + int(z)) & 0x1fffff) << 42);
+
+    const float *p = &_instances[m_particles[first] * 4];
+    cluster.min = QVector3D(p[0] - p[3], p[1] - p[3], p[2] - p[3]);
+    cluster.max = QVector3D(p[0] + p[3], p[1] + p[3], p[2] + p[3]);
+
+    for (unsigned int j = first + 1; j < last; ++j)
+    {
+      p = &_instances[m_particles[j] * 4];
+      cluster.min.setX(std::min(cluster.min.x(), p[0] - p[3]));
+      cluster.min.setY(std::min(cluster.min.y(), p[1] - p[3]));
+      cluster.min.setZ(std::min(cluster.min.z(), p[2] - p[3]));
+      cluster.max.setX(std::max(cluster.max.x(), p[0] + p[3]));
+      cluster.max.setY(std::max(cluster.max.y(), p[1] + p[3]));
+      cluster.max.setZ(std::max(cluster.max.z(), p[2] + p[3]));
+    }
+
+    m_clusters.push_back(cluster);
+    first = last;
+  }
+}
+
+void ClusterGrid::cull(
+    const QMatrix4x4 &_modelViewProjection,
+    std::vector<unsigned int> &_visibleClusters) const
+{
+  QVector4D planes[6];
+  extractPlanes(_modelViewProjection, planes);
+
+  _visibleClusters.clear();
+  for (unsigned int i = 0; i < m_clusters.size(); ++i)
+  {
+    if (boxInside(planes, 6, m_clusters[i].min, m_clusters[i].max))
+    {
+      _visibleClusters.push_back(i);
+    }
+  }
+}
+
+void ClusterGrid::gatherParticles(
+    const std::vector<unsigned int> &_clusters,
+    std::vector<unsigned int> &_particles) const
+{
+  _particles.clear();
+  for (unsigned int idx : _clusters)
+  {
+    const Cluster &cluster = m_clusters[idx];
+    _particles.insert(
+          _particles.end(),
+          m_particles.begin() + cluster.first,
+          m_particles.begin() + cluster.first + cluster.count);
+  }
+}
+
+unsigned int ClusterGrid::getClusterCount() const
+{
+  return m_clusters.size();
+}
+
+const ClusterGrid::Cluster &ClusterGrid::getCluster(unsigned int _idx) const
+{
+  return m_clusters[_idx];
+}
+
+const std::vector<unsigned int> &ClusterGrid::getParticles() const
+{
+  return m_particles;
+}
+
+float ClusterGrid::getCellSize() const
+{
+  return m_cellSize;
+}
+
+void ClusterGrid::extractPlanes(const QMatrix4x4 &_matrix, QVector4D _planes[6])
+{
+  const QVector4D row0 = _matrix.row(0);
+  const QVector4D row1 = _matrix.row(1);
+  const QVector4D row2 = _matrix.row(2);
+  const QVector4D row3 = _matrix.row(3);
+
+  _planes[0] = row3 + row0; // Left
+  _planes[1] = row3 - row0; // Right
+  _planes[2] = row3 + row1; // Bottom
+  _planes[3] = row3 - row1; // Top
+  _planes[4] = row3 + row2; // Near
+  _planes[5] = row3 - row2; // Far
+}
+
+bool ClusterGrid::boxInside(
+    const QVector4D *_planes,
+    unsigned int _count,
+    const QVector3D &_min,
+    const QVector3D &_max)
+{
+  for (unsigned int i = 0; i < _count; ++i)
+  {
+    const QVector4D &plane = _planes[i];
+
+    // Corner of the box furthest along the normal of the plane
+    const float x = plane.x() >= 0.0f ? _max.x() : _min.x();
+    const float y = plane.y() >= 0.0f ? _max.y() : _min.y();
+    const float z = plane.z() >= 0.0f ? _max.z() : _min.z();
+
+    if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() < 0.0f)
+    {
+      return false;
+    }
+  }
+  return true;
+}
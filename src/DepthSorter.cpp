@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file DepthSorter.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+// Qt
+#include <QThreadPool>
+#include <QtConcurrent>
+
+// Project
+#include "DepthSorter.h"
+
+DepthSorter::DepthSorter()
+  : m_depthRange(0.0f)
+  , m_backToFront(false)
+  , m_invalid(true)
+{
+}
+
+bool DepthSorter::update(
+    const std::vector<float> &_instances,
+    const QMatrix4x4 &_modelView,
+    bool _backToFront)
+{
+  const unsigned int count = _instances.size() / 4;
+
+  // Camera in model space, it looks down its negative z axis
+  const QMatrix4x4 inverse = _modelView.inverted();
+  const QVector3D eye = inverse.column(3).toVector3D();
+  const QVector3D forward = -inverse.column(2).toVector3D().normalized();
+
+  if (isUpToDate(_instances, eye, forward, _backToFront)) return false;
+
+  // Depth along the view direction, straight from the third row of the matrix
+  const QVector4D row = _modelView.row(2);
+  m_keys.resize(count);
+  m_order.resize(count);
+  m_positions.resize(count * 3);
+
+  float nearest = 0.0f;
+  float furthest = 0.0f;
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    const float *p = &_instances[i * 4];
+    const float depth = -(row.x() * p[0] + row.y() * p[1] + row.z() * p[2] + row.w());
+
+    nearest = i == 0 ? depth : std::min(nearest, depth);
+    furthest = i == 0 ? depth : std::max(furthest, depth);
+
+    // Flipping the sign bit, and every bit of negative numbers, makes the
+    // integers sort in the same order as the floats.
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    bits ^= (bits & 0x80000000u) ? 0xffffffffu : 0x80000000u;
+
+    m_keys[i] = _backToFront ? ~bits : bits;
+    m_order[i] = i;
+    std::copy(p, p + 3, &m_positions[i * 3]);
+  }
+
+  radixSort();
+
+  m_eye = eye;
+  m_forward = forward;
+  m_depthRange = furthest - nearest;
+  m_backToFront = _backToFront;
+  m_invalid = false;
+  return true;
+}
+
+void DepthSorter::invalidate()
+{
+  m_invalid = true;
+}
+
+const std::vector<unsigned int> &DepthSorter::getOrder() const
+{
+  return m_order;
+}
+
+bool DepthSorter::isUpToDate(
+    const std::vector<float> &_instances,
+    const QVector3D &_eye,
+    const QVector3D &_forward,
+    bool _backToFront) const
+{
+  // Camera or particle moves smaller than this fraction of the depth of the
+  // organism, and turns smaller than about two degrees, hardly change the
+  // order.
+  const float moveFraction = 0.02f;
+  const float minCosine = 0.9994f;
+
+  const unsigned int count = _instances.size() / 4;
+  if (m_invalid || count != m_order.size() || _backToFront != m_backToFront) return false;
+
+  const float maxMove = moveFraction * m_depthRange;
+  if ((_eye - m_eye).length() > maxMove) return false;
+  if (QVector3D::dotProduct(_forward, m_forward) < minCosine) return false;
+
+  // A particle changes its depth at most as much as it moved
+  const float maxMoveSquared = maxMove * maxMove;
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    const float *p = &_instances[i * 4];
+    const float *q = &m_positions[i * 3];
+    const float dx = p[0] - q[0];
+    const float dy = p[1] - q[1];
+    const float dz = p[2] - q[2];
+    if (dx * dx + dy * dy + dz * dz > maxMoveSquared) return false;
+  }
+  return true;
+}
+
+void DepthSorter::radixSort()
+{
+  // Below this many particles the pool costs more than it saves
+  const unsigned int minPerThread = 32768;
+  const unsigned int radix = 256;
+
+  const unsigned int count = m_keys.size();
+  if (count < 2) return;
+
+  m_keysScratch.resize(count);
+  m_orderScratch.resize(count);
+
+  const unsigned int pool = std::max(QThreadPool::globalInstance()->maxThreadCount(), 1);
+  const unsigned int threads = std::max(1u, std::min(pool, count / minPerThread));
+  const unsigned int chunk = (count + threads - 1) / threads;
+
+  // One histogram per chunk, afterwards turned into the place where each
+  // chunk writes each digit so that the sort stays stable.
+  std::vector<unsigned int> offsets(threads * radix);
+
+  // Chunks run on the global pool, the calling thread takes its share
+  std::vector<unsigned int> chunks(threads);
+  std::iota(chunks.begin(), chunks.end(), 0u);
+
+  for (unsigned int shift = 0; shift < 32; shift += 8)
+  {
+    std::fill(offsets.begin(), offsets.end(), 0);
+
+    // Histograms
+    auto histogram = [&](unsigned int &_t)
+    {
+      unsigned int *h = &offsets[_t * radix];
+      const unsigned int end = std::min(count, (_t + 1) * chunk);
+      for (unsigned int i = _t * chunk; i < end; ++i)
+      {
+        h[(m_keys[i] >> shift) & 0xff]++;
+      }
+    };
+
+    if (threads > 1) QtConcurrent::blockingMap(chunks, histogram);
+    else histogram(chunks[0]);
+
+    // Every key has the same digit in this pass, nothing would move
+    const unsigned int first = (m_keys[0] >> shift) & 0xff;
+    unsigned int same = 0;
+    for (unsigned int t = 0; t < threads; ++t) same += offsets[t * radix + first];
+    if (same == count) continue;
+
+    // Prefix sum, digit major and thread minor
+    unsigned int sum = 0;
+    for (unsigned int digit = 0; digit < radix; ++digit)
+    {
+      for (unsigned int t = 0; t < threads; ++t)
+      {
+        const unsigned int n = offsets[t * radix + digit];
+        offsets[t * radix + digit] = sum;
+        sum += n;
+      }
+    }
+
+    // Scatter
+    auto scatter = [&](unsigned int &_t)
+    {
+      unsigned int *o = &offsets[_t * radix];
+      const unsigned int end = std::min(count, (_t + 1) * chunk);
+      for (unsigned int i = _t * chunk; i < end; ++i)
+      {
+        const unsigned int slot = o[(m_keys[i] >> shift) & 0xff]++;
+        m_keysScratch[slot] = m_keys[i];
+        m_orderScratch[slot] = m_order[i];
+      }
+    };
+
+    if (threads > 1) QtConcurrent::blockingMap(chunks, scatter);
+    else scatter(chunks[0]);
+
+    m_keys.swap(m_keysScratch);
+    m_order.swap(m_orderScratch);
+  }
+}
@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file FrameArena.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <algorithm>
+#include <cstdint>
+
+// Project
+#include "FrameArena.h"
+
+FrameArena::FrameArena(std::size_t _blockSize) : m_current(0), m_offset(0)
+{
+  grow(_blockSize);
+}
+
+void *FrameArena::allocate(std::size_t _bytes, std::size_t _alignment)
+{
+  for (;;)
+  {
+    Block &block = m_blocks[m_current];
+    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data.get());
+    std::uintptr_t aligned = (base + m_offset + _alignment - 1) & ~(std::uintptr_t)(_alignment - 1);
+    std::size_t end = (aligned - base) + _bytes;
+
+    if (end <= block.size)
+    {
+      m_offset = end;
+      return reinterpret_cast<void *>(aligned);
+    }
+
+    // Move on to the next block, or make one if this was the last.
+    if (m_current + 1 == m_blocks.size()) grow(_bytes + _alignment);
+    m_current++;
+    m_offset = 0;
+  }
+}
+
+void FrameArena::reset()
+{
+  // Merge the blocks so the next step of the same size fits in one.
+  if (m_blocks.size() > 1)
+  {
+    std::size_t total = getCapacity();
+    m_blocks.clear();
+    grow(total);
+  }
+
+  m_current = 0;
+  m_offset = 0;
+}
+
+std::size_t FrameArena::getCapacity() const
+{
+  std::size_t total = 0;
+  for (const Block &block : m_blocks)
+  {
+    total += block.size;
+  }
+  return total;
+}
+
+FrameArena &FrameArena::local()
+{
+  static thread_local FrameArena arena;
+  return arena;
+}
+
+void FrameArena::grow(std::size_t _bytes)
+{
+  // Blocks at least double in size so growing takes few steps.
+  std::size_t size = std::max(_bytes, m_blocks.empty() ? 0 : m_blocks.back().size * 2);
+
+  Block block;
+  block.data.reset(new char[size]);
+  block.size = size;
+  m_blocks.push_back(std::move(block));
+}
@@ -10,17 +10,27 @@
 #include <iostream>
 // Qt
 #include <QKeyEvent>
+#include <QVector2D>
+#include <cstring>
 #include <iostream>
 #include <string>
 
 // Project
 #include "GLWindow.h"
+#include "RenderGraph.h"
 #include "SkyBox.h"
+#include "UniformBlocks.h"
 
 // helpers
 void subdivide(float*, float*, float*, long, std::vector<GLfloat>&);
 float lerp(float a, float b, float f);
 
+// Constants passed by reference need a definition
+constexpr uint GLWindow::m_instance_ring_regions;
+constexpr uint GLWindow::m_sphere_lods;
+constexpr uint GLWindow::m_no_instance_slot;
+constexpr GLuint GLWindow::m_ssao_kernel_binding;
+
 GLWindow::GLWindow(QWidget*_parent) : QOpenGLWidget(_parent)
 {
   QSurfaceFormat fmt;
@@ -34,6 +44,10 @@ GLWindow::GLWindow(QWidget*_parent) : QOpenGLWidget(_parent)
   setMouseTracking(true);
   setFocus();
 
+  // Frames with nothing new are skipped, the last one has to stay in the
+  // framebuffer to be shown again.
+  setUpdateBehavior(QOpenGLWidget::PartialUpdate);
+
   connect(&m_timer, SIGNAL(timeout()), this, SLOT(update()));
   if(format().swapInterval() == -1)
   {
@@ -46,42 +60,76 @@ GLWindow::GLWindow(QWidget*_parent) : QOpenGLWidget(_parent)
     // V_blank synchronization available
     m_timer.setInterval(0);
   }
+  m_frames_to_settle = m_settle_frames;
   m_timer.start();
+
+  m_resize_timer.setSingleShot(true);
+  m_resize_timer.setInterval(m_resize_settle_time);
+  connect(&m_resize_timer, SIGNAL(timeout()), this, SLOT(reallocateTargets()));
+  m_target_width = 0;
+  m_target_height = 0;
+
   m_draw_links = true;
+  m_rendering_mode = GLWindow::ADS;
+  m_lighting_permutations = nullptr;
+  m_impostors = false;
+  m_occlusion_culling = true;
+  m_depth_sorting = true;
+  m_ssao_quality = GLWindow::SSAO_MEDIUM;
+  m_ssao_width = 0;
+  m_ssao_height = 0;
+  m_ssao_frame = 0;
+  m_occlusion_history = 0;
+  m_occlusion_history_valid = false;
+  m_occlusion_cell_size = 0.0f;
+  m_region_mode = GLWindow::REGION_NONE;
+  m_geometry_query_pending = false;
+  m_geometry_time = 0;
+  m_geometry_frames = 0;
+
+  m_lod_instance_start.fill(0);
+  m_lod_instance_count.fill(0);
+  m_instance_capacity = 0;
+  m_instance_region = 0;
+  m_instance_fences.fill(nullptr);
 }
 
 GLWindow::~GLWindow()
 {
+  makeCurrent();
+  deleteInstanceFences();
+  glDeleteQueries(1, &m_geometry_query);
+  delete m_lighting_permutations;
+  delete m_skybox;
+  m_ssao_kernel_ubo.destroy(this);
+  m_camera_ubo.destroy(this);
+  m_lights_ubo.destroy(this);
+  m_material_ubo.destroy(this);
+  if (!m_occlusion_queries.empty())
+  {
+    glDeleteQueries(m_occlusion_queries.size(), &m_occlusion_queries[0]);
+  }
+  glDeleteTextures(1, &m_box_texture);
+  m_box_buffer.destroy();
+  m_input_manager->cleanupPicking(this);
   cleanup();
+  m_noise_texture->destroy();
+  delete m_noise_texture;
+  m_render_graph.releaseTextures();
+  doneCurrent();
 }
 
 void GLWindow::cleanup()
 {
   qDebug("Cleaning up...");
 
-  // Destroy textures
-  m_view_position_texture->destroy();
-  m_world_position_texture->destroy();
-  m_view_normal_texture->destroy();
-  m_world_normal_texture->destroy();
-  m_occlusion_texture->destroy();
-  m_blurred_occlusion_texture->destroy();
-  m_noise_texture->destroy();
-
-  // Deallocate textures
-  delete m_view_position_texture;
-  delete m_world_position_texture;
-  delete m_view_normal_texture;
-  delete m_world_normal_texture;
-  delete m_occlusion_texture;
-  delete m_blurred_occlusion_texture;
-  delete m_noise_texture;
-
-  // Deallocate framebuffer objects
-  delete m_gbuffer_fbo;
-  delete m_ssao_fbo;
-  delete m_blur_fbo;
-
+  // Destroy textures, and the framebuffers they are attached to
+  for (QOpenGLTexture *history : m_occlusion_history_textures)
+  {
+    m_render_graph.forgetTexture(history);
+    history->destroy();
+    delete history;
+  }
 }
 
 void GLWindow::prepareSSAOPipeline()
@@ -89,140 +137,33 @@ void GLWindow::prepareSSAOPipeline()
   //////////////////////////////////////////////////////////////////////////////
   /// Framebuffer textures initialization
   //////////////////////////////////////////////////////////////////////////////
-  qDebug("Setting texture sizes: %dx%d", width(), height());
-
-  m_view_position_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-  m_view_position_texture->setSize(width(), height());
-  m_view_position_texture->setMinificationFilter(QOpenGLTexture::Nearest);
-  m_view_position_texture->setMagnificationFilter(QOpenGLTexture::Nearest);
-  m_view_position_texture->setFormat(QOpenGLTexture::RGB32F);
-  m_view_position_texture->allocateStorage(QOpenGLTexture::RGB, QOpenGLTexture::Float32);
-
-  m_world_position_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-  m_world_position_texture->setSize(width(), height());
-  m_world_position_texture->setMinificationFilter(QOpenGLTexture::Nearest);
-  m_world_position_texture->setMagnificationFilter(QOpenGLTexture::Nearest);
-  m_world_position_texture->setFormat(QOpenGLTexture::RGB32F);
-  m_world_position_texture->allocateStorage(QOpenGLTexture::RGB, QOpenGLTexture::Float32);
-
-  m_view_normal_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-  m_view_normal_texture->setSize(width(), height());
-  m_view_normal_texture->setMinificationFilter(QOpenGLTexture::Nearest);
-  m_view_normal_texture->setMagnificationFilter(QOpenGLTexture::Nearest);
-  m_view_normal_texture->setFormat(QOpenGLTexture::RGB32F);
-  m_view_normal_texture->allocateStorage(QOpenGLTexture::RGB, QOpenGLTexture::Float32);
-
-  m_world_normal_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-  m_world_normal_texture->setSize(width(), height());
-  m_world_normal_texture->setMinificationFilter(QOpenGLTexture::Nearest);
-  m_world_normal_texture->setMagnificationFilter(QOpenGLTexture::Nearest);
-  m_world_normal_texture->setFormat(QOpenGLTexture::RGB32F);
-  m_world_normal_texture->allocateStorage(QOpenGLTexture::RGB, QOpenGLTexture::Float32);
-
-  m_occlusion_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-  m_occlusion_texture->setSize(width(), height());
-  m_occlusion_texture->setMinificationFilter(QOpenGLTexture::Nearest);
-  m_occlusion_texture->setMagnificationFilter(QOpenGLTexture::Nearest);
-  m_occlusion_texture->setFormat(QOpenGLTexture::RGB16_UNorm);
-  m_occlusion_texture->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float16);
-
-  m_blurred_occlusion_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-  m_blurred_occlusion_texture->setSize(width(), height());
-  m_blurred_occlusion_texture->setMinificationFilter(QOpenGLTexture::Nearest);
-  m_blurred_occlusion_texture->setMagnificationFilter(QOpenGLTexture::Nearest);
-  m_blurred_occlusion_texture->setFormat(QOpenGLTexture::RGB16_UNorm);
-  m_blurred_occlusion_texture->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float16);
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// gBuffer FBO preparation
-  /////////////////////////////////////////////////////////////////////////////
-  m_gbuffer_fbo = new QOpenGLFramebufferObject(width(), height()); // GL_COLOR_ATTACHMENT0
-  m_gbuffer_fbo->bind();
-  m_gbuffer_fbo->addColorAttachment(width(), height(), GL_RGB);    // GL_COLOR_ATTACHMENT1
-
-  glBindTexture(GL_TEXTURE_2D, m_world_position_texture->textureId());
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_world_position_texture->textureId(), 0);
-  glBindTexture(GL_TEXTURE_2D, m_view_position_texture->textureId());
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, m_view_position_texture->textureId(), 0);
-  glBindTexture(GL_TEXTURE_2D, m_world_normal_texture->textureId());
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, m_world_normal_texture->textureId(), 0);
-  glBindTexture(GL_TEXTURE_2D, m_view_normal_texture->textureId());
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, m_view_normal_texture->textureId(), 0);
-  const GLenum gbuffer_attachments[4] = {
-    GL_COLOR_ATTACHMENT0,
-    GL_COLOR_ATTACHMENT1,
-    GL_COLOR_ATTACHMENT2,
-    GL_COLOR_ATTACHMENT3
-  };
-  glDrawBuffers(4, gbuffer_attachments);
-
-  // Create and attach depth buffer (renderbuffer) =============================
-  GLuint rbo_depth;
-
-  // Generate renderbuffer object names
-  glGenRenderbuffers(1, &rbo_depth);
-
-  // Bind a named renderbuffer object
-  glBindRenderbuffer(GL_RENDERBUFFER, rbo_depth);
-
-  // Establish data storage, fromat and dimensions of a renderbuffer object's image
-  glRenderbufferStorage(
-    GL_RENDERBUFFER,     // Target
-    GL_DEPTH_COMPONENT,  // Internal Format
-    width(), height()    // Dimensions
-  );
-
-  // Attach a renderbuffer object to a framebuffer object
-  glFramebufferRenderbuffer(
-    GL_FRAMEBUFFER,       // Target
-    GL_DEPTH_ATTACHMENT,  // Attachment
-    GL_RENDERBUFFER,      // Renderbuffer Target
-    rbo_depth             // Renderbuffer
-  );
-
-  // Finally check if framebuffer object is complete
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    qCritical("gBuffer FBO not complete!");
-  m_gbuffer_fbo->release();
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// SSAO FBO preparation
-  //////////////////////////////////////////////////////////////////////////////
-  m_ssao_fbo = new QOpenGLFramebufferObject(width(), height());
-  m_ssao_fbo->bind();
-
-  qDebug("Occlusion texture ID: %d", m_occlusion_texture->textureId());
-  glBindTexture(GL_TEXTURE_2D, m_occlusion_texture->textureId());
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_occlusion_texture->textureId(), 0);
-
-  const GLenum ssao_attachments[1] = {GL_COLOR_ATTACHMENT0};
-  glDrawBuffers(1, ssao_attachments);
-
-  // Finally check if framebuffer object is complete
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    qCritical("SSAO FBO not complete");
-
-  m_ssao_fbo->release();
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// Blur FBO preparetion
-  //////////////////////////////////////////////////////////////////////////////
-  m_blur_fbo = new QOpenGLFramebufferObject(width(), height());
-  m_blur_fbo->bind();
-
-  qDebug("Blurred occlusion texture ID: %d", m_blurred_occlusion_texture->textureId());
-  glBindTexture(GL_TEXTURE_2D, m_blurred_occlusion_texture->textureId());
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_blurred_occlusion_texture->textureId(), 0);
-
-  const GLenum blur_attachments[1] = {GL_COLOR_ATTACHMENT0};
-  glDrawBuffers(1, blur_attachments);
-
-  // Finally check if framebuffer object is complete
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    qCritical("Blur FBO not complete");
-
-  m_blur_fbo->release();
+  // The gBuffer and most occlusion textures live for a frame only, they come
+  // from the render graph. Only the history outlives the frame.
+  qDebug("Setting texture sizes: %dx%d", m_target_width, m_target_height);
+
+  // Every occlusion texture keeps the linear depth next to the occlusion, so
+  // the blur, the accumulation and the upsampling can tell surfaces apart.
+  // Below the high quality they are half the size of the window.
+  const bool halfResolution = m_ssao_quality != GLWindow::SSAO_HIGH;
+  m_ssao_width = halfResolution ? (m_target_width + 1) / 2 : m_target_width;
+  m_ssao_height = halfResolution ? (m_target_height + 1) / 2 : m_target_height;
+  qDebug("Setting SSAO texture sizes: %dx%d", m_ssao_width, m_ssao_height);
+
+  for (QOpenGLTexture *&history : m_occlusion_history_textures)
+  {
+    history = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    history->setSize(m_ssao_width, m_ssao_height);
+    history->setMinificationFilter(QOpenGLTexture::Nearest);
+    history->setMagnificationFilter(QOpenGLTexture::Nearest);
+    history->setWrapMode(QOpenGLTexture::ClampToEdge);
+    history->setFormat(QOpenGLTexture::RG16F);
+    history->allocateStorage(QOpenGLTexture::RG, QOpenGLTexture::Float16);
+  }
+  m_occlusion_history_valid = false;
+}
 
+void GLWindow::prepareSSAOKernel()
+{
   //////////////////////////////////////////////////////////////////////////////
   /// SSAO kernel preparation
   //////////////////////////////////////////////////////////////////////////////
@@ -245,6 +186,16 @@ void GLWindow::prepareSSAOPipeline()
     m_ssao_kernel.push_back(sample);
   }
 
+  // The kernel goes to a uniform buffer, std140 pads every vec3 to a vec4
+  std::vector<GLfloat> kernelBlock;
+  for (const QVector3D &sample : m_ssao_kernel)
+  {
+    kernelBlock.insert(kernelBlock.end(), {sample.x(), sample.y(), sample.z(), 0.0f});
+  }
+
+  m_ssao_kernel_ubo.setData(&kernelBlock[0], kernelBlock.size() * sizeof(GLfloat));
+  m_ssao_kernel_ubo.upload(this);
+
   //////////////////////////////////////////////////////////////////////////////
   /// Noise texture generation
   //////////////////////////////////////////////////////////////////////////////
@@ -276,13 +227,23 @@ void GLWindow::prepareSSAOPipeline()
   m_ssao_program->bind();
 
     // Texture unit to use
-    m_ssao_program->setUniformValue("tViewPosition" , 0);
+    m_ssao_program->setUniformValue("tDepth"        , 0);
     m_ssao_program->setUniformValue("tViewNormal"   , 1);
     m_ssao_program->setUniformValue("tTexNoise"     , 2);
 
 
   m_ssao_program->release();
 
+  // === TEMPORAL ===
+  m_temporal_program->bind();
+
+    // Texture unit to use
+    m_temporal_program->setUniformValue("tDepth"   , 0);
+    m_temporal_program->setUniformValue("tCurrent" , 1);
+    m_temporal_program->setUniformValue("tHistory" , 2);
+
+  m_temporal_program->release();
+
   // === BLUR ===
   m_blur_program->bind();
 
@@ -291,78 +252,165 @@ void GLWindow::prepareSSAOPipeline()
 
   m_blur_program->release();
 
-  // === LIGHTING ===
-  m_lighting_program->bind();
+  // === DEPTH COPY ===
+  m_depth_copy_program->bind();
 
     // Texture unit to use
-    m_lighting_program->setUniformValue("tWorldPosition" , 0);
-    m_lighting_program->setUniformValue("tWorldNormal"   , 1);
-    m_lighting_program->setUniformValue("tSSAO"          , 2);
-    m_lighting_program->setUniformValue("tSkybox"        , 3);
+    m_depth_copy_program->setUniformValue("tDepth", 0);
 
-    // Uniforms
-    m_lighting_program->setUniformValue("drawLinks", true);
-    m_lighting_program->setUniformValue("CameraPos", m_input_manager->getCameraPosition());
+  m_depth_copy_program->release();
+}
 
+void GLWindow::prepareUniformBuffers()
+{
+  m_ssao_kernel_ubo.create(this, m_ssao_kernel_binding, 64 * 4 * sizeof(GLfloat));
+  m_camera_ubo.create(this, m_camera_binding, sizeof(CameraBlock));
+  m_lights_ubo.create(this, m_lights_binding, sizeof(LightsBlock));
+  m_material_ubo.create(this, m_material_binding, sizeof(MaterialBlock));
+
+  QOpenGLShaderProgram *programs[] = {
+    m_geom_program, m_impostor_program, m_ssao_program, m_temporal_program,
+    m_links_program, m_box_program, m_manipulator_program, m_sun_program,
+    m_skybox->getProgram()
+  };
 
-    // Subroutine ShadingPass Index.
-    m_ADSIndex  = glGetSubroutineIndex(m_lighting_program->programId(), GL_FRAGMENT_SHADER, "ADSRender");
-    m_XRayIndex = glGetSubroutineIndex(m_lighting_program->programId(), GL_FRAGMENT_SHADER, "XRayRender");
-    m_AOIndex   = glGetSubroutineIndex(m_lighting_program->programId(), GL_FRAGMENT_SHADER, "AORender");
-    m_NewOrderIndex   = glGetSubroutineIndex(m_lighting_program->programId(), GL_FRAGMENT_SHADER, "NewOrderRender");
+  for (QOpenGLShaderProgram *program : programs) attachUniformBlocks(program);
+}
 
+void GLWindow::attachUniformBlocks(QOpenGLShaderProgram *_program)
+{
+  // Programs without a block are skipped by attach()
+  m_ssao_kernel_ubo.attach(this, _program, "SSAOKernel");
+  m_camera_ubo.attach(this, _program, "CameraBlock");
+  m_lights_ubo.attach(this, _program, "LightsBlock");
+  m_material_ubo.attach(this, _program, "MaterialBlock");
+}
 
-    // Setting the active renderpass.
-    m_activeRenderPassIndex = m_ADSIndex;
-    m_rendering_mode = GLWindow::ADS;
+QOpenGLShaderProgram *GLWindow::lightingProgram()
+{
+  QStringList defines;
+  switch (m_rendering_mode)
+  {
+  case GLWindow::XRAY:     defines << "RENDER_XRAY";      break;
+  case GLWindow::AO:       defines << "RENDER_AO";        break;
+  case GLWindow::newOrder: defines << "RENDER_NEW_ORDER"; break;
+  default:                 defines << "RENDER_ADS";       break;
+  }
 
-  m_lighting_program->release();
+  if (m_ssao_quality == GLWindow::SSAO_HIGH) defines << "SSAO_FULL_RESOLUTION";
 
-  // === SSAO ===
-  m_ssao_program->bind();
-    m_ssao_program->setUniformValue("width", width());
-    m_ssao_program->setUniformValue("height", height());
-  m_ssao_program->release();
+  return m_lighting_permutations->get(defines);
+}
+
+void GLWindow::resolveUniformLocations()
+{
+  m_uniforms.ssaoRadius    = m_ssao_program->uniformLocation("Radius");
+  m_uniforms.ssaoBias      = m_ssao_program->uniformLocation("Bias");
+  m_uniforms.sampleCount   = m_ssao_program->uniformLocation("SampleCount");
+  m_uniforms.sampleStride  = m_ssao_program->uniformLocation("SampleStride");
+  m_uniforms.sampleOffset  = m_ssao_program->uniformLocation("SampleOffset");
+  m_uniforms.reprojection  = m_temporal_program->uniformLocation("Reprojection");
+  m_uniforms.blendFactor   = m_temporal_program->uniformLocation("BlendFactor");
+  m_uniforms.historyValid  = m_temporal_program->uniformLocation("HistoryValid");
+  m_uniforms.blurDirection = m_blur_program->uniformLocation("Direction");
+}
+
+void GLWindow::updateCameraBlock()
+{
+  const QMatrix4x4 view = m_input_manager->getViewMatrix();
+  const QMatrix4x4 projection = m_input_manager->getProjectionMatrix();
+  const QMatrix4x4 inverseProjection = projection.inverted();
+  const QMatrix4x4 inverseModelView = (view * m_model_matrix).inverted();
+
+  CameraBlock block;
+  std::memcpy(block.model, m_model_matrix.constData(), sizeof(block.model));
+  std::memcpy(block.view, view.constData(), sizeof(block.view));
+  std::memcpy(block.projection, projection.constData(), sizeof(block.projection));
+  std::memcpy(block.inverseProjection, inverseProjection.constData(), sizeof(block.inverseProjection));
+  std::memcpy(block.inverseModelView, inverseModelView.constData(), sizeof(block.inverseModelView));
+
+  // Mode invariant, used to be worked out for every pixel of the lighting
+  // pass. The normal matrix of the inverse is the transpose of the rotation.
+  const QMatrix3x3 worldNormal = inverseModelView.normalMatrix();
+  for (int column = 0; column < 3; ++column)
+  {
+    for (int row = 0; row < 3; ++row)
+    {
+      block.worldNormal[column * 4 + row] = worldNormal(row, column);
+    }
+    block.worldNormal[column * 4 + 3] = 0.0f;
+  }
+
+  m_camera_ubo.setData(block);
+  m_camera_ubo.upload(this);
 }
 
 void GLWindow::initializeGL()
 {
 
   initializeOpenGLFunctions();
+  m_program_cache.initialize(this);
 
   m_input_manager = new InputManager(this);
   m_skybox = new SkyBox(m_input_manager);
 
-  generateSphereData(4); // Four subdivisions of an icosahedra
-  m_sphere_vbo.create();
-  m_sphere_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+  generateSphereLODs();
 
   initializeMatrices();
   setupLights();
-  m_skybox->prepare(width(), height(), context()->versionFunctions<QOpenGLFunctions_4_1_Core>());
+  m_skybox->prepare(context()->versionFunctions<QOpenGLFunctions_4_1_Core>(), m_program_cache);
 
   m_geom_program = new QOpenGLShaderProgram;
-  m_geom_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":shader/geom.vert");
-  m_geom_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/geom.frag");
-  m_geom_program->link();
+  m_program_cache.build(m_geom_program, ":/shader/geom.vert", ":/shader/geom.frag");
+
+  // Shares the particle VAO with the geometry program, so the attributes are
+  // at the same locations in both vertex shaders.
+  m_impostor_program = new QOpenGLShaderProgram;
+  m_program_cache.build(m_impostor_program, ":/shader/geom_impostor.vert", ":/shader/geom_impostor.frag");
+
+  glGenQueries(1, &m_geometry_query);
 
   m_ssao_program = new QOpenGLShaderProgram;
-  m_ssao_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/ssao.vert");
-  m_ssao_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/ssao.frag");
-  m_ssao_program->link();
+  m_program_cache.build(m_ssao_program, ":/shader/ssao.vert", ":/shader/ssao.frag");
+
+  m_temporal_program = new QOpenGLShaderProgram;
+  m_program_cache.build(m_temporal_program, ":/shader/ssao.vert", ":/shader/ssao_temporal.frag");
 
   m_blur_program = new QOpenGLShaderProgram;
-  m_blur_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/ssao.vert");
-  m_blur_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/blur.frag");
-  m_blur_program->link();
+  m_program_cache.build(m_blur_program, ":/shader/ssao.vert", ":/shader/blur.frag");
+
+  // Permutations are built as the rendering modes get used
+  m_lighting_permutations = new ShaderPermutations(
+    &m_program_cache,
+    ":/shader/ssao.vert",
+    ":/shader/lighting.frag",
+    [this](QOpenGLShaderProgram *_program)
+    {
+      attachUniformBlocks(_program);
+
+      // Texture unit to use
+      _program->bind();
+      _program->setUniformValue("tDepth"         , 0);
+      _program->setUniformValue("tViewNormal"    , 1);
+      _program->setUniformValue("tSSAO"          , 2);
+      _program->setUniformValue("tSkybox"        , 3);
+      _program->release();
+    });
 
-  m_lighting_program = new QOpenGLShaderProgram;
-  m_lighting_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/ssao.vert");
-  m_lighting_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/lighting.frag");
-  m_lighting_program->link();
+  m_depth_copy_program = new QOpenGLShaderProgram;
+  m_program_cache.build(m_depth_copy_program, ":/shader/ssao.vert", ":/shader/depth_copy.frag");
+
+  m_render_graph.initialize(this);
 
   prepareQuad();
   prepareParticles();
+  prepareOcclusionQueries();
+  prepareUniformBuffers();
+  resolveUniformLocations();
+  prepareSSAOKernel();
+
+  m_target_width = width();
+  m_target_height = height();
   prepareSSAOPipeline();
 
   glViewport(0, 0, width(), height());
@@ -396,176 +444,349 @@ void GLWindow::initializeGL()
   setFillLight(10);
 
   m_ssao_program->bind();
-    m_ssao_program->setUniformValue("Radius", m_ssaoRadius);
-    m_ssao_program->setUniformValue("Bias", m_ssaoBias);
+    m_ssao_program->setUniformValue(m_uniforms.ssaoRadius, m_ssaoRadius);
+    m_ssao_program->setUniformValue(m_uniforms.ssaoBias, m_ssaoBias);
   m_ssao_program->release();
+
+  // Decode the other skies while idle, so switching to them is instant
+  m_skybox->prefetch();
 }
 
 
 void GLWindow::paintGL()
 {
+  // Nothing changed, the widget shows the last frame again. Picking works in
+  // its own framebuffer, so it carries on.
+  if (m_frames_to_settle == 0 && !isAnimating())
+  {
+    if (m_input_manager->updatePicking(this)) requestRender();
+    if (m_frames_to_settle == 0 && !m_input_manager->isPicking()) m_timer.stop();
+    return;
+  }
+  if (isAnimating()) m_frames_to_settle = m_settle_frames;
+
   updateModelMatrix();
 
-  m_input_manager->loadLightMatricesToShader();
   m_input_manager->doMovement(-m_ps.calculateParticleCentre());
+  updateCameraBlock();
+
+  uploadInstances();
+
+  loadMaterialToShader();
+  loadLightToShader();
+  m_skybox->update();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// Passes
+  //////////////////////////////////////////////////////////////////////////////
+  buildRenderGraph();
+  m_render_graph.execute();
+
+  // With the manipulators just drawn, so their uniforms are set
+  if (m_input_manager->updatePicking(this)) requestRender();
+
+  // Last draw reading the current instance region, the next time the ring
+  // comes back to it we wait on this.
+  GLsync &fence = m_instance_fences[m_instance_region];
+  if (fence != nullptr) glDeleteSync(fence);
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  updateParticleSystem();
+
+  m_frames_to_settle--;
+  if (m_frames_to_settle == 0 && !isAnimating() && !m_input_manager->isPicking())
+  {
+    m_timer.stop();
+  }
+}
+
+void GLWindow::requestRender()
+{
+  m_frames_to_settle = m_settle_frames;
+  if (!m_timer.isActive()) m_timer.start();
+}
+
+bool GLWindow::isAnimating() const
+{
+  return m_lightON || !m_ps.isSettled() || m_input_manager->isMoving() || m_skybox->isLoading();
+}
+
+void GLWindow::buildRenderGraph()
+{
+  typedef RenderGraph::Pass Pass;
+  typedef RenderGraph::Resource Resource;
+
+  m_render_graph.reset();
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// Resources
+  //////////////////////////////////////////////////////////////////////////////
+  const Resource backbuffer = m_render_graph.importBackbuffer(defaultFramebufferObject(), width(), height());
+
+  // Positions are not stored, the passes reading the gBuffer reconstruct them
+  // from the depth. The view space normal is packed in two halfs.
+  const Resource normal = m_render_graph.createTexture("normal", {m_target_width, m_target_height, QOpenGLTexture::RG16F});
+  const Resource depth = m_render_graph.createTexture("depth", {m_target_width, m_target_height, QOpenGLTexture::D24});
+
+  // Occlusion and linear depth at the SSAO resolution
+  const RenderGraph::TextureDescription occlusionDescription = {m_ssao_width, m_ssao_height, QOpenGLTexture::RG16F};
+  const Resource occlusion = m_render_graph.createTexture("occlusion", occlusionDescription);
+  const Resource blurPass = m_render_graph.createTexture("horizontal blur", occlusionDescription);
+  const Resource blurred = m_render_graph.createTexture("blurred occlusion", occlusionDescription);
+
+  // Only these modes shade with the occlusion. In the others nothing reads
+  // it and the SSAO passes are culled.
+  const bool shadeOcclusion = m_rendering_mode == GLWindow::XRAY || m_rendering_mode == GLWindow::AO;
+
+  // Kernel samples taken per frame at each quality. With temporal accumulation
+  // the frames take different samples, so a few frames add up to the kernel.
+  static const int samplesPerFrame[3] = {8, 16, 64};
+  const int kernelSize = m_ssao_kernel.size();
+  const int samples = samplesPerFrame[m_ssao_quality];
+  const int stride = kernelSize / samples;
+  const bool temporal = m_ssao_quality != GLWindow::SSAO_HIGH;
 
   //////////////////////////////////////////////////////////////////////////////
   /// gBuffer: Geometry pass
   //////////////////////////////////////////////////////////////////////////////
-  m_gbuffer_fbo->bind();
+  const Pass gbuffer = m_render_graph.addPass("gbuffer", [this]()
+  {
+    // Only time the pass when the previous result has been collected, so we
+    // never stall waiting for the GPU.
+    readGeometryTimer();
+    const bool timeGeometry = !m_geometry_query_pending;
+    if (timeGeometry) glBeginQuery(GL_TIME_ELAPSED, m_geometry_query);
+
     glEnable(GL_DEPTH_TEST);
+    glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     switch (m_rendering_mode) {
     case GLWindow::XRAY:
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_COLOR);
-      glBlendEquation(GL_FUNC_ADD);
+      // No blending here, the normals are encoded and would not add up. The
+      // lighting pass makes the surfaces see-through from the rim instead.
       glEnable(GL_CULL_FACE);
       drawParticles();
       glDisable(GL_CULL_FACE);
-      glDisable(GL_BLEND);
-
       break;
 
     default:
       drawParticles();
       break;
     }
-  m_gbuffer_fbo->release();
+
+    if (timeGeometry)
+    {
+      glEndQuery(GL_TIME_ELAPSED);
+      m_geometry_query_pending = true;
+    }
+
+    // Outside the timer, so that it measures the particles alone
+    issueOcclusionQueries();
+  });
+  m_render_graph.write(gbuffer, normal);
+  m_render_graph.write(gbuffer, depth);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// SSAO: Generate SSAO texture
+  /// SSAO: Generate, accumulate and blur the SSAO texture
   //////////////////////////////////////////////////////////////////////////////
-  m_ssao_fbo->bind();
+  const Pass ssao = m_render_graph.addPass("ssao", [this, depth, normal, samples, stride]()
+  {
     glDisable(GL_DEPTH_TEST);
-    glClear(GL_COLOR_BUFFER_BIT);
     m_ssao_program->bind();
-    for (size_t i = 0; i < 64; ++i)
-    {
-      std::string s = "samples[" + std::to_string(i) + "]";
-      m_ssao_program->setUniformValue(s.c_str(), m_ssao_kernel[i]);
-    }
-    m_ssao_program->setUniformValue("ProjectionMatrix", m_input_manager->getProjectionMatrix());
-    m_view_position_texture->bind(0);
-    m_view_normal_texture->bind(1);
+    m_ssao_program->setUniformValue(m_uniforms.sampleCount, samples);
+    m_ssao_program->setUniformValue(m_uniforms.sampleStride, stride);
+    m_ssao_program->setUniformValue(m_uniforms.sampleOffset, int(m_ssao_frame % stride));
+    m_render_graph.texture(depth)->bind(0);
+    m_render_graph.texture(normal)->bind(1);
     m_noise_texture->bind(2);
     m_quad_vao->bind();
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+      glDrawArrays(GL_TRIANGLES, 0, 6);
     m_quad_vao->release();
     m_ssao_program->release();
-  m_ssao_fbo->release();
 
-  //////////////////////////////////////////////////////////////////////////////
-  /// Blur: Blur SSAO texture
-  //////////////////////////////////////////////////////////////////////////////
-  m_blur_fbo->bind();
-    glDisable(GL_DEPTH_TEST);
-    glClear(GL_COLOR_BUFFER_BIT);
+    m_ssao_frame++;
+  });
+  m_render_graph.read(ssao, depth);
+  m_render_graph.read(ssao, normal);
+  m_render_graph.write(ssao, occlusion);
+
+  // === Temporal accumulation ===
+  // The history is reprojected with last frame's camera, and only kept where
+  // it still sees the same surface.
+  Resource accumulated = occlusion;
+  if (temporal)
+  {
+    const uint next = 1 - m_occlusion_history;
+    const Resource history = m_render_graph.importTexture("occlusion history", m_occlusion_history_textures[m_occlusion_history]);
+    accumulated = m_render_graph.importTexture("accumulated occlusion", m_occlusion_history_textures[next]);
+
+    const Pass accumulate = m_render_graph.addPass("temporal", [this, depth, occlusion, history, next, samples, kernelSize]()
+    {
+      const QMatrix4x4 projection = m_input_manager->getProjectionMatrix();
+      const QMatrix4x4 modelView = m_input_manager->getViewMatrix() * m_model_matrix;
+
+      m_temporal_program->bind();
+      m_temporal_program->setUniformValue(m_uniforms.reprojection, m_previous_model_view_projection * modelView.inverted());
+      m_temporal_program->setUniformValue(m_uniforms.blendFactor, float(samples) / kernelSize);
+      m_temporal_program->setUniformValue(m_uniforms.historyValid, m_occlusion_history_valid);
+      m_render_graph.texture(depth)->bind(0);
+      m_render_graph.texture(occlusion)->bind(1);
+      m_render_graph.texture(history)->bind(2);
+      m_quad_vao->bind();
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+      m_quad_vao->release();
+      m_temporal_program->release();
+
+      m_occlusion_history = next;
+      m_occlusion_history_valid = true;
+      m_previous_model_view_projection = projection * modelView;
+    });
+    m_render_graph.read(accumulate, depth);
+    m_render_graph.read(accumulate, occlusion);
+    m_render_graph.read(accumulate, history);
+    m_render_graph.write(accumulate, accumulated);
+  }
+
+  // === Bilateral blur, horizontal and then vertical ===
+  const Pass blurHorizontal = m_render_graph.addPass("horizontal blur", [this, accumulated]()
+  {
+    m_blur_program->bind();
+    m_blur_program->setUniformValue(m_uniforms.blurDirection, QVector2D(1.0f, 0.0f));
+    m_render_graph.texture(accumulated)->bind(0);
+    m_quad_vao->bind();
+      glDrawArrays(GL_TRIANGLES, 0, 6);
+    m_quad_vao->release();
+    m_blur_program->release();
+  });
+  m_render_graph.read(blurHorizontal, accumulated);
+  m_render_graph.write(blurHorizontal, blurPass);
+
+  const Pass blurVertical = m_render_graph.addPass("vertical blur", [this, blurPass]()
+  {
     m_blur_program->bind();
-    m_occlusion_texture->bind(0);
+    m_blur_program->setUniformValue(m_uniforms.blurDirection, QVector2D(0.0f, 1.0f));
+    m_render_graph.texture(blurPass)->bind(0);
     m_quad_vao->bind();
       glDrawArrays(GL_TRIANGLES, 0, 6);
     m_quad_vao->release();
     m_blur_program->release();
-  m_blur_fbo->release();
+  });
+  m_render_graph.read(blurVertical, blurPass);
+  m_render_graph.write(blurVertical, blurred);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// Default FBO: lighting shader
+  /// Default FBO: background
   //////////////////////////////////////////////////////////////////////////////
-  loadMaterialToShader();
-  loadLightToShader();
-
-  //Default colour. Dark grey.
-  glClearColor(0.25, 0.25, 0.25, 1.0);
-  glClear(GL_COLOR_BUFFER_BIT);
-
-  // === Sky ===
-  switch (m_rendering_mode) {
-  case GLWindow::ADS:
-    glClearColor(0, 0, 0, 0);
-    glDepthMask(GL_FALSE);
-    m_skybox->draw(context()->versionFunctions<QOpenGLFunctions_4_1_Core>());
-    glDepthMask(GL_TRUE);
-    break;
-
-  //Ambient Occlusion render pass.
-  case GLWindow::AO:
-    break;
-
-  //New Order artstyle render.
-  case GLWindow::newOrder:
-    break;
+  const Pass background = m_render_graph.addPass("background", [this]()
+  {
+    //Default colour. Dark grey.
+    glClearColor(0.25, 0.25, 0.25, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-  default:
-    break;
-  }
+    // === Sky ===
+    if (m_rendering_mode == GLWindow::ADS)
+    {
+      glDepthMask(GL_FALSE);
+      m_skybox->draw(context()->versionFunctions<QOpenGLFunctions_4_1_Core>());
+      glDepthMask(GL_TRUE);
+    }
+  });
+  m_render_graph.write(background, backbuffer);
 
   //////////////////////////////////////////////////////////////////////////////
-  /// Quad
+  /// Quad: lighting shader
   //////////////////////////////////////////////////////////////////////////////
-  m_lighting_program->bind();
-  m_world_position_texture->bind(0);
-  m_world_normal_texture->bind(1);
-  m_blurred_occlusion_texture->bind(2);
-  m_skybox->getCubeMapTexture()->bind(3);
-
-
-  m_quad_vao->bind();
-    m_lighting_program->setUniformValue("ModelMatrix", m_model_matrix);
-    m_lighting_program->setUniformValue("ViewMatrix", m_input_manager->getViewMatrix());
-    glUniformSubroutinesuiv(GL_FRAGMENT_SHADER, 1, &m_activeRenderPassIndex);
-
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glDisable(GL_BLEND);
-
-
-  m_quad_vao->release();
-  m_lighting_program->release();
-
+  const Pass lighting = m_render_graph.addPass("lighting", [this, depth, normal, blurred, shadeOcclusion]()
+  {
+    QOpenGLShaderProgram *program = lightingProgram();
+    program->bind();
+    m_render_graph.texture(depth)->bind(0);
+    m_render_graph.texture(normal)->bind(1);
+    if (shadeOcclusion) m_render_graph.texture(blurred)->bind(2);
+    if (m_skybox->getCubeMapTexture()) m_skybox->getCubeMapTexture()->bind(3);
 
+    m_quad_vao->bind();
+      glDisable(GL_DEPTH_TEST);
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      glDrawArrays(GL_TRIANGLES, 0, 6);
+      glDisable(GL_BLEND);
+    m_quad_vao->release();
+    program->release();
+  });
+  m_render_graph.read(lighting, depth);
+  m_render_graph.read(lighting, normal);
+  if (shadeOcclusion) m_render_graph.read(lighting, blurred);
+  m_render_graph.write(lighting, backbuffer);
 
   //////////////////////////////////////////////////////////////////////////////
   /// Manipulators and Lights
   //////////////////////////////////////////////////////////////////////////////
-  // Flush the depth values
-  glClear(GL_DEPTH_BUFFER_BIT);
-  // Don't draw color, just depth
-  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-  // Enable depth testing so manipulators / particles are tested
-  glEnable(GL_DEPTH_TEST);
-  // Draw the particles depth values
-  drawParticles();
-  // Enable back colour so we can paint manipulators
-  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-  // Draw manipulators
+  const Pass overlay = m_render_graph.addPass("overlay", [this, depth]()
+  {
+    // Don't draw color, just depth
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    // Enable depth testing so manipulators are tested
+    glEnable(GL_DEPTH_TEST);
+    // Copy the particles depth values from the gBuffer, every pixel is written
+    // so there is no need to clear.
+    glDepthFunc(GL_ALWAYS);
+    m_depth_copy_program->bind();
+    m_render_graph.texture(depth)->bind(0);
+    m_quad_vao->bind();
+      glDrawArrays(GL_TRIANGLES, 0, 6);
+    m_quad_vao->release();
+    m_depth_copy_program->release();
+    glDepthFunc(GL_LESS);
+    // Enable back colour so we can paint manipulators
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    // Draw manipulators
 
-  for(auto &s : m_object_list) { s->draw(); }
+    for(auto &s : m_object_list) { s->draw(); }
 
-  if (m_draw_links) drawLinks();
+    if (m_draw_links) drawLinks();
 
-  // Bring it back to previous state
-  glDisable(GL_DEPTH_TEST);
+    // Bring it back to previous state
+    glDisable(GL_DEPTH_TEST);
+  });
+  m_render_graph.read(overlay, depth);
+  m_render_graph.write(overlay, backbuffer);
 
-  updateParticleSystem();
+  m_render_graph.compile();
+
+  // Frames without occlusion leave the history behind the camera
+  if (m_render_graph.isCulled(ssao)) m_occlusion_history_valid = false;
 }
 
 void GLWindow::resizeGL(int _w, int _h)
 {
   qDebug("Window resized to %dx%d", _w, _h);
-  m_input_manager->resized(_w, _h);
   m_input_manager->setupCamera(45.0f, width(), height(), 0.1f, 1000.0f);
+
+  // Dragging the window resizes it many times a second, the targets are only
+  // reallocated once it settles.
+  if (_w == m_target_width && _h == m_target_height) m_resize_timer.stop();
+  else m_resize_timer.start();
+
+  // The framebuffer of the widget is new and empty
+  requestRender();
+}
+
+void GLWindow::reallocateTargets()
+{
+  if (width() == m_target_width && height() == m_target_height) return;
+  qDebug("Resize settled, reallocating the render targets");
+
+  makeCurrent();
+  m_target_width = width();
+  m_target_height = height();
+  m_input_manager->resized(m_target_width, m_target_height);
   cleanup();
   prepareSSAOPipeline();
-  m_ssao_program->bind();
-  m_ssao_program->setUniformValue("width", _w);
-  m_ssao_program->setUniformValue("height", _h);
-  m_ssao_program->release();
-  glViewport(0, 0, width(), height());
+  doneCurrent();
 
+  requestRender();
 }
 
 void GLWindow::initializeMatrices()
@@ -581,32 +802,43 @@ void GLWindow::loadLightToShader()
   m_ps.setLightPos(m_lightPos);
   m_ps.setLightPos(m_fillLightPos);
 
-  //Setting light struct values.
-  m_lighting_program->bind();
-    m_lighting_program->setUniformValue("light.position", m_lightPos);
-    m_lighting_program->setUniformValue("light.ambient", QVector3D(m_lightAmbientR, m_lightAmbientG, m_lightAmbientB));
-    m_lighting_program->setUniformValue("light.diffuse", QVector3D(m_lightDiffuseR, m_lightDiffuseG, m_lightDiffuseB));
-    m_lighting_program->setUniformValue("light.specular", QVector3D(m_lightSpecularR, m_lightSpecularG, m_lightSpecularB));
-    m_lighting_program->setUniformValue("light.Linear", 0.09f);
-    m_lighting_program->setUniformValue("light.Quadratic", 0.032f);
-
-    m_lighting_program->setUniformValue("fillLight.position", m_fillLightPos);
-    m_lighting_program->setUniformValue("fillLight.ambient", QVector3D(m_fillLight, m_fillLight, m_fillLight));
-    m_lighting_program->setUniformValue("fillLight.diffuse", QVector3D(m_fillLight, m_fillLight, m_fillLight));
-    m_lighting_program->setUniformValue("fillLight.specular", QVector3D(m_fillLight, m_fillLight, m_fillLight));
-  m_lighting_program->release();
+  const QVector3D ambient(m_lightAmbientR, m_lightAmbientG, m_lightAmbientB);
+  const QVector3D diffuse(m_lightDiffuseR, m_lightDiffuseG, m_lightDiffuseB);
+  const QVector3D specular(m_lightSpecularR, m_lightSpecularG, m_lightSpecularB);
+  const QVector3D fill(m_fillLight, m_fillLight, m_fillLight);
+
+  // Only reaches OpenGL when a light moved or a slider changed
+  LightsBlock block = {};
+  copyVector(m_lightPos, block.position);
+  copyVector(ambient, block.ambient);
+  copyVector(diffuse, block.diffuse);
+  copyVector(specular, block.specular);
+  block.linear = 0.09f;
+  block.quadratic = 0.032f;
+
+  copyVector(m_fillLightPos, block.fillPosition);
+  copyVector(fill, block.fillAmbient);
+  copyVector(fill, block.fillDiffuse);
+  copyVector(fill, block.fillSpecular);
+
+  m_lights_ubo.setData(block);
+  m_lights_ubo.upload(this);
 }
 
 void GLWindow::loadMaterialToShader()
 {
-    //Setting material struct values.
-  m_lighting_program->bind();
-    m_lighting_program->setUniformValue("material.ambient", QVector3D(m_materialR*0.5, m_materialG*0.5, m_materialB*0.5));
-    m_lighting_program->setUniformValue("material.diffuse", QVector3D(m_materialR, m_materialG, m_materialB));
-    m_lighting_program->setUniformValue("material.specular", QVector3D(0.5f, 0.5f, 0.5f));
-    m_lighting_program->setUniformValue("material.shininess", 32.0f);
-    m_lighting_program->setUniformValue("material.attenuation", 0.5f);
-  m_lighting_program->release();
+  const QVector3D diffuse(m_materialR, m_materialG, m_materialB);
+  const QVector3D ambient = diffuse * 0.5f;
+
+  MaterialBlock block = {};
+  copyVector(ambient, block.ambient);
+  copyVector(diffuse, block.diffuse);
+  block.specular[0] = block.specular[1] = block.specular[2] = 0.5f;
+  block.shininess = 32.0f;
+  block.attenuation = 0.5f;
+
+  m_material_ubo.setData(block);
+  m_material_ubo.upload(this);
 }
 
 void GLWindow::prepareQuad()
@@ -631,11 +863,12 @@ void GLWindow::prepareQuad()
 
   m_quad_vbo.allocate(quad, 30 * sizeof(GLfloat));
 
-  m_lighting_program->setAttributeBuffer("position", GL_FLOAT, 0, 3, 5 * sizeof(GLfloat));
-  m_lighting_program->enableAttributeArray("position");
+  // Locations fixed in ssao.vert, shared by all the full screen programs
+  m_ssao_program->setAttributeBuffer("position", GL_FLOAT, 0, 3, 5 * sizeof(GLfloat));
+  m_ssao_program->enableAttributeArray("position");
 
-  m_lighting_program->setAttributeBuffer("uv", GL_FLOAT, 3 * sizeof(GLfloat), 2, 5 * sizeof(GLfloat));
-  m_lighting_program->enableAttributeArray("uv");
+  m_ssao_program->setAttributeBuffer("uv", GL_FLOAT, 3 * sizeof(GLfloat), 2, 5 * sizeof(GLfloat));
+  m_ssao_program->enableAttributeArray("uv");
 
   m_quad_vbo.release();
   m_quad_vao->release();
@@ -644,9 +877,7 @@ void GLWindow::prepareQuad()
 void GLWindow::prepareParticles()
 {
   m_links_program = new QOpenGLShaderProgram(this);
-  m_links_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/links.vert");
-  m_links_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/links.frag");
-  m_links_program->link();
+  m_program_cache.build(m_links_program, ":/shader/links.vert", ":/shader/links.frag");
 
   m_part_vao = new QOpenGLVertexArrayObject(this);
   m_part_vao->create();
@@ -654,37 +885,255 @@ void GLWindow::prepareParticles()
   m_links_vao = new QOpenGLVertexArrayObject(this);
   m_links_vao->create();
 
+  // The sphere never changes, it only needs uploading once
+  m_sphere_vbo.create();
+  m_sphere_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+  m_sphere_vbo.bind();
+  m_sphere_vbo.allocate(&m_sphere_data[0], m_sphere_data.size() * sizeof(GLfloat));
+  m_sphere_vbo.release();
+
   m_part_vbo.create();
-  m_part_vbo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+  m_part_vbo.setUsagePattern(QOpenGLBuffer::StreamDraw);
+  reserveInstanceRing(m_ps.getSize());
 
   m_links_ebo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
   m_links_ebo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
   m_links_ebo.create();
 
+  // Vertex state is set once, per draw only the instance offset changes
+  m_part_vao->bind();
+    m_sphere_vbo.bind();
+    m_geom_program->enableAttributeArray("position");
+    m_geom_program->setAttributeBuffer("position", GL_FLOAT, 0, 3);
+
+    m_part_vbo.bind();
+    m_geom_program->enableAttributeArray("instances");
+    m_geom_program->setAttributeBuffer("instances", GL_FLOAT, 0, 4);
+    glVertexAttribDivisor(m_geom_program->attributeLocation("instances"), 1);
+    m_part_vbo.release();
+  m_part_vao->release();
+
+  // Links index the particles of the region being drawn through the base
+  // vertex, so the attribute always starts at the beginning of the buffer.
+  m_links_vao->bind();
+    m_part_vbo.bind();
+    m_links_ebo.bind();
+    m_links_program->enableAttributeArray("position");
+    m_links_program->setAttributeBuffer("position", GL_FLOAT, 0, 3, 4 * sizeof(GLfloat));
+    m_part_vbo.release();
+  m_links_vao->release();
+
   // Initial batch
   sendParticleDataToOpenGL();
 }
 
 void GLWindow::drawParticles()
 {
+  if (m_impostors)
+  {
+    drawImpostors();
+    return;
+  }
+
   m_geom_program->bind();
-  m_geom_program->setUniformValue("ModelMatrix", m_model_matrix);
-  m_geom_program->setUniformValue("ViewMatrix", m_input_manager->getViewMatrix());
-  m_geom_program->setUniformValue("ProjectionMatrix", m_input_manager->getProjectionMatrix());
   m_part_vao->bind();
-    glDrawArraysInstanced(GL_TRIANGLES, 0, m_sphere_data.size() / 3, m_ps.getSize());
+  m_part_vbo.bind();
+    const GLintptr region = m_instance_region * m_instance_capacity * 4 * sizeof(GLfloat);
+    for (uint lod = 0; lod < m_sphere_lods; ++lod)
+    {
+      if (m_lod_instance_count[lod] == 0) continue;
+
+      // One draw per level, each pointed to its own run of instances
+      m_geom_program->setAttributeBuffer(
+            "instances",
+            GL_FLOAT,
+            region + m_lod_instance_start[lod] * 4 * sizeof(GLfloat),
+            4);
+      glDrawArraysInstanced(
+            GL_TRIANGLES,
+            m_sphere_lod_first[lod],
+            m_sphere_lod_count[lod],
+            m_lod_instance_count[lod]);
+    }
+  m_part_vbo.release();
   m_part_vao->release();
   m_geom_program->release();
 }
 
+void GLWindow::drawImpostors()
+{
+  m_impostor_program->bind();
+  m_part_vao->bind();
+  m_part_vbo.bind();
+    // A quad costs the same at any distance, the runs of all the levels of
+    // detail are contiguous so they go in a single draw.
+    const GLsizei count =
+        m_lod_instance_start[m_sphere_lods - 1] + m_lod_instance_count[m_sphere_lods - 1];
+    const GLintptr region = m_instance_region * m_instance_capacity * 4 * sizeof(GLfloat);
+
+    m_impostor_program->setAttributeBuffer("instances", GL_FLOAT, region, 4);
+    glDrawArraysInstanced(GL_TRIANGLES, m_impostor_first, 6, count);
+  m_part_vbo.release();
+  m_part_vao->release();
+  m_impostor_program->release();
+}
+
+void GLWindow::prepareOcclusionQueries()
+{
+  m_box_program = new QOpenGLShaderProgram(this);
+  m_program_cache.build(m_box_program, ":/shader/occlusion_box.vert", ":/shader/occlusion_box.frag");
+  m_box_program->bind();
+  m_box_program->setUniformValue("tBoxes", 0);
+  m_box_program->release();
+
+  // The shader builds the cube from the vertex index, the VAO has no
+  // attributes but the core profile needs one bound to draw.
+  m_box_vao = new QOpenGLVertexArrayObject(this);
+  m_box_vao->create();
+
+  // Corners of the boxes, filled in before the queries of every frame
+  m_box_buffer.create();
+  m_box_buffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+  m_box_buffer.bind();
+  m_box_buffer.allocate(6 * sizeof(GLfloat));
+  m_box_buffer.release();
+
+  glGenTextures(1, &m_box_texture);
+  glBindTexture(GL_TEXTURE_BUFFER, m_box_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, m_box_buffer.bufferId());
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void GLWindow::readOcclusionQueries()
+{
+  m_occluded_clusters.clear();
+
+  // Keys of a grid with other cells name other regions of space
+  const bool sameGrid = m_cluster_grid.getCellSize() == m_occlusion_cell_size;
+
+  // Results not ready yet count as visible, better to draw a hidden cluster
+  // than to wait for the GPU.
+  for (size_t i = 0; sameGrid && i < m_occlusion_keys.size(); ++i)
+  {
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(m_occlusion_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available == GL_FALSE) continue;
+
+    GLuint passed = GL_TRUE;
+    glGetQueryObjectuiv(m_occlusion_queries[i], GL_QUERY_RESULT, &passed);
+    if (passed == GL_FALSE) m_occluded_clusters.insert(m_occlusion_keys[i]);
+  }
+
+  m_occlusion_keys.clear();
+}
+
+void GLWindow::issueOcclusionQueries()
+{
+  // See-through modes can not hide anything
+  if (!m_occlusion_culling || m_rendering_mode == GLWindow::XRAY) return;
+
+  const QMatrix4x4 modelView = m_input_manager->getViewMatrix() * m_model_matrix;
+  const QVector3D camera = modelView.inverted().column(3).toVector3D();
+
+  // A box the camera is in would be clipped by the near plane and look hidden
+  const QVector3D margin(1.0f, 1.0f, 1.0f);
+
+  if (m_occlusion_queries.size() < m_visible_clusters.size())
+  {
+    const size_t old = m_occlusion_queries.size();
+    m_occlusion_queries.resize(m_visible_clusters.size());
+    glGenQueries(m_occlusion_queries.size() - old, &m_occlusion_queries[old]);
+  }
+
+  // Upload the boxes in one go, so each query is a single draw
+  m_box_data.clear();
+  for (uint idx : m_visible_clusters)
+  {
+    const ClusterGrid::Cluster &cluster = m_cluster_grid.getCluster(idx);
+
+    const QVector3D lo = cluster.min - margin;
+    const QVector3D hi = cluster.max + margin;
+    if (camera.x() > lo.x() && camera.y() > lo.y() && camera.z() > lo.z() &&
+        camera.x() < hi.x() && camera.y() < hi.y() && camera.z() < hi.z())
+    {
+      continue;
+    }
+
+    const QVector3D corners[2] = {cluster.min, cluster.max};
+    for (const QVector3D &corner : corners)
+    {
+      m_box_data.push_back(corner.x());
+      m_box_data.push_back(corner.y());
+      m_box_data.push_back(corner.z());
+    }
+    m_occlusion_keys.push_back(cluster.key);
+  }
+  m_occlusion_cell_size = m_cluster_grid.getCellSize();
+  if (m_occlusion_keys.empty()) return;
+
+  m_box_buffer.bind();
+  m_box_buffer.allocate(&m_box_data[0], m_box_data.size() * sizeof(GLfloat));
+  m_box_buffer.release();
+
+  m_box_program->bind();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_BUFFER, m_box_texture);
+
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  glEnable(GL_DEPTH_TEST);
+
+  m_box_vao->bind();
+  for (size_t i = 0; i < m_occlusion_keys.size(); ++i)
+  {
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, m_occlusion_queries[i]);
+      glDrawArrays(GL_TRIANGLES, GLint(36 * i), 36);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+  }
+  m_box_vao->release();
+
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  glDepthMask(GL_TRUE);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  m_box_program->release();
+}
+
+void GLWindow::readGeometryTimer()
+{
+  if (!m_geometry_query_pending) return;
+
+  GLuint available = GL_FALSE;
+  glGetQueryObjectuiv(m_geometry_query, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available == GL_FALSE) return;
+
+  GLuint64 elapsed = 0;
+  glGetQueryObjectui64v(m_geometry_query, GL_QUERY_RESULT, &elapsed);
+  m_geometry_time += elapsed;
+  m_geometry_frames++;
+  m_geometry_query_pending = false;
+}
+
+void GLWindow::reportGeometryTimer()
+{
+  if (m_geometry_frames > 0)
+  {
+    qInfo("%s geometry pass: %.3f ms per frame over %d frames with %d particles.",
+          m_impostors ? "Impostor" : "Mesh",
+          m_geometry_time / (1.0e6 * m_geometry_frames),
+          m_geometry_frames,
+          m_ps.getSize());
+  }
+
+  m_geometry_time = 0;
+  m_geometry_frames = 0;
+}
+
 void GLWindow::drawLinks()
 {
   m_links_program->bind();
-  m_links_program->setUniformValue("ProjectionMatrix", m_input_manager->getProjectionMatrix());
-  m_links_program->setUniformValue("ModelMatrix", m_model_matrix);
-  m_links_program->setUniformValue("ViewMatrix", m_input_manager->getViewMatrix());
   m_links_vao->bind();
-    glDrawElements(GL_LINES, m_links_data.size(), GL_UNSIGNED_INT, 0);
+    glDrawElementsBaseVertex(GL_LINES, m_visible_links_data.size(), GL_UNSIGNED_INT, 0, m_instance_region * m_instance_capacity);
   m_links_vao->release();
   m_links_program->release();
 }
@@ -692,14 +1141,10 @@ void GLWindow::drawLinks()
 void GLWindow::setupLights()
 {
   m_manipulator_program = new QOpenGLShaderProgram(this);
-  m_manipulator_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/manip.vert");
-  m_manipulator_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/manip.frag");
-  m_manipulator_program->link();
+  m_program_cache.build(m_manipulator_program, ":/shader/manip.vert", ":/shader/manip.frag");
 
   m_sun_program = new QOpenGLShaderProgram(this);
-  m_sun_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/sun.vert");
-  m_sun_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/sun.frag");
-  m_sun_program->link();
+  m_program_cache.build(m_sun_program, ":/shader/sun.vert", ":/shader/sun.frag");
 
   QVector3D masterUniqueColour=QVector3D(0.0f, 100.0f, 0.0f);
 
@@ -711,8 +1156,6 @@ void GLWindow::setupLights()
   pointlight->createGeometry(masterUniqueColour);
   m_object_list.push_back(std::move(std::unique_ptr<PointLight>(pointlight)));
 
-  m_input_manager->addShaderProgram(m_manipulator_program);
-  m_input_manager->addShaderProgram(m_sun_program);
   m_input_manager->setObjectList(m_object_list);
 }
 
@@ -723,8 +1166,6 @@ void GLWindow::generateSphereData(uint _num_subdivisions)
     _num_subdivisions = 1;
   }
 
-  m_sphere_data.clear();
-
   GLfloat X = 0.525731112119133606;
   GLfloat Z = 0.850650808352039932;
 
@@ -750,6 +1191,89 @@ void GLWindow::generateSphereData(uint _num_subdivisions)
   }
 }
 
+void GLWindow::generateSphereLODs()
+{
+  // Subdivisions of each level: 5120, 1280, 320 and 80 triangles
+  static const uint subdivisions[m_sphere_lods] = {4, 3, 2, 1};
+
+  m_sphere_data.clear();
+  for (uint lod = 0; lod < m_sphere_lods; ++lod)
+  {
+    m_sphere_lod_first[lod] = m_sphere_data.size() / 3;
+    generateSphereData(subdivisions[lod]);
+    m_sphere_lod_count[lod] = m_sphere_data.size() / 3 - m_sphere_lod_first[lod];
+  }
+
+  // Quad for the impostors, facing the camera in view space
+  static const GLfloat quad[] = {
+    -1.0f, -1.0f, 0.0f,
+     1.0f, -1.0f, 0.0f,
+     1.0f,  1.0f, 0.0f,
+     1.0f,  1.0f, 0.0f,
+    -1.0f,  1.0f, 0.0f,
+    -1.0f, -1.0f, 0.0f
+  };
+
+  m_impostor_first = m_sphere_data.size() / 3;
+  m_sphere_data.insert(m_sphere_data.end(), quad, quad + 18);
+}
+
+void GLWindow::binParticlesByLOD()
+{
+  // Smallest radius in pixels each level is used for. Below the last one the
+  // coarsest sphere is already smaller than a few pixels.
+  static const float minPixelRadius[m_sphere_lods] = {48.0f, 16.0f, 6.0f, 0.0f};
+
+  const QMatrix4x4 modelView = m_input_manager->getViewMatrix() * m_model_matrix;
+  const QMatrix4x4 projection = m_input_manager->getProjectionMatrix();
+
+  // Radius in pixels of a sphere of radius one at distance one
+  const float pixelScale = 0.5f * height() * projection(1, 1);
+
+  const uint visible = m_draw_order.size();
+  m_particle_lod.resize(visible);
+  m_lod_instance_count.fill(0);
+
+  for (uint i = 0; i < visible; ++i)
+  {
+    const GLfloat *instance = &m_particle_data[m_draw_order[i] * 4];
+    const float depth = -(modelView * QVector3D(instance[0], instance[1], instance[2])).z();
+
+    // Behind the camera it will be clipped anyway, give it the coarsest
+    uint lod = m_sphere_lods - 1;
+    if (depth > 0.0f)
+    {
+      const float pixelRadius = instance[3] * pixelScale / depth;
+      lod = 0;
+      while (lod < m_sphere_lods - 1 && pixelRadius < minPixelRadius[lod]) ++lod;
+    }
+
+    m_particle_lod[i] = lod;
+    m_lod_instance_count[lod]++;
+  }
+
+  GLsizei start = 0;
+  for (uint lod = 0; lod < m_sphere_lods; ++lod)
+  {
+    m_lod_instance_start[lod] = start;
+    start += m_lod_instance_count[lod];
+  }
+
+  // Scatter every particle into the run of its level, the culled ones are
+  // left without a slot. The scatter is stable so each run keeps the order.
+  std::array<GLsizei, m_sphere_lods> next = m_lod_instance_start;
+  m_lod_particle_data.resize(visible * 4);
+  m_instance_slot.assign(m_particle_data.size() / 4, m_no_instance_slot);
+
+  for (uint i = 0; i < visible; ++i)
+  {
+    const uint particle = m_draw_order[i];
+    const uint slot = next[m_particle_lod[i]]++;
+    m_instance_slot[particle] = slot;
+    std::copy(&m_particle_data[particle * 4], &m_particle_data[particle * 4] + 4, &m_lod_particle_data[slot * 4]);
+  }
+}
+
 void GLWindow::updateParticleSystem()
 {
   m_ps.setLightPos(m_lightPos);
@@ -773,27 +1297,9 @@ void GLWindow::sendParticleDataToOpenGL()
   // Uncomment to see what x, y, z, radius get sent to the shader
   // for_each(m_particle_data.begin(), m_particle_data.end(), [](float f){ qDebug("%f", f);});
 
-  m_part_vao->bind();
-
-    // Sphere Data =============================================================
-    m_sphere_vbo.bind();
-    m_sphere_vbo.allocate(&m_sphere_data[0], m_sphere_data.size() * sizeof(GLfloat));
-    m_geom_program->enableAttributeArray("position");
-    m_geom_program->setAttributeBuffer("position", GL_FLOAT, 0, 3);
-
-    // Instance Data ===========================================================
-    m_part_vbo.bind();
-    m_part_vbo.allocate(&m_particle_data[0], m_ps.getSize() * 4 * sizeof(GLfloat));
-
-    m_geom_program->enableAttributeArray("instances");
-    m_geom_program->setAttributeBuffer("instances", GL_FLOAT, 0, 4);
+  m_cluster_grid.build(m_particle_data);
 
-    m_part_vbo.release();
-    glVertexAttribDivisor(m_geom_program->attributeLocation("instances"), 1);
-
-  m_part_vao->release();
-
-  // Link Data (on request) =========================================23===========
+  // Link Data (on request) ====================================================
   if (m_draw_links)
   {
     // Work on the links
@@ -801,17 +1307,193 @@ void GLWindow::sendParticleDataToOpenGL()
 
     // Uncomment to see what indices are being sent to ebo
     // for_each(m_links_data.begin(), m_links_data.end(), [](uint i){ qDebug("%d", i);});
+  }
+
+  // Nothing reaches OpenGL until uploadInstances() runs at the beginning of
+  // the next frame, once the camera for that frame is known.
+}
+
+void GLWindow::sortVisibleParticles()
+{
+  if (!m_depth_sorting)
+  {
+    m_draw_order = m_visible_particles;
+    return;
+  }
+
+  // Front to back lets the depth test reject hidden fragments early, in every
+  // mode since the geometry pass never blends.
+  const QMatrix4x4 modelView = m_input_manager->getViewMatrix() * m_model_matrix;
+  m_depth_sorter.update(m_particle_data, modelView, false);
+
+  // The sorter orders every particle, keep the ones that survived culling
+  m_particle_visible.assign(m_particle_data.size() / 4, false);
+  for (uint particle : m_visible_particles) m_particle_visible[particle] = true;
+
+  m_draw_order.clear();
+  for (uint particle : m_depth_sorter.getOrder())
+  {
+    if (m_particle_visible[particle]) m_draw_order.push_back(particle);
+  }
+}
+
+void GLWindow::uploadInstances()
+{
+  // Only the clusters inside the frustum are uploaded and drawn
+  const QMatrix4x4 modelViewProjection =
+      m_input_manager->getProjectionMatrix() *
+      m_input_manager->getViewMatrix() *
+      m_model_matrix;
+
+  m_cluster_grid.cull(modelViewProjection, m_visible_clusters);
+
+  // Clusters found hidden behind others last frame are skipped as well
+  readOcclusionQueries();
+  m_drawn_clusters.clear();
+  for (uint idx : m_visible_clusters)
+  {
+    if (m_occluded_clusters.count(m_cluster_grid.getCluster(idx).key) == 0)
+    {
+      m_drawn_clusters.push_back(idx);
+    }
+  }
+
+  m_cluster_grid.gatherParticles(m_drawn_clusters, m_visible_particles);
 
+  sortVisibleParticles();
+  binParticlesByLOD();
+  if (m_draw_links) gatherVisibleLinks();
+
+  // Instance Data =============================================================
+  reserveInstanceRing(m_ps.getSize());
+
+  m_instance_region = (m_instance_region + 1) % m_instance_ring_regions;
+  waitForInstanceRegion(m_instance_region);
+
+  const GLintptr offset = m_instance_region * m_instance_capacity * 4 * sizeof(GLfloat);
+  const GLsizeiptr bytes = m_lod_particle_data.size() * sizeof(GLfloat);
+
+  m_part_vbo.bind();
+  if (bytes > 0)
+  {
+    // The fence guarantees nobody reads the region, no need for the driver to
+    // synchronise with the GPU on our behalf.
+    void *region = m_part_vbo.mapRange(
+          offset,
+          bytes,
+          QOpenGLBuffer::RangeWrite |
+          QOpenGLBuffer::RangeInvalidate |
+          QOpenGLBuffer::RangeUnsynchronized);
+
+    if (region)
+    {
+      memcpy(region, &m_lod_particle_data[0], bytes);
+      m_part_vbo.unmap();
+    }
+    else
+    {
+      qWarning("Could not map the instance buffer, falling back to a copy.");
+      m_part_vbo.write(offset, &m_lod_particle_data[0], bytes);
+    }
+  }
+  m_part_vbo.release();
+
+  // Link Data =================================================================
+  if (m_draw_links)
+  {
     m_links_vao->bind();
-      m_part_vbo.bind();
-      m_links_ebo.bind();
-      m_links_ebo.allocate(&m_links_data[0], m_links_data.size() * sizeof(uint));
-      m_links_program->enableAttributeArray("position");
-      m_links_program->setAttributeBuffer("position", GL_FLOAT, 0, 3, 4 * sizeof(GLfloat));
+      m_links_ebo.allocate(m_visible_links_data.data(), m_visible_links_data.size() * sizeof(uint));
     m_links_vao->release();
   }
 }
 
+void GLWindow::gatherVisibleLinks()
+{
+  // A link crossing the edge of the screen, or going behind an occluder, is
+  // still seen as long as one end is in the frustum.
+  m_particle_in_frustum.assign(m_particle_data.size() / 4, false);
+  const std::vector<uint> &particles = m_cluster_grid.getParticles();
+  for (uint idx : m_visible_clusters)
+  {
+    const ClusterGrid::Cluster &cluster = m_cluster_grid.getCluster(idx);
+    for (uint i = cluster.first; i < cluster.first + cluster.count; ++i) m_particle_in_frustum[particles[i]] = true;
+  }
+
+  // The instances were reordered by level of detail. Ends that were not drawn
+  // go to a tail past the draws, each particle at most once, so the region
+  // never holds more than every particle.
+  m_visible_links_data.clear();
+  for (size_t i = 0; i + 1 < m_links_data.size(); i += 2)
+  {
+    const uint a = m_links_data[i];
+    const uint b = m_links_data[i + 1];
+    if (a >= m_instance_slot.size() || b >= m_instance_slot.size()) continue;
+    if (!m_particle_in_frustum[a] && !m_particle_in_frustum[b]) continue;
+
+    for (uint particle : {a, b})
+    {
+      uint &slot = m_instance_slot[particle];
+      if (slot == m_no_instance_slot)
+      {
+        slot = m_lod_particle_data.size() / 4;
+        m_lod_particle_data.insert(m_lod_particle_data.end(), &m_particle_data[particle * 4], &m_particle_data[particle * 4] + 4);
+      }
+      m_visible_links_data.push_back(slot);
+    }
+  }
+}
+
+void GLWindow::reserveInstanceRing(uint _count)
+{
+  if (_count <= m_instance_capacity && m_instance_capacity > 0) return;
+
+  // Grow geometrically so a growing organism does not reallocate every split
+  uint capacity = m_instance_capacity > 0 ? m_instance_capacity : 256;
+  while (capacity < _count) capacity *= 2;
+
+  // Allocating orphans the old storage, the draws still using it keep it
+  // alive, so the old fences are of no use anymore.
+  deleteInstanceFences();
+  m_instance_capacity = capacity;
+  m_instance_region = 0;
+
+  m_part_vbo.bind();
+  m_part_vbo.allocate(m_instance_ring_regions * m_instance_capacity * 4 * sizeof(GLfloat));
+  m_part_vbo.release();
+
+  qDebug("Instance ring resized to %d particles per region.", m_instance_capacity);
+}
+
+void GLWindow::waitForInstanceRegion(uint _region)
+{
+  GLsync &fence = m_instance_fences[_region];
+  if (fence == nullptr) return;
+
+  GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  while (result == GL_TIMEOUT_EXPIRED)
+  {
+    // One frame of GPU work at most, wait a millisecond at a time
+    result = glClientWaitSync(fence, 0, 1000000);
+  }
+
+  if (result == GL_WAIT_FAILED)
+  {
+    qWarning("Waiting on the instance ring fence failed.");
+  }
+
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+void GLWindow::deleteInstanceFences()
+{
+  for (GLsync &fence : m_instance_fences)
+  {
+    if (fence != nullptr) glDeleteSync(fence);
+    fence = nullptr;
+  }
+}
+
 void GLWindow::updateModelMatrix()
 {
   // Insert particle system position here
@@ -831,7 +1513,6 @@ void GLWindow::keyPressEvent(QKeyEvent* ev)
       break;
 
     case Qt::Key_1:
-      m_activeRenderPassIndex = m_ADSIndex;
       m_rendering_mode = GLWindow::ADS;
       emit changedShadingType(0);
       emit setConnectionState(true);
@@ -839,7 +1520,6 @@ void GLWindow::keyPressEvent(QKeyEvent* ev)
       break;
 
     case Qt::Key_2:
-      m_activeRenderPassIndex = m_XRayIndex;
       m_rendering_mode = GLWindow::XRAY;
 
       emit changedShadingType(1);
@@ -848,7 +1528,6 @@ void GLWindow::keyPressEvent(QKeyEvent* ev)
       break;
 
     case Qt::Key_3:
-      m_activeRenderPassIndex = m_AOIndex;
       m_rendering_mode = GLWindow::AO;
       emit changedShadingType(2);
       emit setConnectionState(false);
@@ -856,7 +1535,6 @@ void GLWindow::keyPressEvent(QKeyEvent* ev)
       break;
 
   case Qt::Key_4:
-    m_activeRenderPassIndex = m_NewOrderIndex;
     m_rendering_mode = GLWindow::newOrder;
     emit changedShadingType(3);
     qDebug("New Order Artstyle.");
@@ -866,11 +1544,39 @@ void GLWindow::keyPressEvent(QKeyEvent* ev)
       bulge();
       break;
 
+    case Qt::Key_O:
+      m_occlusion_culling = !m_occlusion_culling;
+      qDebug("Occlusion culling %s.", m_occlusion_culling ? "on" : "off");
+      break;
+
+    case Qt::Key_Q:
+      setSSAOQuality((m_ssao_quality + 1) % 3);
+      break;
+
+    case Qt::Key_Z:
+      m_depth_sorting = !m_depth_sorting;
+      m_depth_sorter.invalidate();
+      qDebug("Depth sorting %s.", m_depth_sorting ? "on" : "off");
+      break;
+
+    // Switching prints how long the geometry pass took in the previous mode
+    case Qt::Key_I:
+      reportGeometryTimer();
+      m_impostors = !m_impostors;
+      qDebug("%s particles.", m_impostors ? "Impostor" : "Mesh");
+      break;
+
+    case Qt::Key_Escape:
+      m_selected_particles.clear();
+      qDebug("Selection cleared.");
+      break;
+
     default:
       break;
   }
 
   m_input_manager->keyPressEvent(ev);
+  requestRender();
 }
 
 void GLWindow::keyReleaseEvent(QKeyEvent *key)
@@ -883,32 +1589,138 @@ void GLWindow::mouseMoveEvent(QMouseEvent* event)
 {
   makeCurrent();
   setFocus();
+
+  // The camera stays put while a region is dragged
+  switch (m_region_mode)
+  {
+    case GLWindow::REGION_BOX:
+      m_region_points.back() = event->pos();
+      return;
+
+    case GLWindow::REGION_LASSO:
+      if ((event->pos() - m_region_points.back()).manhattanLength() >= m_region_click_distance)
+        m_region_points.push_back(event->pos());
+      return;
+
+    default:
+      break;
+  }
+
   m_input_manager->mouseMoveEvent(event);
 
+  // Dragging moves the camera or a manipulator, hovering only needs the pick
+  // to come back.
+  if (event->buttons() != Qt::NoButton) requestRender();
+  else if (!m_timer.isActive()) m_timer.start();
 }
 
 void GLWindow::mousePressEvent(QMouseEvent *event)
 {
   makeCurrent();
   setFocus();
+
+  if (event->button() == Qt::LeftButton && (event->modifiers() & (Qt::ShiftModifier | Qt::ControlModifier)))
+  {
+    m_region_mode = (event->modifiers() & Qt::ShiftModifier) ? GLWindow::REGION_BOX : GLWindow::REGION_LASSO;
+    m_region_points.assign(m_region_mode == GLWindow::REGION_BOX ? 2 : 1, event->pos());
+    return;
+  }
+
   m_input_manager->mousePressEvent(event);
+  requestRender();
 }
 
 void GLWindow::mouseReleaseEvent(QMouseEvent *event)
 {
   makeCurrent();
   setFocus();
+
+  if (m_region_mode != GLWindow::REGION_NONE)
+  {
+    if (event->button() != Qt::LeftButton) return;
+
+    m_region_points.push_back(event->pos());
+    finishRegionSelection();
+    m_region_mode = GLWindow::REGION_NONE;
+    m_region_points.clear();
+    return;
+  }
+
   m_input_manager->mouseReleaseEvent(event);
+  requestRender();
 
   qDebug("Light Position length: %f", m_lightPos.length());
   qDebug("Fill Light Position length: %f", m_fillLightPos.length());
 }
 
+QVector2D GLWindow::toNormalizedDevice(const QPoint &_position) const
+{
+  return QVector2D(
+      2.0f * _position.x() / width() - 1.0f,
+      1.0f - 2.0f * _position.y() / height());
+}
+
+void GLWindow::finishRegionSelection()
+{
+  const QMatrix4x4 modelViewProjection =
+      m_input_manager->getProjectionMatrix() *
+      m_input_manager->getViewMatrix() *
+      m_model_matrix;
+
+  const QPoint start = m_region_points.front();
+  const QPoint end = m_region_points.back();
+
+  // A click picks the closest particle under the cursor
+  bool click = true;
+  for (const QPoint &point : m_region_points)
+  {
+    if ((point - start).manhattanLength() >= m_region_click_distance) click = false;
+  }
+
+  if (click)
+  {
+    const int particle = ParticlePicker::pick(m_cluster_grid, m_particle_data, modelViewProjection, toNormalizedDevice(end));
+    m_selected_particles.clear();
+    if (particle < 0)
+    {
+      qDebug("No particle picked.");
+      return;
+    }
+
+    m_selected_particles.push_back(particle);
+    const GLfloat *picked = &m_particle_data[particle * 4];
+    qDebug("Picked particle %d at (%f, %f, %f), radius %f.", particle, picked[0], picked[1], picked[2], picked[3]);
+    return;
+  }
+
+  if (m_region_mode == GLWindow::REGION_BOX)
+  {
+    ParticlePicker::selectBox(
+        m_cluster_grid,
+        m_particle_data,
+        modelViewProjection,
+        toNormalizedDevice(start),
+        toNormalizedDevice(end),
+        m_selected_particles);
+  }
+  else
+  {
+    std::vector<QVector2D> lasso;
+    lasso.reserve(m_region_points.size());
+    for (const QPoint &point : m_region_points) lasso.push_back(toNormalizedDevice(point));
+
+    ParticlePicker::selectLasso(m_cluster_grid, m_particle_data, modelViewProjection, lasso, m_selected_particles);
+  }
+
+  qDebug("%d particles selected.", int(m_selected_particles.size()));
+}
+
 void GLWindow::wheelEvent(QWheelEvent *event)
 {
   makeCurrent();
   setFocus();
   m_input_manager->wheelEvent(event);
+  requestRender();
 }
 
 void GLWindow::setLightIconScale(int _value)
@@ -916,43 +1728,21 @@ void GLWindow::setLightIconScale(int _value)
   float t = (float)_value / 100.0f;
   float iconScale = 0.02f * (1.0f - t) + 0.08f * t;
   m_input_manager->setLightIconScales(iconScale);
+  requestRender();
 }
 
 void GLWindow::setBackgroundBlurIterations(int _value)
 {
   qDebug("aiaiai  %d", _value);
   m_skybox->setBlurIterations(_value);
-
+  requestRender();
 }
 
 void GLWindow::setBackgroundSkymap(int _index)
 {
-  switch (_index)
-  {
-  case 0:
-    m_skybox->setBackground("badomen");
-  case 1:
-    m_skybox->setBackground("criminal-impact");
-    break;
-  case 2:
-    m_skybox->setBackground("cwd");
-    break;
-  case 3:
-    m_skybox->setBackground("drakeq");
-    break;
-  case 4:
-    m_skybox->setBackground("forest");
-    break;
-  case 5:
-    m_skybox->setBackground("mandaris");
-    break;
-  case 6:
-    m_skybox->setBackground("misty");
-    break;
-  case 7:
-    m_skybox->setBackground("mnight");
-    break;
-  }
+  const QStringList names = SkyBox::backgrounds();
+  if (_index >= 0 && _index < names.size()) m_skybox->setBackground(names[_index]);
+  requestRender();
 }
 
 // Slots
@@ -960,6 +1750,7 @@ void GLWindow::setParticleSize(double _size)
 {
   m_ps.setParticleSize(_size);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setParticleType(int _type)
@@ -1033,15 +1824,14 @@ void GLWindow::setParticleType(int _type)
   }
   m_ps.reset(particleType);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::showConnections(bool _state)
 {
   m_draw_links=_state;
-  m_lighting_program->bind();
-  m_lighting_program->setUniformValue("drawLinks", _state);
-  m_lighting_program->release();
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setShading(QString _type)
@@ -1049,29 +1839,26 @@ void GLWindow::setShading(QString _type)
   if (_type=="ADS")
   {
     emit setConnectionState(true);
-    m_activeRenderPassIndex = m_ADSIndex;
     m_rendering_mode = GLWindow::ADS;
 
   }
   else if(_type=="Ambient Occlusion")
   {
     emit setConnectionState(false);
-    m_activeRenderPassIndex = m_AOIndex;
     m_rendering_mode = GLWindow::AO;
 
   }
   else if(_type=="X Ray")
   {
-    m_activeRenderPassIndex = m_XRayIndex;
     m_rendering_mode = GLWindow::XRAY;
   }
 
   else if(_type=="New Order")
   {
-    m_activeRenderPassIndex = m_NewOrderIndex;
     m_rendering_mode = GLWindow::newOrder;
   }
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::toggleForces(bool _state)
@@ -1079,6 +1866,7 @@ void GLWindow::toggleForces(bool _state)
   // Only for LinkedParticles
   m_ps.toggleForces(_state);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::toggleParticleDeath(bool _state)
@@ -1095,6 +1883,7 @@ void GLWindow::toggleParticleDeath(bool _state)
   {
     emit enableBulge(true);
   }
+  requestRender();
 }
 
 void GLWindow::setSplitType(int _type)
@@ -1132,6 +1921,7 @@ void GLWindow::setSplitType(int _type)
     emit enableLightOff(true);
   }
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setCohesion(int _amount)
@@ -1139,6 +1929,7 @@ void GLWindow::setCohesion(int _amount)
   //Only for LinkedParticles
   m_ps.setCohesion(_amount);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setSSAORadius(double _radius)
@@ -1147,17 +1938,31 @@ void GLWindow::setSSAORadius(double _radius)
     qDebug("SSAO rad: %f", m_ssaoRadius);
 
     m_ssao_program->bind();
-      m_ssao_program->setUniformValue("Radius", m_ssaoRadius);
+      m_ssao_program->setUniformValue(m_uniforms.ssaoRadius, m_ssaoRadius);
     m_ssao_program->release();
-
+    requestRender();
 }
 
 void GLWindow::setSSAOBias(double _bias)
 {
     m_ssaoBias = (float) _bias;
     m_ssao_program->bind();
-      m_ssao_program->setUniformValue("Bias", m_ssaoBias);
+      m_ssao_program->setUniformValue(m_uniforms.ssaoBias, m_ssaoBias);
     m_ssao_program->release();
+    requestRender();
+}
+
+void GLWindow::setSSAOQuality(int _quality)
+{
+  m_ssao_quality = static_cast<SSAOQuality>(qBound(0, _quality, 2));
+  qDebug("SSAO quality %d.", m_ssao_quality);
+
+  // The occlusion textures change size, rebuild them with our context
+  makeCurrent();
+  cleanup();
+  prepareSSAOPipeline();
+  doneCurrent();
+  requestRender();
 }
 
 
@@ -1168,69 +1973,82 @@ void GLWindow::setSSAOBias(double _bias)
 void GLWindow::setRcolour(int _rColour)
 {
   m_lightDiffuseR = (float)_rColour/255.0f;
+  requestRender();
 }
 
 void GLWindow::setGcolour(int _gColour)
 {
   m_lightDiffuseG = (float)_gColour/255.0f;
+  requestRender();
 }
 
 
 void GLWindow::setBcolour(int _bColour)
 {
   m_lightDiffuseB = (float)_bColour/255.0f;
+  requestRender();
 }
 
 void GLWindow:: setAmbientLightR(int _red)
 {
     m_lightAmbientR = (float) _red/255;
+    requestRender();
 }
 
 void GLWindow:: setAmbientLightG(int _green)
 {
     m_lightAmbientG = (float) _green/255;
+    requestRender();
 }
 
 
 void GLWindow:: setAmbientLightB(int _blue)
 {
     m_lightAmbientB = (float) _blue/255;
+    requestRender();
 }
 
 void GLWindow::setSpecularLightR(int _red)
 {
     m_lightSpecularR = (float) _red/255;
+    requestRender();
 }
 
 void GLWindow::setSpecularLightG(int _green)
 {
     m_lightSpecularG = (float) _green/255;
+    requestRender();
 }
 
 void GLWindow::setSpecularLightB(int _blue)
 {
     m_lightSpecularB = (float) _blue/255;
+    requestRender();
 }
 
 void GLWindow::setFillLight(int _amount)
 {
    m_fillLight = (float) _amount/100;
+   requestRender();
 }
 
 void GLWindow::setRcolourMaterial(int _rColour)
 {
     m_materialR = (float)_rColour/255.0f;
+    requestRender();
 }
 
 void GLWindow::setGcolourMaterial(int _gColour)
 {
     m_materialG = (float)_gColour/255.0f;
+    requestRender();
 }
 
 
 void GLWindow::setBcolourMaterial(int _bColour)
 {
     m_materialB = (float)_bColour/255.0f;
+    requestRender();
 }
 
 /*---------------------------------------------
@@ -1242,6 +2060,7 @@ void GLWindow::bulge()
   //Only for LinkedParticles
   m_ps.bulge();
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::lightOn()
@@ -1257,6 +2076,7 @@ void GLWindow::lightOn()
 
   m_lightON = true;
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::lightOff()
@@ -1271,12 +2091,14 @@ void GLWindow::lightOff()
   m_lightSpecularB = 0.0;
   m_lightON = false;
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setLocalCohesion(int _amount)
 {
   m_ps.setLocalCohesion(_amount);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setAutomataRadius(int _amount)
@@ -1284,6 +2106,7 @@ void GLWindow::setAutomataRadius(int _amount)
   //Only for AutomataParticles
   m_ps.setAutomataRadius(_amount);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setAutomataTime(int _amount)
@@ -1291,6 +2114,7 @@ void GLWindow::setAutomataTime(int _amount)
   //Only for AutomataParticles
   m_ps.setAutomataTime(_amount);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::setBranchLength(double _amount)
@@ -1298,6 +2122,7 @@ void GLWindow::setBranchLength(double _amount)
   // Only for GrowthParticles
   m_ps.setBranchLength(_amount);
   sendParticleDataToOpenGL();
+  requestRender();
 }
 
 void GLWindow::restart()
@@ -1318,6 +2143,7 @@ void GLWindow::restart()
   emit resetGrowToLight(true);
 
   m_ps.reset('L');
+  m_selected_particles.clear();
   // Add reset functions here
   emit resetRColour(255);
   emit resetGColour(255);
@@ -1335,23 +2161,27 @@ void GLWindow::restart()
   emit resetAORadius(5.0);
   emit resetAOBias(0.025);
 
-  m_activeRenderPassIndex = m_ADSIndex;
+  m_rendering_mode = GLWindow::ADS;
   emit setConnectionState(false);
+  requestRender();
   }
 
 void GLWindow::setChildThreshold(int _amount)
 {
   m_ps.setChildThreshold(_amount);
+  requestRender();
 }
 
 void GLWindow::setNearestParticle(bool _state)
 {
     m_ps.setNearestParticleState(_state);
+    requestRender();
 }
 
 void GLWindow::setGrowToLight(bool _state)
 {
   m_ps.setGrowToLight(_state);
+  requestRender();
 }
 
 void GLWindow::cancel()
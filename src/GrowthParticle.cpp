@@ -6,6 +6,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 // Standard
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <random>
@@ -15,6 +16,11 @@
 
 GrowthParticle::GrowthParticle() : Particle()
 {
+  m_childrenTreshold = 3;
+  m_branchLength = 1.0;
+  m_saturated = false;
+  m_saturatedSize = 0.0f;
+  m_saturatedBranchLength = 0.0f;
   qDebug("Growth Particle default constructor.");
 }
 
@@ -27,6 +33,9 @@ GrowthParticle::GrowthParticle(
 {
   m_childrenTreshold = 3;
   m_branchLength = 1.0;
+  m_saturated = false;
+  m_saturatedSize = 0.0f;
+  m_saturatedBranchLength = 0.0f;
   qDebug("Growth Particle constructor passing in position: %f,%f,%f.", _x, _y, _z);
 }
 
@@ -41,6 +50,9 @@ GrowthParticle::GrowthParticle(
 {
   m_childrenTreshold = 3;
   m_branchLength = _branchLength;
+  m_saturated = false;
+  m_saturatedSize = 0.0f;
+  m_saturatedBranchLength = 0.0f;
   qDebug("Growth Particle constructor passing in positions: %f,%f,%f and a list"
          " of particles.", _x, _y, _z);
 }
@@ -53,87 +65,132 @@ bool GrowthParticle::split(
 {
   // Checks length of children particle list to see if the max particle threshold
   // is reached or not.
-  if (m_connectedParticles.size() >= m_childrenTreshold) return false;
-
-  // Creating a list of particles for new particles, those will represent the
-  // branches between the particles
-  std::vector<uint> newConnectedParticles;
-  // Appends mother ID, which is always the first element in the
-  // connectedParticle vector
-  newConnectedParticles.push_back(m_ID);
-
-  float input0A;
-  float input0B;
-  float input1A;
-  float input1B;
-  float input2A;
-  float input2B;
-
-  // If it isn't meant to grow towards the light it will chose a random value
-  // between the parents position and twice that value.
-  if (_growToLight==false)
-  {
-    input0A = m_pos[0] + 0.001;
-    input0B = m_pos[0] + m_pos[0];
-    input1A = m_pos[1] + 0.001;
-    input1B = m_pos[1] + m_pos[1];
-    input2A = m_pos[2] + 0.001;
-    input2B = m_pos[2] + m_pos[2];
-  }
-  // If the particle is meant to grow towards the light it will find a value
-  // between the mothers position and the light.
-  else
+  if (m_connectedParticles.size() >= getChildThreshold()) return false;
+
+  const float size = getSize();
+  const float branchLength = getBranchLength();
+
+  // Nothing around this tip moves, so once every direction was blocked there
+  // is no point in testing them again until the size or branch length change.
+  if (m_saturated
+      && m_saturatedSize == size
+      && m_saturatedBranchLength == branchLength) return false;
+
+  // The generator is handed in by value, so mix in the tip and its number of
+  // branches to get a different pattern for every split.
+  std::seed_seq seed{
+    static_cast<uint>(_gen()),
+    m_ID,
+    static_cast<uint>(m_connectedParticles.size())};
+  _gen.seed(seed);
+
+  // If it isn't meant to grow towards the light it grows away from the
+  // origin, otherwise it aims the light.
+  QVector3D preferred = _growToLight ? _lightPos - m_pos : m_pos;
+  preferred.normalize();
+
+  // Random rotation of the shared direction set so tips don't all branch
+  // along the same lattice.
+  std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+  const float axisZ = 2.0f * distribution(_gen) - 1.0f;
+  const float axisPhi = 2.0f * float(M_PI) * distribution(_gen);
+  const float axisR = std::sqrt(std::max(0.0f, 1.0f - axisZ * axisZ));
+  const QVector3D axis(axisR * std::cos(axisPhi), axisR * std::sin(axisPhi), axisZ);
+  const float angle = 2.0f * float(M_PI) * distribution(_gen);
+  const float cosAngle = std::cos(angle);
+  const float sinAngle = std::sin(angle);
+
+  // Rotate the directions (Rodrigues) and keep the ones facing the preferred
+  // direction. A bit of jitter on the score keeps some variety instead of
+  // always picking the same best direction.
+  const std::vector<QVector3D> &directions = fibonacciDirections();
+  ScratchVector<std::pair<float, QVector3D>> candidates;
+  candidates.reserve(directions.size());
+  for (const QVector3D &d : directions)
   {
-    input0A = m_pos[0] + 0.001;
-    input0B = _lightPos[0];
-    input1A = m_pos[1] + 0.001;
-    input1B = _lightPos[1];
-    input2A = m_pos[2] + 0.001;
-    input2B = _lightPos[2];
+    QVector3D rotated =
+        d * cosAngle +
+        QVector3D::crossProduct(axis, d) * sinAngle +
+        axis * QVector3D::dotProduct(axis, d) * (1.0f - cosAngle);
+
+    const float score = QVector3D::dotProduct(rotated, preferred);
+    if (score < 0.0f) continue;
+    candidates.push_back(std::make_pair(score + 0.5f * distribution(_gen), rotated));
   }
+  std::sort(candidates.begin(), candidates.end(),
+    [](const std::pair<float, QVector3D> &_a, const std::pair<float, QVector3D> &_b)
+    {
+      return _a.first > _b.first;
+    });
 
-  // Finding a random position in the predefined boundaries.
-  std::uniform_real_distribution<float> distributionX(input0A, input0B);
-  std::uniform_real_distribution<float> distributionY(input1A, input1B);
-  std::uniform_real_distribution<float> distributionZ(input2A, input2B);
-
-  QVector3D pos;
-
-  uint counter = 0;
-  float branchMultiplier = 1.05;
+  // Only the particles around the fourth ancestor can be hit.
+  Neighbourhood neighbourhood;
+  gatherNeighbourhood(4, _particleList, neighbourhood);
 
-  do {
-    pos[0] = distributionX(_gen);
-    pos[1] = distributionY(_gen);
-    pos[2] = distributionZ(_gen);
+  const uint batchSize = 8;
+  const uint rings = 4;
 
-    QVector3D direction;
-    direction[0]=pos[0]-m_pos[0];
-    direction[1]=pos[1]-m_pos[1];
-    direction[2]=pos[2]-m_pos[2];
+  float x[batchSize];
+  float y[batchSize];
+  float z[batchSize];
+  bool colliding[batchSize];
 
-    // Place new particle in direction of vector mutilplied by size of particle.
-    direction.normalize();
+  QVector3D pos;
+  bool found = false;
 
-    pos[0] = m_pos[0] + direction[0] * (m_size + m_branchLength + branchMultiplier);
-    pos[1] = m_pos[1] + direction[1] * (m_size + m_branchLength + branchMultiplier);
-    pos[2] = m_pos[2] + direction[2] * (m_size + m_branchLength + branchMultiplier);
+  // Increases the length of a branch if every direction is still colliding.
+  for (uint ring = 0; ring < rings && !found; ring++)
+  {
+    const float distance = size + branchLength + 1.05f + 0.5f * ring;
 
-    // Increases the length of a branch the particle is still colliding after 50 tries.
-    if(counter % 50 == 0)
+    for (size_t first = 0; first < candidates.size() && !found; first += batchSize)
     {
-      branchMultiplier += 0.5;
+      const size_t count = std::min<size_t>(batchSize, candidates.size() - first);
+
+      // Unused lanes are parked on the tip itself so they always collide.
+      for (uint b = 0; b < batchSize; b++)
+      {
+        const QVector3D p = b < count ?
+              m_pos + candidates[first + b].second * distance : m_pos;
+        x[b] = p[0];
+        y[b] = p[1];
+        z[b] = p[2];
+      }
+
+      testCollisionBatch(x, y, z, neighbourhood, colliding);
+
+      for (uint b = 0; b < count; b++)
+      {
+        if (colliding[b]) continue;
+        pos = QVector3D(x[b], y[b], z[b]);
+        found = true;
+        break;
+      }
     }
-    counter++;
   }
-  while(collision(4, pos, _particleList));
 
-  // Create new particle and add to particle list
-  _particleList.push_back(
-    std::unique_ptr<GrowthParticle> (
-      new GrowthParticle(pos[0], pos[1], pos[2], newConnectedParticles, m_size, m_branchLength)
-    )
-  );
+  if (!found)
+  {
+    m_saturated = true;
+    m_saturatedSize = size;
+    m_saturatedBranchLength = branchLength;
+    return false;
+  }
+
+  // Creating a list of particles for new particles, those will represent the
+  // branches between the particles. Mother ID is always the first element in
+  // the connectedParticle vector.
+  std::vector<uint> newConnectedParticles;
+  newConnectedParticles.push_back(m_ID);
+
+  // Create new particle, sharing the parameters and overrides of its mother,
+  // and add it to particle list
+  GrowthParticle *child =
+      new GrowthParticle(pos[0], pos[1], pos[2], newConnectedParticles, m_size, m_branchLength);
+  child->m_childrenTreshold = m_childrenTreshold;
+  shareParameters(*child);
+
+  _particleList.push_back(std::unique_ptr<GrowthParticle>(child));
 
   // Add particle to links in mother particle
   uint new_ID = _particleList[_particleList.size() - 1]->getID();
@@ -141,12 +198,38 @@ bool GrowthParticle::split(
   return true;
 }
 
-bool GrowthParticle::collision(int _levels,QVector3D _testPosition,std::vector<std::unique_ptr<Particle> > &_particleList)
+const std::vector<QVector3D> &GrowthParticle::fibonacciDirections()
+{
+  // Built once by the initialiser, which C++11 makes thread safe
+  static const std::vector<QVector3D> directions = []()
+  {
+    const uint count = 64;
+    const float goldenAngle = float(M_PI) * (3.0f - std::sqrt(5.0f));
+
+    std::vector<QVector3D> table;
+    table.reserve(count);
+    for (uint i = 0; i < count; i++)
+    {
+      const float z = 1.0f - (2.0f * i + 1.0f) / count;
+      const float r = std::sqrt(1.0f - z * z);
+      const float phi = goldenAngle * i;
+      table.push_back(QVector3D(r * std::cos(phi), r * std::sin(phi), z));
+    }
+    return table;
+  }();
+
+  return directions;
+}
+
+void GrowthParticle::gatherNeighbourhood(
+    int _levels,
+    std::vector<std::unique_ptr<Particle>> &_particleList,
+    Neighbourhood &_neighbourhood)
 {
   // Original parent is current particle
   uint parent = m_ID;
 
-  std::vector<uint> links;
+  ScratchVector<uint> links;
 
   // Finding parent of particles until level of generation is reached.
   for (int j = 0; j <= _levels; j++)
@@ -163,52 +246,93 @@ bool GrowthParticle::collision(int _levels,QVector3D _testPosition,std::vector<s
     parent = links[0];
   }
 
-  bool collision = _particleList[parent]->recursiveCollision(_testPosition, _particleList);
-  return collision;
+  // Walk down the subtree of that parent.
+  ScratchVector<uint> stack;
+  stack.push_back(parent);
 
-}
+  QVector3D position;
 
-bool GrowthParticle::testCollision(QVector3D _particlePos)
-{
-  float distance = _particlePos.distanceToPoint(m_pos);
-  return distance <= m_size * 2.0;
-}
+  // Same threshold as the per particle distance <= size * 2 test, all
+  // particles of a tree share their size.
+  const float minDistance = getSize() * 2.0f;
 
-bool GrowthParticle::recursiveCollision(
-    QVector3D _particle,
-    std::vector<std::unique_ptr<Particle>> &_particleList)
-{
-  // Tests for collision of the current particle
-  if (testCollision(_particle))
+  while (!stack.empty())
   {
-     return true;
+    const uint current = stack.back();
+    stack.pop_back();
+
+    _particleList[current]->getPos(position);
+    _neighbourhood.x.push_back(position[0]);
+    _neighbourhood.y.push_back(position[1]);
+    _neighbourhood.z.push_back(position[2]);
+    _neighbourhood.minDistanceSquared.push_back(minDistance * minDistance);
+
+    // Starting from 1 as first connection is the mother particle, unless it is
+    // the first particle ever created.
+    _particleList[current]->getConnectionsID(links);
+    for (size_t i = current == 0 ? 0 : 1; i < links.size(); i++)
+    {
+      stack.push_back(links[i]);
+    }
   }
+}
+
+void GrowthParticle::testCollisionBatch(
+    const float *_x,
+    const float *_y,
+    const float *_z,
+    const Neighbourhood &_neighbourhood,
+    bool *_colliding)
+{
+  const uint batchSize = 8;
 
-  // If particle first particle ever created (doesn't have a parent)
-  int start_i = 0;
+  int hits[batchSize] = {0, 0, 0, 0, 0, 0, 0, 0};
 
-  // Starting from 1 as first particle is mother particle
-  if (m_ID != 0)
+  const size_t count = _neighbourhood.x.size();
+  const float *nx = _neighbourhood.x.data();
+  const float *ny = _neighbourhood.y.data();
+  const float *nz = _neighbourhood.z.data();
+  const float *nd = _neighbourhood.minDistanceSquared.data();
+
+  // Fixed width inner loop without branches so the compiler can keep the whole
+  // batch in vector registers.
+  for (size_t i = 0; i < count; i++)
   {
-    // If it doesn't have any children
-    if(m_connectedParticles.size() <= 1) return false;
-    start_i = 1;
+    for (uint b = 0; b < batchSize; b++)
+    {
+      const float dx = _x[b] - nx[i];
+      const float dy = _y[b] - ny[i];
+      const float dz = _z[b] - nz[i];
+      hits[b] |= (dx * dx + dy * dy + dz * dz) <= nd[i];
+    }
   }
 
-  for(size_t i = start_i; i < m_connectedParticles.size(); i++)
+  for (uint b = 0; b < batchSize; b++)
   {
-    // If colliding return true
-    if(_particleList[m_connectedParticles[i]]->recursiveCollision(_particle,_particleList)) return true;
+    _colliding[b] = hits[b] != 0;
   }
-  return false;
 }
 
 void GrowthParticle::setChildThreshold(uint _amount)
 {
   m_childrenTreshold=_amount;
+  m_overrides |= CHILD_THRESHOLD_OVERRIDE;
 }
 
 void GrowthParticle::setBranchLength(float _value)
 {
   m_branchLength=_value;
+  m_overrides |= BRANCH_LENGTH_OVERRIDE;
+}
+
+uint GrowthParticle::getChildThreshold() const
+{
+  if (m_parameters == nullptr || (m_overrides & CHILD_THRESHOLD_OVERRIDE)) return m_childrenTreshold;
+  return m_parameters->childThreshold;
+}
+
+float GrowthParticle::getBranchLength() const
+{
+  if (m_parameters == nullptr || (m_overrides & BRANCH_LENGTH_OVERRIDE)) return m_branchLength;
+  return m_parameters->branchLength;
 }
@@ -9,9 +9,14 @@
 InputManager::InputManager (QOpenGLWidget *_window) :
   m_camera(QVector3D(0.0f, 0.0f, -20.0f)),
   m_keys{0},
-  m_mousePressed(false)
+  m_mousePressed(false),
+  m_pick_requested(false),
+  m_pick_x(0),
+  m_pick_y(0),
+  m_pick_select(false),
+  m_picking_select(false)
 {
-  m_fbo = new QOpenGLFramebufferObject(_window->width(), _window->height());
+  m_picker.resize(_window->width(), _window->height());
   // Camera initialisation
   // Must be run on start for camera to calculate its position and orientation
   m_camera.processMouseMovement(0, 0);
@@ -44,47 +49,72 @@ void InputManager::doMovement(QVector3D _rp)
   m_camera.setRotationPoint(_rp);
 }
 
-void InputManager::getUniqueColour(const int _x, const int _y)
+bool InputManager::isMoving() const
 {
-  m_fbo->bind();
-  // Clear colour buffer for temporary drawing
-  // This must be run before actual drawing to frame buffer
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-  // Draw all objects in a unique colour
-  for(auto &s : m_objectList) { s->drawBackBuffer(); }
-
-  QImage img = m_fbo->toImage();
-//  img.save("/home/i7243466/Desktop/koko.jpg");
+  return m_keys[Qt::Key_W] || m_keys[Qt::Key_S] || m_keys[Qt::Key_A] || m_keys[Qt::Key_D];
+}
 
-  QColor col = img.pixelColor(_x, _y);
-  setCurrentDepth(img.depth());
-  //qDebug("%d %d %d", col.red(), col.green(), col.blue());
+bool InputManager::isPicking() const
+{
+  return m_pick_requested || m_picker.isBusy();
+}
 
-  QVector3D pixelColour = QVector3D(col.red(), col.green(), col.blue());
-  setCurrentUniqueColour(pixelColour);
-  m_fbo->release();
+void InputManager::requestPick(const int _x, const int _y, bool _select)
+{
+  // A click is not lost to the moves after it
+  m_pick_select = (m_pick_requested && m_pick_select) || _select;
+  m_pick_requested = true;
+  m_pick_x = _x;
+  m_pick_y = _y;
 }
 
-void InputManager::doSelection(const int _x, const int _y)
+bool InputManager::updatePicking(QOpenGLFunctions_4_1_Core *_funcs)
 {
-  // Compare colours
-  for(auto &s : m_objectList)
+  QVector3D pixelColour;
+  bool changed = false;
+  if (m_picker.resolve(_funcs, pixelColour))
   {
-    QOpenGLShaderProgram* m_manipulatorProgram;
-    s->getMainProgram(&m_manipulatorProgram);
-    getUniqueColour(_x, _y);
-    s->setClicked(m_currentUniqueColour, true);
+    // Compare colours
+    if (m_picking_select)
+    {
+      setCurrentUniqueColour(pixelColour);
+
+      // Released already, it would stay clicked
+      if (m_mousePressed)
+      {
+        for(auto &s : m_objectList) { s->setClicked(m_currentUniqueColour, true); }
+        changed = true;
+      }
+    }
+    else if (!m_mousePressed && pixelColour != m_currentUniqueColour)
+    {
+      // Still over the same object, or none, the hover stays as it is
+      setCurrentUniqueColour(pixelColour);
+      onHover();
+      changed = true;
+    }
   }
+
+  // One pick in flight, later requests wait and merge
+  if (!m_pick_requested || m_picker.isBusy()) return changed;
+
+  // Draw all objects in a unique colour
+  const bool started = m_picker.pick(_funcs, m_pick_x, m_pick_y, [this]()
+  {
+    for(auto &s : m_objectList) { s->drawBackBuffer(); }
+  });
+
+  if (started) m_picking_select = m_pick_select;
+  m_pick_requested = false;
+  m_pick_select = false;
+  return changed;
 }
 
-void InputManager::addShaderProgram(QOpenGLShaderProgram* _program)
+void InputManager::cleanupPicking(QOpenGLFunctions_4_1_Core *_funcs)
 {
-  m_programs.push_back(_program);
+  m_picker.destroy(_funcs);
 }
 
-
-
 void InputManager::setupCamera(float _fov, int _w, int _h, float _near, float _far)
 {
   //////////////////////////////////////////////////////////////////////////////
@@ -95,22 +125,6 @@ void InputManager::setupCamera(float _fov, int _w, int _h, float _near, float _f
                          _near, _far);
 }
 
-void InputManager::loadLightMatricesToShader()
-{
-  for(size_t i = 0; i < m_programs.size(); i++)
-  {
-    QOpenGLShaderProgram *prgrm = m_programs[i];
-    prgrm->bind();
-
-    prgrm->setUniformValue("view", m_view);
-    // Projection matrix only has to be set once, but it makes more
-    // sense to have all the setup here.
-    prgrm->setUniformValue("projection", m_projection);
-    prgrm->release();
-  }
-
-}
-
 void InputManager::setObjectList(
     std::vector<std::shared_ptr<SelectableObject> > _objectList)
 {
@@ -164,7 +178,7 @@ void InputManager::mousePressEvent(QMouseEvent *_event)
 
   if(m_alt_key==false)
   {
-    doSelection(_event->pos().x(), _event->pos().y());
+    requestPick(_event->pos().x(), _event->pos().y(), true);
   }
 }
 
@@ -175,7 +189,7 @@ void InputManager::mouseMoveEvent(QMouseEvent *_event)
   GLfloat ypos = _event->pos().y();
   GLfloat xoffset = xpos - m_lastX;
   GLfloat yoffset = m_lastY - ypos;
-  getUniqueColour(xpos, ypos);
+  requestPick(xpos, ypos, false);
 
   // Only process movement if the mouse button and alt is pressed
   if (m_mousePressed && m_alt_key==true)
@@ -202,16 +216,7 @@ void InputManager::mouseMoveEvent(QMouseEvent *_event)
     }
   }
 
-  // HOVER
-  for(auto &s : m_objectList)
-  {
-    if(!m_mousePressed)
-    {
-      QOpenGLShaderProgram* m_manipulatorProgram;
-      s->getMainProgram(&m_manipulatorProgram);
-      onHover();
-    }
-  }
+  // HOVER happens when the pick comes back, see updatePicking()
 
   m_lastX = xpos;
   m_lastY = ypos;
@@ -268,8 +273,7 @@ void InputManager::wheelEvent(QWheelEvent *_event)
 
 void InputManager::resized(int _w, int _h)
 {
-  delete m_fbo;
-  m_fbo = new QOpenGLFramebufferObject(_w, _h);
+  m_picker.resize(_w, _h);
 }
 
 void InputManager::setLightIconScales(float _lightScale)
@@ -7,12 +7,13 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 // Standard
+#include <algorithm>
 #include <random>
 
 // Project
 #include "LinkedParticle.h"
 
-LinkedParticle::LinkedParticle():Particle()
+LinkedParticle::LinkedParticle():Particle(), m_particleLife(0), m_foodLife(0)
 {
   qDebug("Linked Particle default constructor.");
 }
@@ -23,6 +24,8 @@ LinkedParticle::LinkedParticle(
     qreal _z,
     float _size)
   : Particle(_x, _y, _z, _size)
+  , m_particleLife(0)
+  , m_foodLife(0)
 {
    qDebug("Linked Particle constructor passing in positions: %f,%f,%f", _x, _y, _z);
 }
@@ -34,6 +37,8 @@ LinkedParticle::LinkedParticle(
     std::vector<uint> _linkedParticles,
     float _size)
   : Particle(_x, _y, _z, _linkedParticles, _size)
+  , m_particleLife(0)
+  , m_foodLife(0)
 {
   qDebug("Linked Particle constructor passing in positions: %f,%f,%f and a"
          "list of particles", _x, _y, _z);
@@ -47,7 +52,7 @@ void LinkedParticle::calculate(
     bool _particleDeath)
 {
   unsigned int connectionCount = getConnectionCount();
-  std::vector<QVector3D> linkPosition;
+  ScratchVector<QVector3D> linkPosition;
   QVector3D origin;
 
   // EQUIDISTANCE
@@ -73,8 +78,8 @@ void LinkedParticle::calculate(
   // Sends particles towards particle centre based on distance from centre.
   QVector3D cohesion = origin - m_pos;
   float cohesionLength = cohesion.length();
-  float cohesionDist = m_size + (cohesionLength / 2.0);
-  if (cohesionLength >= m_size * 2.0)
+  float cohesionDist = getSize() + (cohesionLength / 2.0);
+  if (cohesionLength >= getSize() * 2.0)
   {
     m_vel /= 1.1;
   }
@@ -98,9 +103,9 @@ void LinkedParticle::calculate(
   QVector3D localCohesion = connectionCentre - m_pos;
 
   float localCohesionLength = localCohesion.length();
-  float localCohesionDist = m_size+(localCohesionLength/2);
+  float localCohesionDist = getSize()+(localCohesionLength/2);
 
-  if (localCohesionLength>=m_size*2)
+  if (localCohesionLength>=getSize()*2)
   {
     m_vel/=1.1;
   }
@@ -123,7 +128,7 @@ void LinkedParticle::calculate(
     {
       QVector3D distanceFromLinkedParticles = linkPosition[i] - m_pos;
       if (m_particleLife >= 200
-          && distanceFromLinkedParticles.length() <= (m_size*2))
+          && distanceFromLinkedParticles.length() <= (getSize()*2))
       {
         m_vel.setX(0.0);
         m_vel.setY(0.0);
@@ -139,45 +144,26 @@ void LinkedParticle::calculateUnlinked(std::vector<std::unique_ptr<Particle>> &_
   // Move the particles which aren't linked away from each other.
   QVector3D repulse;
   QVector3D unlinkedPos;
-  std::vector<uint> allParticles;       // IDs of all particles
-  std::vector<uint> notConnected;       // IDs of all the unlinked particles
-  std::vector<uint> connectedParticles; // IDs of all the linked particles
 
-  for (uint i = 0; i < m_ID_counter; i++)
+  for (size_t j = 0; j < _particleList.size(); j++)
   {
-    allParticles.push_back(i);
-    getConnectionsID(connectedParticles);
-  }
-
-  getConnectionsID(connectedParticles);
-
-  std::sort(allParticles.begin(), allParticles.end());
-  std::sort(connectedParticles.begin(), connectedParticles.end());
-
-  // Creates a vector of unlinked particles by finding all of the IDs in the
-  // allParticles list which aren't in the connectedParticles list.
-  std::set_difference(
-    allParticles.begin(),
-    allParticles.end(),
-    connectedParticles.begin(),
-    connectedParticles.end(),
-    std::back_inserter(notConnected)
-  );
-
-  for (uint j = 0; j < notConnected.size(); j++)
-  {
-    if (m_ID != notConnected[j])
+    uint ID = _particleList[j]->getID();
+    if (m_ID == ID) continue;
+
+    // Links are only a handful, checking them directly is cheaper than
+    // building the list of unlinked particles.
+    if (std::find(m_connectedParticles.begin(), m_connectedParticles.end(), ID)
+        != m_connectedParticles.end()) continue;
+
+    unlinkedPos = _particleList[j]->getPosition();
+    repulse = m_pos - unlinkedPos;
+    float length = repulse.length();
+    if (length <= getSize() * 2.0)
     {
-      unlinkedPos = _particleList[j]->getPosition();
-      repulse = m_pos - unlinkedPos;
-      float length = repulse.length();
-      if (length <= m_size * 2.0)
-      {
-        float distance = m_size - (length / 2.0);
-        repulse.normalize();
-        repulse *= distance;
-        m_vel += repulse;
-      }
+      float distance = getSize() - (length / 2.0);
+      repulse.normalize();
+      repulse *= distance;
+      m_vel += repulse;
     }
   }
 }
@@ -187,9 +173,9 @@ void LinkedParticle::bulge(QVector3D _particleCentre)
   // BULGE
   // Finds the particles closest to the centre and move them outwards on a key press.
   QVector3D distance = m_pos - _particleCentre;
-  if (distance.x() <= m_size * 2.0
-      || distance.y() <= m_size * 2.0
-      || distance.z() <= m_size * 2.0)
+  if (distance.x() <= getSize() * 2.0
+      || distance.y() <= getSize() * 2.0
+      || distance.z() <= getSize() * 2.0)
   {
     m_vel += distance;
   }
@@ -204,7 +190,7 @@ void LinkedParticle::addFood(QVector3D _particleCentre)
     m_foodLife++;
     QVector3D food = _particleCentre - m_pos;
 
-    if(food.length() <= m_size*2)
+    if(food.length() <= getSize()*2)
     {
         m_vel /= 1.1;
     }
@@ -244,13 +230,15 @@ bool LinkedParticle::split(
   std::uniform_int_distribution<int> distribution(1, m_connectedParticles.size());
 
   // Holds all ID's of the particles that are kept by the current particle.
-  std::vector<uint> keepList;
+  ScratchVector<uint> keepList;
+  keepList.reserve(m_connectedParticles.size());
 
   // Holds all the ID's of the particles that are linked to the new particle.
-  std::vector<uint> relinkList;
+  ScratchVector<uint> relinkList;
+  relinkList.reserve(m_connectedParticles.size() + 3);
 
   // Holds the positions of the linked particles.
-  std::vector<QVector3D> linkPosition;
+  ScratchVector<QVector3D> linkPosition;
 
   getPosFromConnections(linkPosition, _particleList);
 
@@ -289,16 +277,18 @@ bool LinkedParticle::split(
   normal.normalize();
 
   // Create new particle
-  qreal x = m_pos.x() + normal.x() * m_size;
-  qreal y = m_pos.y() + normal.y() * m_size;
-  qreal z = m_pos.z() + normal.z() * m_size;
+  qreal x = m_pos.x() + normal.x() * getSize();
+  qreal y = m_pos.y() + normal.y() * getSize();
+  qreal z = m_pos.z() + normal.z() * getSize();
 
   relinkList.push_back(m_ID);
 
   // Creating new particle
   _particleList.push_back(
-        std::unique_ptr<Particle>(new LinkedParticle(x, y, z, relinkList, m_size))
+        std::unique_ptr<Particle>(new LinkedParticle(
+          x, y, z, std::vector<uint>(relinkList.begin(), relinkList.end()), getSize()))
   );
+  shareParameters(*_particleList[_particleList.size() - 1]);
 
   //get the new particles ID
   int newPartID = _particleList[_particleList.size() - 1]->getID();
@@ -321,7 +311,7 @@ bool LinkedParticle::split(
   }
 
   // Link both, parent and child, to each other
-  m_connectedParticles = keepList;
+  m_connectedParticles.assign(keepList.begin(), keepList.end());
 
   doubleConnect(newPartID,_particleList);
 
@@ -334,7 +324,7 @@ void LinkedParticle:: doubleConnect(
 {
   m_connectedParticles.push_back(_ID);
 
-  std::vector<uint> connections;
+  ScratchVector<uint> connections;
 
   _particleList[_ID]->getConnectionsID(connections);
 
@@ -21,6 +21,10 @@ Particle::Particle()
     , m_foodLevel(false)
     , m_size(2.0)
     , m_foodThreshold(0)
+    , m_asleep(false)
+    , m_restSteps(0)
+    , m_parameters(nullptr)
+    , m_overrides(0)
 {
   qDebug("Particle default constructor.");
 }
@@ -35,6 +39,10 @@ Particle::Particle(
     , m_foodLevel(false)
     , m_size(_size)
     , m_foodThreshold(100)
+    , m_asleep(false)
+    , m_restSteps(0)
+    , m_parameters(nullptr)
+    , m_overrides(0)
 {
   qDebug("Particle constructor passing in positions: %f,%f,%f.", _x, _y, _z);
 }
@@ -50,6 +58,10 @@ Particle::Particle(qreal _x,
     , m_foodLevel(false)
     , m_size(_size)
     , m_foodThreshold(100)
+    , m_asleep(false)
+    , m_restSteps(0)
+    , m_parameters(nullptr)
+    , m_overrides(0)
 {
  qDebug("Particle constructor passing in positions: %f,%f,%f and a list of"
          "particles", _x, _y, _z);
@@ -61,28 +73,32 @@ void Particle::advance()
   m_pos += m_vel;
 }
 
-void Particle::calculate(
-    std::vector<std::unique_ptr<Particle>> &_particleList,
-    QVector3D _averageDistance,
-    int _cohesionFactor,
-    int _localCohesionFactor,
-    bool _particleDeath)
+bool Particle::isAsleep()
 {
-  Q_UNUSED(_particleList);
-  Q_UNUSED(_averageDistance);
-  Q_UNUSED(_cohesionFactor);
-  Q_UNUSED(_localCohesionFactor);
-  Q_UNUSED(_particleDeath);
+  return m_asleep;
 }
 
-void Particle::calculate(
-    std::vector<std::unique_ptr<Particle>> &_particleList,
-    int _automataRadius,
-    int _automataTime)
+void Particle::wake()
 {
-  Q_UNUSED(_particleList);
-  Q_UNUSED(_automataRadius);
-  Q_UNUSED(_automataTime);
+  m_asleep = false;
+  m_restSteps = 0;
+}
+
+bool Particle::updateSleepState()
+{
+  // How slow a particle has to be to count as resting, and for how many steps
+  // in a row before it is put to sleep.
+  const float restSpeed = 1e-6f;
+  const uint stepsToSleep = 10;
+
+  if (m_vel.lengthSquared() > restSpeed * restSpeed)
+  {
+    m_restSteps = 0;
+    return true;
+  }
+
+  if (++m_restSteps >= stepsToSleep) m_asleep = true;
+  return false;
 }
 
 void Particle::bulge(QVector3D _particleCentre)
@@ -105,37 +121,6 @@ void Particle::setBranchLength(float _value)
   Q_UNUSED(_value);
 }
 
-bool Particle::split(
-    QVector3D _lightPos,
-    std::vector<std::unique_ptr<Particle>> &_particleList,
-    std::mt19937_64 _gen,
-    bool _growToLight)
-{
-  Q_UNUSED(_lightPos);
-  Q_UNUSED(_particleList);
-  Q_UNUSED(_gen);
-  Q_UNUSED(_growToLight);
-  return false;
-}
-
-bool Particle::split(
-    std::vector<std::unique_ptr<Particle>>& _particleList,
-    std::mt19937_64 _gen)
-{
-  Q_UNUSED(_particleList);
-  Q_UNUSED(_gen);
-  return false;
-}
-
-bool Particle::recursiveCollision(
-    QVector3D _particle,
-    std::vector<std::unique_ptr<Particle>> &_particleList)
-{
-  Q_UNUSED(_particle);
-  Q_UNUSED(_particleList);
-  return false;
-}
-
 QVector3D Particle::getPosition()
 {
   return m_pos;
@@ -175,12 +160,25 @@ void Particle::setPos(qreal _x, qreal _y, qreal _z)
 
 void Particle::getRadius(float &_radius)
 {
-  _radius = m_size;
+  _radius = getSize();
 }
 
 void Particle::setRadius(float _radius)
 {
   m_size = _radius;
+  m_overrides |= SIZE_OVERRIDE;
+}
+
+void Particle::setParameters(const ParticleParameters *_parameters)
+{
+  m_parameters = _parameters;
+}
+
+void Particle::shareParameters(Particle &_child) const
+{
+  _child.m_parameters = m_parameters;
+  _child.m_overrides = m_overrides;
+  _child.m_size = m_size;
 }
 
 void Particle::connect(uint _ID)
@@ -210,17 +208,23 @@ void Particle::getConnectionsID(std::vector<uint> &_returnList)
   _returnList = m_connectedParticles;
 }
 
+void Particle::getConnectionsID(ScratchVector<uint> &_returnList)
+{
+  _returnList.assign(m_connectedParticles.begin(), m_connectedParticles.end());
+}
+
 int Particle::getConnectionCount()
 {
   return m_connectedParticles.size();
 }
 
 void Particle::getPosFromConnections(
-    std::vector<QVector3D> &_linkPos,
+    ScratchVector<QVector3D> &_linkPos,
     std::vector<std::unique_ptr<Particle>> &_particleList)
 {
   // Looks for the Id in the particleList of the particle system and then gets the position
   _linkPos.clear();
+  _linkPos.reserve(m_connectedParticles.size());
   QVector3D tempVec;
 
   for (size_t i = 0; i < m_connectedParticles.size(); i++)
@@ -0,0 +1,103 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ParticleEngine.cpp
+/// @author Carola Gille
+/// @author Ramon Blanquer
+/// @author Esme Prior
+/// @author Lydia Kenton
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <random>
+
+// Project
+#include "ParticleEngine.h"
+
+void LinkedModel::fill(ParticleSystem &_system, unsigned int _amount)
+{
+  std::vector<std::unique_ptr<Particle>> &particles = _system.m_particles;
+  std::vector<QVector3D> pos;
+
+  const float X = 0.525731112119133606;
+  const float Z = 0.850650808352039932;
+  const float N= 0.0f;
+
+  //Esme
+  pos.push_back(QVector3D(-X,N,Z));
+  pos.push_back(QVector3D(X,N,Z));
+  pos.push_back(QVector3D(-X,N,-Z));
+  pos.push_back(QVector3D(X,N,-Z));
+  pos.push_back(QVector3D(N,Z,X));
+  pos.push_back(QVector3D(N,Z,-X));
+  pos.push_back(QVector3D(N,-Z,X));
+  pos.push_back(QVector3D(N,-Z,-X));
+  pos.push_back(QVector3D(Z,X,N));
+  pos.push_back(QVector3D(-Z,X,N));
+  pos.push_back(QVector3D(Z,-X,N));
+  pos.push_back(QVector3D(-Z,-X,N));
+
+  // Only the twelve vertices of the icosahedron are available
+  if (_amount > pos.size())
+  {
+    qDebug("To many particles to link");
+    _amount = pos.size();
+  }
+
+  for (unsigned int i = 0; i < _amount; i++)
+  {
+    particles.emplace_back(std::unique_ptr<Particle>(new LinkedParticle(pos[i].x(), pos[i].y(),pos[i].z(),_system.m_parameters.particleSize)));
+    particles.back()->setParameters(&_system.m_parameters);
+  }
+
+  if (_amount < pos.size()) return;
+
+  // Linking the icosahedron
+  particles[0]->doubleConnect(1,particles);
+  particles[0]->doubleConnect(4,particles);
+  particles[0]->doubleConnect(6,particles);
+  particles[0]->doubleConnect(9,particles);
+  particles[0]->doubleConnect(11,particles);
+  particles[1]->doubleConnect(4,particles);
+  particles[1]->doubleConnect(6,particles);
+  particles[1]->doubleConnect(8,particles);
+  particles[1]->doubleConnect(10,particles);
+  particles[2]->doubleConnect(3,particles);
+  particles[2]->doubleConnect(5,particles);
+  particles[2]->doubleConnect(7,particles);
+  particles[2]->doubleConnect(9,particles);
+  particles[2]->doubleConnect(11,particles);
+  particles[3]->doubleConnect(5,particles);
+  particles[3]->doubleConnect(7,particles);
+  particles[3]->doubleConnect(8,particles);
+  particles[3]->doubleConnect(10,particles);
+  particles[4]->doubleConnect(5,particles);
+  particles[4]->doubleConnect(8,particles);
+  particles[4]->doubleConnect(9,particles);
+  particles[5]->doubleConnect(8,particles);
+  particles[5]->doubleConnect(9,particles);
+  particles[6]->doubleConnect(7,particles);
+  particles[6]->doubleConnect(10,particles);
+  particles[6]->doubleConnect(11,particles);
+  particles[7]->doubleConnect(10,particles);
+  particles[7]->doubleConnect(11,particles);
+  particles[8]->doubleConnect(10,particles);
+  particles[9]->doubleConnect(11,particles);
+}
+
+void GrowthModel::fill(ParticleSystem &_system, unsigned int _amount)
+{
+  for (unsigned int i = 0; i < _amount; i++)
+  {
+    _system.m_particles.emplace_back(std::unique_ptr<Particle>(new GrowthParticle(0.1,0.3,0.4,_system.m_parameters.particleSize)));
+    _system.m_particles.back()->setParameters(&_system.m_parameters);
+  }
+}
+
+void AutomataModel::fill(ParticleSystem &_system, unsigned int _amount)
+{
+  for (unsigned int i = 0; i < _amount; i++)
+  {
+    _system.m_particles.emplace_back(std::unique_ptr<Particle>(new AutomataParticle(0,0,0)));
+    _system.m_particles.back()->setParameters(&_system.m_parameters);
+  }
+}
@@ -0,0 +1,222 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ParticlePicker.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+// Project
+#include "ParticlePicker.h"
+
+int ParticlePicker::pick(
+    const ClusterGrid &_grid,
+    const std::vector<float> &_instances,
+    const QMatrix4x4 &_modelViewProjection,
+    const QVector2D &_point)
+{
+  // Ray through the pixel from the near to the far plane, in the space of the
+  // instances
+  const QMatrix4x4 inverse = _modelViewProjection.inverted();
+  const QVector3D origin = (inverse * QVector4D(_point.x(), _point.y(), -1.0f, 1.0f)).toVector3DAffine();
+  const QVector3D end = (inverse * QVector4D(_point.x(), _point.y(), 1.0f, 1.0f)).toVector3DAffine();
+  const QVector3D direction = (end - origin).normalized();
+
+  // Clusters the ray goes through, with the distance it enters them at
+  std::vector<std::pair<float, unsigned int>> crossed;
+  for (unsigned int i = 0; i < _grid.getClusterCount(); ++i)
+  {
+    const ClusterGrid::Cluster &cluster = _grid.getCluster(i);
+
+    // Slabs of the bounding box
+    float enter = 0.0f;
+    float exit = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      const float o = origin[axis];
+      const float d = direction[axis];
+      if (std::fabs(d) < 1e-12f)
+      {
+        if (o < cluster.min[axis] || o > cluster.max[axis]) exit = -1.0f;
+        continue;
+      }
+
+      float t0 = (cluster.min[axis] - o) / d;
+      float t1 = (cluster.max[axis] - o) / d;
+      if (t0 > t1) std::swap(t0, t1);
+      enter = std::max(enter, t0);
+      exit = std::min(exit, t1);
+    }
+
+    if (enter <= exit) crossed.push_back(std::make_pair(enter, i));
+  }
+
+  // Nearest clusters first, once one starts behind the closest hit so far
+  // none of the others can be closer.
+  std::sort(crossed.begin(), crossed.end());
+
+  const std::vector<unsigned int> &particles = _grid.getParticles();
+  float closest = std::numeric_limits<float>::max();
+  int hit = -1;
+
+  for (const std::pair<float, unsigned int> &entry : crossed)
+  {
+    if (entry.first > closest) break;
+
+    const ClusterGrid::Cluster &cluster = _grid.getCluster(entry.second);
+    for (unsigned int i = cluster.first; i < cluster.first + cluster.count; ++i)
+    {
+      const float *p = &_instances[particles[i] * 4];
+      const QVector3D offset = origin - QVector3D(p[0], p[1], p[2]);
+
+      // Ray against the sphere, the direction is unit length
+      const float b = QVector3D::dotProduct(offset, direction);
+      const float c = offset.lengthSquared() - p[3] * p[3];
+      const float discriminant = b * b - c;
+      if (discriminant < 0.0f) continue;
+
+      const float root = std::sqrt(discriminant);
+      float t = -b - root;
+      if (t < 0.0f) t = -b + root;
+      if (t < 0.0f || t >= closest) continue;
+
+      closest = t;
+      hit = particles[i];
+    }
+  }
+
+  return hit;
+}
+
+void ParticlePicker::selectBox(
+    const ClusterGrid &_grid,
+    const std::vector<float> &_instances,
+    const QMatrix4x4 &_modelViewProjection,
+    const QVector2D &_corner,
+    const QVector2D &_opposite,
+    std::vector<unsigned int> &_particles)
+{
+  const QVector2D min(std::min(_corner.x(), _opposite.x()), std::min(_corner.y(), _opposite.y()));
+  const QVector2D max(std::max(_corner.x(), _opposite.x()), std::max(_corner.y(), _opposite.y()));
+  selectRegion(_grid, _instances, _modelViewProjection, min, max, nullptr, _particles);
+}
+
+void ParticlePicker::selectLasso(
+    const ClusterGrid &_grid,
+    const std::vector<float> &_instances,
+    const QMatrix4x4 &_modelViewProjection,
+    const std::vector<QVector2D> &_lasso,
+    std::vector<unsigned int> &_particles)
+{
+  _particles.clear();
+  if (_lasso.size() < 3) return;
+
+  // The bounds of the lasso do the culling, the polygon only the particles
+  QVector2D min = _lasso[0];
+  QVector2D max = _lasso[0];
+  for (const QVector2D &point : _lasso)
+  {
+    min = QVector2D(std::min(min.x(), point.x()), std::min(min.y(), point.y()));
+    max = QVector2D(std::max(max.x(), point.x()), std::max(max.y(), point.y()));
+  }
+
+  selectRegion(_grid, _instances, _modelViewProjection, min, max, &_lasso, _particles);
+}
+
+void ParticlePicker::selectRegion(
+    const ClusterGrid &_grid,
+    const std::vector<float> &_instances,
+    const QMatrix4x4 &_modelViewProjection,
+    const QVector2D &_min,
+    const QVector2D &_max,
+    const std::vector<QVector2D> *_lasso,
+    std::vector<unsigned int> &_particles)
+{
+  _particles.clear();
+
+  QVector4D planes[6];
+  regionPlanes(_modelViewProjection, _min, _max, planes);
+
+  const QVector4D row0 = _modelViewProjection.row(0);
+  const QVector4D row1 = _modelViewProjection.row(1);
+
+  const std::vector<unsigned int> &particles = _grid.getParticles();
+  for (unsigned int c = 0; c < _grid.getClusterCount(); ++c)
+  {
+    const ClusterGrid::Cluster &cluster = _grid.getCluster(c);
+    if (!ClusterGrid::boxInside(planes, 6, cluster.min, cluster.max)) continue;
+
+    for (unsigned int i = cluster.first; i < cluster.first + cluster.count; ++i)
+    {
+      const float *p = &_instances[particles[i] * 4];
+      const QVector4D centre(p[0], p[1], p[2], 1.0f);
+
+      // Same test as the box, but for the centre alone
+      bool inside = true;
+      for (const QVector4D &plane : planes)
+      {
+        if (QVector4D::dotProduct(plane, centre) < 0.0f)
+        {
+          inside = false;
+          break;
+        }
+      }
+      if (!inside) continue;
+
+      if (_lasso != nullptr)
+      {
+        // In front of the camera, so w is positive
+        const float w = QVector4D::dotProduct(planes[4] + planes[5], centre) * 0.5f;
+        const QVector2D projected(
+            QVector4D::dotProduct(row0, centre) / w,
+            QVector4D::dotProduct(row1, centre) / w);
+        if (!insidePolygon(*_lasso, projected)) continue;
+      }
+
+      _particles.push_back(particles[i]);
+    }
+  }
+}
+
+void ParticlePicker::regionPlanes(
+    const QMatrix4x4 &_matrix,
+    const QVector2D &_min,
+    const QVector2D &_max,
+    QVector4D _planes[6])
+{
+  // Inside means min.x * w <= x <= max.x * w and so on, like the frustum
+  // planes of ClusterGrid::extractPlanes() with the screen edges moved in.
+  const QVector4D x = _matrix.row(0);
+  const QVector4D y = _matrix.row(1);
+  const QVector4D z = _matrix.row(2);
+  const QVector4D w = _matrix.row(3);
+
+  _planes[0] = x - _min.x() * w;
+  _planes[1] = _max.x() * w - x;
+  _planes[2] = y - _min.y() * w;
+  _planes[3] = _max.y() * w - y;
+  _planes[4] = w + z;
+  _planes[5] = w - z;
+}
+
+bool ParticlePicker::insidePolygon(const std::vector<QVector2D> &_polygon, const QVector2D &_point)
+{
+  bool inside = false;
+  for (size_t i = 0, j = _polygon.size() - 1; i < _polygon.size(); j = i++)
+  {
+    const QVector2D &a = _polygon[i];
+    const QVector2D &b = _polygon[j];
+
+    // Edges crossing the horizontal line through the point, on its right
+    if ((a.y() > _point.y()) != (b.y() > _point.y()) &&
+        _point.x() < (b.x() - a.x()) * (_point.y() - a.y()) / (b.y() - a.y()) + a.x())
+    {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
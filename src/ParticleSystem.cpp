@@ -9,22 +9,28 @@
 
 // Native
 #include <math.h>
+#include <algorithm>
 #include <iostream>
 #include <random>
+#include <utility>
 
 // Custom
 #include "include/ParticleSystem.h"
+#include "include/ParticleEngine.h"
 
-// Default constructor creates a 2500 (50*50) distribution of particles
+// Default constructor creates an icosahedron of linked particles
 ParticleSystem::ParticleSystem() :
+  ParticleSystem('L')
+{
+}
+
+//filling particle system with input particle type
+ParticleSystem::ParticleSystem(char _particleType):
   m_gen(m_rd())
 {
-  qDebug("Default constructor called");
+  qDebug("Custom constructor called");
 
-  m_currentParticleSize=2.0;
   m_particleCount=0;
-  m_particleType= 'L';
-  fill(12);
   m_forces = true;
   m_particleDeath = false;
   m_cohesion = 30; //percent
@@ -33,81 +39,161 @@ ParticleSystem::ParticleSystem() :
   m_automataTime = 200;
   m_nearestParticleState=true;
   m_GP_growtoLight=true;
+
+  reset(_particleType);
 }
 
-//filling particle system with input particle type
-ParticleSystem::ParticleSystem(char _particleType):
-  m_gen(m_rd())
+ParticleSystem::~ParticleSystem()
 {
-  qDebug("Custom constructor called");
+}
 
-  m_currentParticleSize=2.0;
-  m_particleCount=0;
-  m_particleType = _particleType;
+void ParticleSystem::advance()
+{
+  // Scratch memory of the previous step is not needed anymore
+  FrameArena::local().reset();
 
-  //if it's a linked particle we need 12 particle
-  if (m_particleType=='L')
-  {
-    fill(12);
+  applyParameters();
 
-    m_cohesion = 30; //percent
-    m_localCohesion = 30;
-    m_forces = true;
-    m_particleDeath = false;
-  }
-  //if it's a Growth particle we need 1 particle to start with
-  else if (m_particleType== 'G')
+  //reseting the particle count to the size of the particle list
+  m_particleCount=m_particles.size();
+
+  //calculating the forces
+  if (m_forces==true)
   {
-    fill(1);
+    m_engine->advance(*this);
   }
-  else if (m_particleType=='A')
+
+  m_iterID.resize(0); //Resizes the vector of dead particles
+}
+
+bool ParticleSystem::isSettled() const
+{
+  if (!m_forces) return true;
+  if (!m_engine->canSleep()) return false;
+
+  // Only the particles of the last step can still be moving. The ones woken
+  // by a particle moving in it are caught through that one.
+  for (unsigned int i : m_activeParticles)
   {
-    fill(1);
-    m_automataRadius = 4;
-    m_automataTime = 200;
+    if (!m_particles[i]->isAsleep()) return false;
   }
+  return true;
 }
 
-
-void ParticleSystem::advance()
+void ParticleSystem::updateSleepStates()
 {
-  //reseting the particle count to the size of the particle list
-  m_particleCount=m_particles.size();
+  ScratchVector<uint> links;
+  ScratchVector<uint> moving;
 
-  //calculating the forces
-  if (m_forces==true)
+  for (unsigned int i : m_activeParticles)
   {
-    for (unsigned int i = 0; i < m_particleCount; ++i)
+    // A particle that moved changes the forces on everything linked to it
+    if (m_particles[i]->updateSleepState())
     {
-      switch(m_particleType)
+      moving.push_back(i);
+      m_particles[i]->getConnectionsID(links);
+      for (uint ID : links)
       {
-      case 'A':
-        m_particles[i]->calculate(m_particles, m_automataRadius, m_automataTime);
-        if(m_particles[i]->isAlive() == false)
-        {
-          m_iterID.push_back(i); //Pushes dead particles into a vector of IDs
-          deleteParticle(); //Function call to deleteParticle
-        }
-        break;
-      case 'L':
-        m_particles[i]->calculate(m_particles, m_averageDistance, m_cohesion, m_localCohesion, m_particleDeath);
-        break;
-      default:
-        break;
+        m_particles[ID]->wake();
       }
     }
+  }
+
+  // Unlinked particles push each other apart when they overlap, a sleeper
+  // would never push back.
+  if (!moving.empty()) wakeNeighbours(moving);
+}
+
+void ParticleSystem::wakeNeighbours(const ScratchVector<uint> &_moving)
+{
+  const uint count = m_particles.size();
+
+  ScratchVector<QVector3D> positions(count);
+  ScratchVector<float> radii(count);
+  float maxRadius = 0.0f;
+  for (uint i = 0; i < count; ++i)
+  {
+    m_particles[i]->getPos(positions[i]);
+    m_particles[i]->getRadius(radii[i]);
+    maxRadius = std::max(maxRadius, radii[i]);
+  }
+
+  QVector3D lo = positions[0];
+  for (const QVector3D &pos : positions)
+  {
+    lo = QVector3D(std::min(lo.x(), pos.x()), std::min(lo.y(), pos.y()), std::min(lo.z(), pos.z()));
+  }
+
+  // Cells as wide as the repulsion reaches, so the neighbours of a particle
+  // are all in the 27 cells around it.
+  const float cellSize = std::max(2.0f * maxRadius, 1e-3f);
+  const quint64 maxCell = (1u << 21) - 1;
+  auto cellOf = [&](const QVector3D &_pos, int _axis)
+  {
+    return std::min(quint64((_pos[_axis] - lo[_axis]) / cellSize), maxCell);
+  };
+  auto key = [](quint64 _x, quint64 _y, quint64 _z)
+  {
+    return _x | (_y << 21) | (_z << 42);
+  };
+
+  // Spatial hash as particles sorted by cell
+  typedef std::pair<quint64, uint> Entry;
+  ScratchVector<Entry> cells;
+  cells.reserve(count);
+  for (uint i = 0; i < count; ++i)
+  {
+    cells.push_back(Entry(key(cellOf(positions[i], 0), cellOf(positions[i], 1), cellOf(positions[i], 2)), i));
+  }
+  std::sort(cells.begin(), cells.end());
 
-    for (unsigned int i = 0; i < m_particleCount; ++i)
+  for (uint m : _moving)
+  {
+    const quint64 c[3] = {cellOf(positions[m], 0), cellOf(positions[m], 1), cellOf(positions[m], 2)};
+
+    for (quint64 x = c[0] ? c[0] - 1 : 0; x <= std::min(c[0] + 1, maxCell); ++x)
+    for (quint64 y = c[1] ? c[1] - 1 : 0; y <= std::min(c[1] + 1, maxCell); ++y)
+    for (quint64 z = c[2] ? c[2] - 1 : 0; z <= std::min(c[2] + 1, maxCell); ++z)
     {
-      m_particles[i]->advance();
+      const quint64 cell = key(x, y, z);
+      auto it = std::lower_bound(cells.begin(), cells.end(), Entry(cell, 0));
+      for (; it != cells.end() && it->first == cell; ++it)
+      {
+        const uint j = it->second;
+        if (j == m || !m_particles[j]->isAsleep()) continue;
+
+        // Either of the two repels the other from twice its own size
+        const float reach = 2.0f * std::max(radii[m], radii[j]);
+        if ((positions[j] - positions[m]).lengthSquared() <= reach * reach) m_particles[j]->wake();
+      }
     }
   }
+}
 
-  m_iterID.resize(0); //Resizes the vector of dead particles
+void ParticleSystem::wakeLinked(unsigned int _idx)
+{
+  ScratchVector<uint> links;
+  m_particles[_idx]->getConnectionsID(links);
+
+  m_particles[_idx]->wake();
+  for (uint ID : links)
+  {
+    m_particles[ID]->wake();
+  }
+}
+
+void ParticleSystem::wakeAll()
+{
+  for (auto &particle : m_particles)
+  {
+    particle->wake();
+  }
 }
 
 void ParticleSystem::bulge()
 {
+  wakeAll();
+
   //Bulges the innermost particles outwards
   m_particleCount=m_particles.size();
   for (unsigned int i = 0; i < m_particleCount; ++i)
@@ -120,6 +206,8 @@ void ParticleSystem::bulge()
 
 void ParticleSystem::addFood()
 {
+  wakeAll();
+
   for (unsigned int i=0; i<=m_particles.size()/3; i++)
   {
     unsigned int randomIndex = rand() % m_particleCount;
@@ -134,89 +222,8 @@ void ParticleSystem::addFood()
 
 void ParticleSystem::fill(unsigned int _amount)
 {
-  std::uniform_real_distribution<float> distribution(-10.0,10.0);
-  std::vector<QVector3D> pos;
-
-  const float X = 0.525731112119133606;
-  const float Z = 0.850650808352039932;
-  const float N= 0.0f;
-
-  //Esme
-  pos.push_back(QVector3D(-X,N,Z));
-  pos.push_back(QVector3D(X,N,Z));
-  pos.push_back(QVector3D(-X,N,-Z));
-  pos.push_back(QVector3D(X,N,-Z));
-  pos.push_back(QVector3D(N,Z,X));
-  pos.push_back(QVector3D(N,Z,-X));
-  pos.push_back(QVector3D(N,-Z,X));
-  pos.push_back(QVector3D(N,-Z,-X));
-  pos.push_back(QVector3D(Z,X,N));
-  pos.push_back(QVector3D(-Z,X,N));
-  pos.push_back(QVector3D(Z,-X,N));
-  pos.push_back(QVector3D(-Z,-X,N));
-
-  for (unsigned int i = 0; i < _amount; i++)
-  {
-    if(m_particleType=='G') //Growth particle
-    {
-      m_particles.emplace_back(std::unique_ptr<Particle>(new GrowthParticle(0.1,0.3,0.4,m_currentParticleSize)));
-
-      m_particleCount++;
-    }
-    else if(m_particleType=='L') //Linked particle
-    {
-      m_particles.emplace_back(std::unique_ptr<Particle>(new LinkedParticle(pos[i].x(), pos[i].y(),pos[i].z(),m_currentParticleSize)));
-    }
-    else if(m_particleType=='A') //Automata particle
-    {
-      m_particles.emplace_back(std::unique_ptr<Particle>(new AutomataParticle(0,0,0)));
-      m_particleCount++;
-    }
-    m_particleCount++;
-  }
-
-  if (_amount <= 12)
-  {
-   if (m_particleType=='L')
-   {
-    //Linking the icosahedron
-    m_particles[0]->doubleConnect(1,m_particles);
-    m_particles[0]->doubleConnect(4,m_particles);
-    m_particles[0]->doubleConnect(6,m_particles);
-    m_particles[0]->doubleConnect(9,m_particles);
-    m_particles[0]->doubleConnect(11,m_particles);
-    m_particles[1]->doubleConnect(4,m_particles);
-    m_particles[1]->doubleConnect(6,m_particles);
-    m_particles[1]->doubleConnect(8,m_particles);
-    m_particles[1]->doubleConnect(10,m_particles);
-    m_particles[2]->doubleConnect(3,m_particles);
-    m_particles[2]->doubleConnect(5,m_particles);
-    m_particles[2]->doubleConnect(7,m_particles);
-    m_particles[2]->doubleConnect(9,m_particles);
-    m_particles[2]->doubleConnect(11,m_particles);
-    m_particles[3]->doubleConnect(5,m_particles);
-    m_particles[3]->doubleConnect(7,m_particles);
-    m_particles[3]->doubleConnect(8,m_particles);
-    m_particles[3]->doubleConnect(10,m_particles);
-    m_particles[4]->doubleConnect(5,m_particles);
-    m_particles[4]->doubleConnect(8,m_particles);
-    m_particles[4]->doubleConnect(9,m_particles);
-    m_particles[5]->doubleConnect(8,m_particles);
-    m_particles[5]->doubleConnect(9,m_particles);
-    m_particles[6]->doubleConnect(7,m_particles);
-    m_particles[6]->doubleConnect(10,m_particles);
-    m_particles[6]->doubleConnect(11,m_particles);
-    m_particles[7]->doubleConnect(10,m_particles);
-    m_particles[7]->doubleConnect(11,m_particles);
-    m_particles[8]->doubleConnect(10,m_particles);
-    m_particles[9]->doubleConnect(11,m_particles);
-   }
-  }
-
-  else
-  {
-    qDebug("To many particles to link");
-  }
+  m_engine->fill(*this, _amount);
+  m_particleCount = m_particles.size();
 }
 
 // Returns a NORMAL pointer to the linked particle, not a smart one, otherwise
@@ -270,10 +277,15 @@ void ParticleSystem::setLightPos(QVector3D _lightPos)
 
 void ParticleSystem::splitRandomParticle()
 {
-  if(m_particleType=='A') return;
+  if(!m_engine->canSplit()) return;
+
+  FrameArena::local().reset();
+
+  applyParameters();
 
   bool split=false;
-  std::vector<uint> toSplit;
+  ScratchVector<uint> toSplit;
+  toSplit.reserve(m_particles.size());
 
   for(uint i=0;i<m_particles.size();i++)
   {
@@ -281,7 +293,7 @@ void ParticleSystem::splitRandomParticle()
   }
   
 
-  while (split == false)
+  while (split == false && !toSplit.empty())
   {
     std::uniform_int_distribution<int> distribution(0,toSplit.size()-1);
 
@@ -292,16 +304,7 @@ void ParticleSystem::splitRandomParticle()
         index=nearestParticle;
     else
         index=distribution(m_gen);
-    // calling different split function based on the particle type
-
-    if(m_particleType=='G')
-    {
-      split=m_particles[toSplit[index]]->split(m_lightPos,m_particles,m_gen,m_GP_growtoLight);
-    }
-    else if(m_particleType=='L')
-    {
-      split=m_particles[toSplit[index]]->split(m_particles,m_gen);
-    }
+    split=m_engine->split(*this, toSplit[index]);
 
     m_particleCount=m_particles.size();
 
@@ -309,28 +312,22 @@ void ParticleSystem::splitRandomParticle()
     {
       toSplit.erase(toSplit.begin()+index);
     }
-  }
-
-  for (unsigned int i = 0; i < m_particleCount; ++i)
-  {
-    switch(m_particleType)
+    else
     {
-    case 'A':
-      m_particles[i]->calculate(m_particles, m_automataRadius, m_automataTime);
-      break;
-    case 'L':
-      m_particles[i]->calculate(m_particles, m_averageDistance, m_cohesion, m_localCohesion, m_particleDeath);
-      break;
-    default:
-      break;
+      // The split rearranged the links around both particles
+      wakeLinked(toSplit[index]);
+      wakeLinked(m_particleCount - 1);
     }
   }
+
+  m_engine->calculate(*this);
 }
 
-unsigned int ParticleSystem::getNearestParticle(std::vector<uint> _toSplit)
+unsigned int ParticleSystem::getNearestParticle(const ScratchVector<uint> &_toSplit)
 {
   //Finds the particle nearest to the point light radius so that they may be split
-  std::vector<float> m_lightDistances;
+  ScratchVector<float> m_lightDistances;
+  m_lightDistances.reserve(_toSplit.size());
 
   for (unsigned int i=0; i<_toSplit.size(); i++)
   {
@@ -338,7 +335,7 @@ unsigned int ParticleSystem::getNearestParticle(std::vector<uint> _toSplit)
     m_lightDistances.push_back(lightDist.lengthSquared());
   }
 
-  std::vector<float>::iterator minElement = std::min_element (std::begin(m_lightDistances), std::end(m_lightDistances));
+  ScratchVector<float>::iterator minElement = std::min_element (std::begin(m_lightDistances), std::end(m_lightDistances));
   unsigned int minElementIndex = std::distance(std::begin(m_lightDistances), minElement);
 
   return minElementIndex;
@@ -363,6 +360,8 @@ void ParticleSystem::deleteParticle()
 
 void ParticleSystem::packageDataForDrawing(std::vector<float> &_packagedData)
 {
+  applyParameters();
+
   _packagedData.clear();
   for_each(m_particles.begin(), m_particles.end(), [&_packagedData](std::unique_ptr<Particle> &p)
   {
@@ -419,31 +418,32 @@ QVector3D ParticleSystem::calculateAverageDistanceFromCentre()
 
 void ParticleSystem::setParticleSize(double _size)
 {
-  m_currentParticleSize=_size;
-  for(unsigned int i=0;i< m_particles.size();i++)
-  {
-    m_particles[i]->setRadius(_size);
-  }
+  m_pendingParameters.particleSize = _size;
+  m_pendingParameters.version++;
 }
 
 void ParticleSystem::toggleForces(bool _state)
 {
   m_forces=_state;
+  wakeAll();
 }
 
 void ParticleSystem::toggleParticleDeath(bool _state)
 {
   m_particleDeath=_state;
+  wakeAll();
 }
 
 void ParticleSystem::setCohesion(int _amount)
 {
   m_cohesion = 100 - (_amount);
+  wakeAll();
 }
 
 void ParticleSystem::setLocalCohesion(int _amount)
 {
   m_localCohesion = 100 - (_amount);
+  wakeAll();
 }
 
 void ParticleSystem::setAutomataRadius(int _amount)
@@ -460,46 +460,58 @@ void ParticleSystem::setAutomataTime(int _amount)
 
 void ParticleSystem::setBranchLength(float _amount)
 {
-  for(unsigned int i=0;i< m_particles.size();i++)
-  {
-    m_particles[i]->setBranchLength(_amount);
-  }
+  m_pendingParameters.branchLength = _amount;
+  m_pendingParameters.version++;
 }
 
 void ParticleSystem::setChildThreshold(int _value)
 {
-  for(unsigned int i=0;i< m_particles.size();i++)
-  {
-    m_particles[i]->setChildThreshold(_value);
-  }
+  m_pendingParameters.childThreshold = _value;
+  m_pendingParameters.version++;
+}
+
+void ParticleSystem::applyParameters()
+{
+  if (m_parameters.version == m_pendingParameters.version) return;
+
+  // Particles only hold a pointer to the block, swapping the values is all
+  // it takes. Done between steps so a step never sees half of a change.
+  m_parameters = m_pendingParameters;
+  wakeAll();
 }
 
 void ParticleSystem::reset(char _particleType)
 {
   m_particles.clear();
+  m_activeParticles.clear();
   m_particleCount=0;
   Particle::resetIDCounter();
-  m_particleType=_particleType;
-  if (m_particleType=='L') //Linked Particles
-  {
-    fill(12);
 
-    m_forces = true;
-    m_particleDeath = false;
-    m_cohesion = 30; //percent
-    m_localCohesion = 30;
-    m_nearestParticleState=true;
-  }
-  else if (m_particleType== 'G') //Growth particles
+  // The only place where the particle type matters, from here on everything
+  // goes through the engine.
+  switch (_particleType)
   {
+  case 'G': //Growth particles
+    m_engine.reset(new ParticleEngine<GrowthModel>);
     m_nearestParticleState=false;
     fill(1);
-  }
-  else if (m_particleType == 'A') //Automata particles
-  {
-    fill(1);
+    break;
+  case 'A': //Automata particles
+    m_engine.reset(new ParticleEngine<AutomataModel>);
     m_automataRadius = 4;
     m_automataTime = 200;
+    fill(1);
+    break;
+  default:
+    if (_particleType != 'L') qCritical("Unknown particle type %c, using linked particles.", _particleType);
+    m_engine.reset(new ParticleEngine<LinkedModel>);
+    m_forces = true;
+    m_particleDeath = false;
+    m_cohesion = 30; //percent
+    m_localCohesion = 30;
+    m_nearestParticleState=true;
+    fill(12);
+    break;
   }
   m_GP_growtoLight=true;
 }
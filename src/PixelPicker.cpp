@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file PixelPicker.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Project
+#include "PixelPicker.h"
+
+PixelPicker::PixelPicker()
+  : m_fbo(nullptr)
+  , m_pbo(0)
+  , m_fence(nullptr)
+  , m_width(0)
+  , m_height(0)
+{
+}
+
+void PixelPicker::resize(int _w, int _h)
+{
+  if (_w == m_width && _h == m_height) return;
+
+  // Made again by the next pick, when the context is current for sure
+  delete m_fbo;
+  m_fbo = nullptr;
+  m_width = _w;
+  m_height = _h;
+}
+
+void PixelPicker::destroy(QOpenGLFunctions_4_1_Core *_funcs)
+{
+  if (m_fence != nullptr) _funcs->glDeleteSync(m_fence);
+  m_fence = nullptr;
+
+  _funcs->glDeleteBuffers(1, &m_pbo);
+  m_pbo = 0;
+
+  delete m_fbo;
+  m_fbo = nullptr;
+}
+
+bool PixelPicker::isBusy() const
+{
+  return m_fence != nullptr;
+}
+
+bool PixelPicker::pick(
+    QOpenGLFunctions_4_1_Core *_funcs,
+    int _x,
+    int _y,
+    const std::function<void()> &_draw)
+{
+  if (_x < 0 || _y < 0 || _x >= m_width || _y >= m_height) return false;
+
+  if (m_fbo == nullptr) m_fbo = new QOpenGLFramebufferObject(m_width, m_height);
+  if (m_pbo == 0)
+  {
+    _funcs->glGenBuffers(1, &m_pbo);
+    _funcs->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+    _funcs->glBufferData(GL_PIXEL_PACK_BUFFER, 4, nullptr, GL_STREAM_READ);
+    _funcs->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  // OpenGL rows go up
+  const int row = m_height - 1 - _y;
+
+  m_fbo->bind();
+  _funcs->glViewport(0, 0, m_width, m_height);
+  _funcs->glEnable(GL_SCISSOR_TEST);
+  _funcs->glScissor(_x, row, 1, 1);
+
+  // Clear colour buffer for temporary drawing
+  _funcs->glClearColor(0, 0, 0, 0);
+  _funcs->glClear(GL_COLOR_BUFFER_BIT);
+  _draw();
+
+  // Lands in the buffer whenever the GPU gets there, nothing waits for it
+  _funcs->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+  _funcs->glReadPixels(_x, row, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  _funcs->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_fence = _funcs->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  _funcs->glDisable(GL_SCISSOR_TEST);
+  m_fbo->release();
+  return true;
+}
+
+bool PixelPicker::resolve(QOpenGLFunctions_4_1_Core *_funcs, QVector3D &_colour)
+{
+  if (m_fence == nullptr) return false;
+
+  const GLenum result = _funcs->glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (result == GL_TIMEOUT_EXPIRED) return false;
+
+  _funcs->glDeleteSync(m_fence);
+  m_fence = nullptr;
+
+  if (result == GL_WAIT_FAILED)
+  {
+    qWarning("Waiting on the picking fence failed.");
+    return false;
+  }
+
+  GLubyte pixel[4];
+  _funcs->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+  _funcs->glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(pixel), pixel);
+  _funcs->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  _colour = QVector3D(pixel[0], pixel[1], pixel[2]);
+  return true;
+}
@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ProgramCache.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Qt
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// Project
+#include "ProgramCache.h"
+
+ProgramCache::ProgramCache()
+  : m_funcs(nullptr)
+{
+}
+
+void ProgramCache::initialize(QOpenGLFunctions_4_1_Core *_funcs)
+{
+  m_funcs = _funcs;
+  m_directory.clear();
+
+  m_driver  = reinterpret_cast<const char*>(m_funcs->glGetString(GL_VENDOR));
+  m_driver += reinterpret_cast<const char*>(m_funcs->glGetString(GL_RENDERER));
+  m_driver += reinterpret_cast<const char*>(m_funcs->glGetString(GL_VERSION));
+
+  // Without binary formats there is nothing to cache
+  GLint formats = 0;
+  m_funcs->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats == 0)
+  {
+    qDebug("Program binaries not supported, shaders are compiled every time.");
+    return;
+  }
+
+  const QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/programs";
+  if (!QDir().mkpath(directory))
+  {
+    qWarning("Could not create the shader cache at %s", qPrintable(directory));
+    return;
+  }
+  m_directory = directory;
+}
+
+bool ProgramCache::build(
+    QOpenGLShaderProgram *_program,
+    const QString &_vertex,
+    const QString &_fragment)
+{
+  return buildFromSource(_program, readSource(_vertex), readSource(_fragment));
+}
+
+bool ProgramCache::buildFromSource(
+    QOpenGLShaderProgram *_program,
+    const QByteArray &_vertex,
+    const QByteArray &_fragment)
+{
+  QString path;
+  if (!m_directory.isEmpty())
+  {
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(_vertex);
+    hash.addData(QByteArray(1, '\0'));
+    hash.addData(_fragment);
+    hash.addData(QByteArray(1, '\0'));
+    hash.addData(m_driver);
+    path = m_directory + "/" + QString::fromLatin1(hash.result().toHex()) + ".bin";
+
+    if (load(_program, path)) return true;
+  }
+
+  _program->addShaderFromSourceCode(QOpenGLShader::Vertex, _vertex);
+  _program->addShaderFromSourceCode(QOpenGLShader::Fragment, _fragment);
+
+  // The driver may not keep the binary around unless asked to
+  if (!path.isEmpty())
+  {
+    m_funcs->glProgramParameteri(_program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  if (!_program->link())
+  {
+    qWarning("Shader program failed to link:\n%s", qPrintable(_program->log()));
+    return false;
+  }
+
+  if (!path.isEmpty()) save(_program, path);
+  return true;
+}
+
+QByteArray ProgramCache::readSource(const QString &_path)
+{
+  QFile file(_path);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    qWarning("Could not read shader %s", qPrintable(_path));
+    return QByteArray();
+  }
+  return file.readAll();
+}
+
+bool ProgramCache::load(QOpenGLShaderProgram *_program, const QString &_path)
+{
+  QFile file(_path);
+  if (!file.open(QIODevice::ReadOnly)) return false;
+
+  quint32 format = 0;
+  QByteArray binary;
+  QDataStream stream(&file);
+  stream >> format >> binary;
+  file.close();
+
+  if (stream.status() != QDataStream::Ok || binary.isEmpty())
+  {
+    file.remove();
+    return false;
+  }
+
+  if (!_program->create()) return false;
+  m_funcs->glProgramBinary(_program->programId(), format, binary.constData(), binary.size());
+
+  GLint linked = GL_FALSE;
+  m_funcs->glGetProgramiv(_program->programId(), GL_LINK_STATUS, &linked);
+  if (linked == GL_FALSE)
+  {
+    // Usually a driver update the strings did not catch, build it again
+    qDebug("Discarding stale program binary %s", qPrintable(_path));
+    file.remove();
+    return false;
+  }
+
+  // Without shaders link() only picks up the state set by glProgramBinary
+  return _program->link();
+}
+
+void ProgramCache::save(QOpenGLShaderProgram *_program, const QString &_path)
+{
+  GLint length = 0;
+  m_funcs->glGetProgramiv(_program->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+
+  QByteArray binary(length, Qt::Uninitialized);
+  GLenum format = 0;
+  m_funcs->glGetProgramBinary(_program->programId(), length, &length, &format, binary.data());
+  binary.resize(length);
+
+  // Written aside and renamed, a crash never leaves half a binary behind
+  QSaveFile file(_path);
+  if (!file.open(QIODevice::WriteOnly)) return;
+
+  QDataStream stream(&file);
+  stream << quint32(format) << binary;
+  if (!file.commit())
+  {
+    qWarning("Could not write program binary %s", qPrintable(_path));
+  }
+}
@@ -0,0 +1,370 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file RenderGraph.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <algorithm>
+
+// Qt
+#include <QStringList>
+
+// Project
+#include "RenderGraph.h"
+
+// Constants passed by reference need a definition
+constexpr unsigned RenderGraph::m_max_idle_frames;
+
+RenderGraph::RenderGraph()
+  : m_funcs(nullptr)
+  , m_frame(0)
+{
+}
+
+void RenderGraph::initialize(QOpenGLFunctions_4_1_Core *_funcs)
+{
+  m_funcs = _funcs;
+}
+
+void RenderGraph::releaseTextures()
+{
+  for (auto &entry : m_framebuffers) m_funcs->glDeleteFramebuffers(1, &entry.second);
+  m_framebuffers.clear();
+
+  for (PooledTexture &pooled : m_pool)
+  {
+    pooled.texture->destroy();
+    delete pooled.texture;
+  }
+  m_pool.clear();
+
+  // Handles of the frame pointing to them are gone too
+  reset();
+}
+
+void RenderGraph::forgetTexture(const QOpenGLTexture *_texture)
+{
+  const GLuint id = _texture->textureId();
+  for (auto fbo = m_framebuffers.begin(); fbo != m_framebuffers.end();)
+  {
+    if (std::find(fbo->first.begin(), fbo->first.end(), id) == fbo->first.end())
+    {
+      ++fbo;
+      continue;
+    }
+    m_funcs->glDeleteFramebuffers(1, &fbo->second);
+    fbo = m_framebuffers.erase(fbo);
+  }
+}
+
+void RenderGraph::reset()
+{
+  m_passes.clear();
+  m_resources.clear();
+}
+
+RenderGraph::Resource RenderGraph::createTexture(
+    const QString &_name,
+    const TextureDescription &_description)
+{
+  ResourceNode node;
+  node.name = _name;
+  node.description = _description;
+  node.texture = nullptr;
+  node.framebuffer = 0;
+  node.imported = false;
+  node.backbuffer = false;
+  m_resources.push_back(node);
+  return m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importTexture(const QString &_name, QOpenGLTexture *_texture)
+{
+  ResourceNode node;
+  node.name = _name;
+  node.description = {_texture->width(), _texture->height(), _texture->format()};
+  node.texture = _texture;
+  node.framebuffer = 0;
+  node.imported = true;
+  node.backbuffer = false;
+  m_resources.push_back(node);
+  return m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importBackbuffer(GLuint _framebuffer, int _width, int _height)
+{
+  ResourceNode node;
+  node.name = "backbuffer";
+  node.description = {_width, _height, QOpenGLTexture::NoFormat};
+  node.texture = nullptr;
+  node.framebuffer = _framebuffer;
+  node.imported = true;
+  node.backbuffer = true;
+  m_resources.push_back(node);
+  return m_resources.size() - 1;
+}
+
+RenderGraph::Pass RenderGraph::addPass(const QString &_name, const std::function<void()> &_execute)
+{
+  PassNode node;
+  node.name = _name;
+  node.execute = _execute;
+  node.culled = false;
+  m_passes.push_back(node);
+  return m_passes.size() - 1;
+}
+
+void RenderGraph::read(Pass _pass, Resource _resource)
+{
+  m_passes[_pass].reads.push_back(_resource);
+}
+
+void RenderGraph::write(Pass _pass, Resource _resource)
+{
+  m_passes[_pass].writes.push_back(_resource);
+}
+
+void RenderGraph::compile()
+{
+  m_frame++;
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// Culling
+  //////////////////////////////////////////////////////////////////////////////
+  // Walking backwards, a pass is needed if it draws on screen or draws
+  // something a needed pass after it reads.
+  for (ResourceNode &resource : m_resources) resource.needed = false;
+
+  for (size_t p = m_passes.size(); p-- > 0;)
+  {
+    PassNode &pass = m_passes[p];
+    pass.culled = true;
+    for (Resource written : pass.writes)
+    {
+      if (m_resources[written].backbuffer || m_resources[written].needed) pass.culled = false;
+    }
+
+    if (pass.culled) continue;
+    for (Resource read : pass.reads) m_resources[read].needed = true;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// Lifetimes of the transient textures
+  //////////////////////////////////////////////////////////////////////////////
+  const size_t unused = m_passes.size();
+  for (ResourceNode &resource : m_resources)
+  {
+    resource.firstUse = unused;
+    resource.lastUse = 0;
+  }
+
+  for (size_t p = 0; p < m_passes.size(); ++p)
+  {
+    if (m_passes[p].culled) continue;
+
+    for (const std::vector<Resource> *used : {&m_passes[p].reads, &m_passes[p].writes})
+    {
+      for (Resource r : *used)
+      {
+        m_resources[r].firstUse = std::min(m_resources[r].firstUse, p);
+        m_resources[r].lastUse = std::max(m_resources[r].lastUse, p);
+      }
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  /// Aliasing
+  //////////////////////////////////////////////////////////////////////////////
+  // Outputs are taken before the inputs of the same pass are given back, so a
+  // pass never reads and writes the same texture.
+  for (PooledTexture &pooled : m_pool) pooled.busy = false;
+
+  for (size_t p = 0; p < m_passes.size(); ++p)
+  {
+    if (m_passes[p].culled) continue;
+
+    for (ResourceNode &resource : m_resources)
+    {
+      if (!resource.imported && resource.firstUse == p) resource.texture = acquire(resource.description);
+    }
+
+    for (ResourceNode &resource : m_resources)
+    {
+      if (!resource.imported && resource.lastUse == p) release(resource.texture);
+    }
+  }
+
+  trim();
+
+  QStringList live;
+  QStringList culled;
+  for (const PassNode &pass : m_passes) (pass.culled ? culled : live) << pass.name;
+
+  QString passes = live.join(", ");
+  if (!culled.isEmpty()) passes += QString(" (culled %1)").arg(culled.join(", "));
+  if (passes != m_live_passes)
+  {
+    qDebug("Render graph: %s, %d pooled textures", qPrintable(passes), int(m_pool.size()));
+    m_live_passes = passes;
+  }
+}
+
+void RenderGraph::execute()
+{
+  for (const PassNode &pass : m_passes)
+  {
+    if (pass.culled) continue;
+
+    bindOutputs(pass);
+    pass.execute();
+  }
+
+  // Leave the screen bound, like the passes found it
+  for (const ResourceNode &resource : m_resources)
+  {
+    if (resource.backbuffer) m_funcs->glBindFramebuffer(GL_FRAMEBUFFER, resource.framebuffer);
+  }
+}
+
+QOpenGLTexture *RenderGraph::texture(Resource _resource) const
+{
+  return m_resources[_resource].texture;
+}
+
+bool RenderGraph::isCulled(Pass _pass) const
+{
+  return m_passes[_pass].culled;
+}
+
+QOpenGLTexture *RenderGraph::acquire(const TextureDescription &_description)
+{
+  for (PooledTexture &pooled : m_pool)
+  {
+    const TextureDescription &d = pooled.description;
+    if (pooled.busy ||
+        d.width != _description.width ||
+        d.height != _description.height ||
+        d.format != _description.format) continue;
+
+    pooled.busy = true;
+    pooled.lastFrame = m_frame;
+    return pooled.texture;
+  }
+
+  QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+  texture->setSize(_description.width, _description.height);
+  texture->setFormat(_description.format);
+  texture->setMinificationFilter(QOpenGLTexture::Nearest);
+  texture->setMagnificationFilter(QOpenGLTexture::Nearest);
+  texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+  texture->allocateStorage();
+
+  PooledTexture pooled;
+  pooled.texture = texture;
+  pooled.description = _description;
+  pooled.busy = true;
+  pooled.lastFrame = m_frame;
+  m_pool.push_back(pooled);
+  return texture;
+}
+
+void RenderGraph::release(QOpenGLTexture *_texture)
+{
+  for (PooledTexture &pooled : m_pool)
+  {
+    if (pooled.texture == _texture) pooled.busy = false;
+  }
+}
+
+void RenderGraph::trim()
+{
+  for (auto it = m_pool.begin(); it != m_pool.end();)
+  {
+    if (m_frame - it->lastFrame <= m_max_idle_frames)
+    {
+      ++it;
+      continue;
+    }
+
+    // Framebuffers with the texture attached go with it
+    forgetTexture(it->texture);
+    it->texture->destroy();
+    delete it->texture;
+    it = m_pool.erase(it);
+  }
+}
+
+void RenderGraph::bindOutputs(const PassNode &_pass)
+{
+  std::vector<QOpenGLTexture*> colours;
+  QOpenGLTexture *depth = nullptr;
+
+  for (Resource written : _pass.writes)
+  {
+    const ResourceNode &resource = m_resources[written];
+    if (resource.backbuffer)
+    {
+      m_funcs->glBindFramebuffer(GL_FRAMEBUFFER, resource.framebuffer);
+      m_funcs->glViewport(0, 0, resource.description.width, resource.description.height);
+      return;
+    }
+
+    if (isDepthFormat(resource.description.format)) depth = resource.texture;
+    else colours.push_back(resource.texture);
+  }
+
+  const QOpenGLTexture *sized = colours.empty() ? depth : colours[0];
+  if (sized == nullptr) return;
+
+  m_funcs->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer(colours, depth));
+  m_funcs->glViewport(0, 0, sized->width(), sized->height());
+}
+
+GLuint RenderGraph::framebuffer(const std::vector<QOpenGLTexture*> &_colours, QOpenGLTexture *_depth)
+{
+  std::vector<GLuint> key;
+  for (QOpenGLTexture *colour : _colours) key.push_back(colour->textureId());
+  key.push_back(_depth ? _depth->textureId() : 0);
+
+  auto found = m_framebuffers.find(key);
+  if (found != m_framebuffers.end()) return found->second;
+
+  GLuint fbo;
+  m_funcs->glGenFramebuffers(1, &fbo);
+  m_funcs->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  std::vector<GLenum> attachments;
+  for (size_t i = 0; i < _colours.size(); ++i)
+  {
+    attachments.push_back(GL_COLOR_ATTACHMENT0 + i);
+    m_funcs->glFramebufferTexture(GL_FRAMEBUFFER, attachments.back(), _colours[i]->textureId(), 0);
+  }
+  if (_depth) m_funcs->glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _depth->textureId(), 0);
+
+  if (attachments.empty()) m_funcs->glDrawBuffer(GL_NONE);
+  else m_funcs->glDrawBuffers(attachments.size(), &attachments[0]);
+
+  // Finally check if framebuffer object is complete
+  if (m_funcs->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    qCritical("Render graph FBO not complete!");
+
+  m_framebuffers[key] = fbo;
+  return fbo;
+}
+
+bool RenderGraph::isDepthFormat(QOpenGLTexture::TextureFormat _format)
+{
+  switch (_format)
+  {
+  case QOpenGLTexture::D16:
+  case QOpenGLTexture::D24:
+  case QOpenGLTexture::D32:
+  case QOpenGLTexture::D32F:
+  case QOpenGLTexture::D24S8:
+  case QOpenGLTexture::D32FS8X24:
+    return true;
+  default:
+    return false;
+  }
+}
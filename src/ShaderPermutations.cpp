@@ -0,0 +1,70 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file ShaderPermutations.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Project
+#include "ShaderPermutations.h"
+
+ShaderPermutations::ShaderPermutations(
+    ProgramCache *_cache,
+    const QString &_vertex,
+    const QString &_fragment,
+    LinkCallback _onLink)
+  : m_cache(_cache)
+  , m_vertex_source(ProgramCache::readSource(_vertex))
+  , m_fragment_source(ProgramCache::readSource(_fragment))
+  , m_on_link(_onLink)
+{
+}
+
+QOpenGLShaderProgram *ShaderPermutations::get(QStringList _defines)
+{
+  // The same set in another order is the same permutation
+  _defines.sort();
+  _defines.removeDuplicates();
+  const QString key = _defines.join(' ');
+
+  auto found = m_programs.find(key);
+  if (found != m_programs.end()) return found->second.get();
+
+  qDebug("Building shader permutation [%s]", qPrintable(key));
+
+  QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+  if (!m_cache->buildFromSource(program, specialise(m_vertex_source, _defines), specialise(m_fragment_source, _defines)))
+  {
+    qWarning("Shader permutation [%s] failed to build", qPrintable(key));
+  }
+
+  if (m_on_link) m_on_link(program);
+
+  m_programs[key].reset(program);
+  return program;
+}
+
+void ShaderPermutations::clear()
+{
+  m_programs.clear();
+}
+
+QByteArray ShaderPermutations::specialise(const QByteArray &_source, const QStringList &_defines)
+{
+  // #version has to stay the first line
+  const int version = _source.indexOf("#version");
+  const int end = version < 0 ? 0 : _source.indexOf('\n', version) + 1;
+
+  QByteArray defines;
+  for (const QString &define : _defines)
+  {
+    defines += "#define " + define.toLatin1() + "\n";
+  }
+
+  // Keeps the line numbers of the compiler errors matching the file
+  const int line = _source.left(end).count('\n') + 1;
+  defines += "#line " + QByteArray::number(line) + "\n";
+
+  QByteArray result = _source;
+  result.insert(end, defines);
+  return result;
+}
@@ -1,61 +1,357 @@
+// Native
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
 // Qt
+#include <QCoreApplication>
+#include <QImageReader>
+#include <QOpenGLPixelTransferOptions>
 #include <QOpenGLFunctions_4_1_Core>
+#include <QtConcurrent>
 
 // Project
 #include "SkyBox.h"
 
-SkyBox::SkyBox(InputManager *_input_manager) : m_input_manager(_input_manager), m_blur_iterations(5)
+SkyBox::SkyBox(InputManager *_input_manager)
+  : m_input_manager(_input_manager)
+  , m_blur_iterations(5)
+  , m_blur_level(0.0f)
+  , m_blur_level_location(-1)
+  , m_face_size(1)
+  , m_cubemap_texture(nullptr)
+  , m_cache_bytes(0)
 {
 }
 
 SkyBox::~SkyBox()
 {
+  // The workers only touch their own images, but they hold our futures
+  for (auto &pending : m_pending) pending.second.faces.waitForFinished();
+
+  for (auto &cubemap : m_cubemaps) delete cubemap.second.texture;
 }
 
 void SkyBox::setBackground(QString _name)
 {
-  if (m_cubemap_texture->isCreated()) m_cubemap_texture->destroy();
+  m_requested = _name;
+
+  if (m_cubemaps.count(_name))
+  {
+    show(_name);
+    return;
+  }
+
+  auto pending = m_pending.find(_name);
+  if (pending != m_pending.end())
+  {
+    pending->second.prefetch = false;
+    return;
+  }
+
+  decode(_name, false);
+}
+
+void SkyBox::prefetch()
+{
+  // Sized from the headers before decoding, so what would not fit is never
+  // decoded only to be thrown away.
+  size_t bytes = m_cache_bytes;
+  for (const QString &name : backgrounds())
+  {
+    if (m_cubemaps.count(name) || m_pending.count(name)) continue;
+
+    const int size = faceSize(name);
+    if (size <= 0 || bytes + cubemapBytes(size) > m_cache_budget) continue;
+
+    bytes += cubemapBytes(size);
+    decode(name, true);
+  }
+}
+
+void SkyBox::update()
+{
+  for (auto it = m_pending.begin(); it != m_pending.end(); ++it)
+  {
+    const Decode decode = it->second;
+    if (!decode.baked && !decode.faces.isFinished()) continue;
+
+    const QString name = it->first;
+    m_pending.erase(it);
+
+    const QList<QImage> faces = decode.baked ? QList<QImage>() : decode.faces.results();
+
+    // Prefetching only fills free space, it never pushes out what was shown
+    size_t bytes = 0;
+    if (decode.baked) bytes = cubemapBytes(decode.header.faceSize);
+    else if (!faces.isEmpty()) bytes = cubemapBytes(faces[0].width());
+    if (decode.prefetch && m_cache_bytes + bytes > m_cache_budget) return;
+
+    const Cubemap cubemap = decode.baked ? uploadBaked(decode) : upload(faces);
+    if (cubemap.texture == nullptr)
+    {
+      qWarning("Could not decode the %s background", qPrintable(name));
+      return;
+    }
+
+    m_cubemaps[name] = cubemap;
+    m_recent.push_back(name);
+    m_cache_bytes += cubemap.bytes;
+
+    if (name == m_requested) show(name);
+    evict();
+
+    // One upload per frame keeps the frames even while prefetching
+    return;
+  }
+}
+
+QStringList SkyBox::backgrounds()
+{
+  return QStringList()
+    << "badomen" << "criminal-impact" << "cwd" << "drakeq"
+    << "forest" << "mandaris" << "misty" << "mnight";
+}
+
+void SkyBox::decode(const QString &_name, bool _prefetch)
+{
+  Decode decode;
+  decode.data = nullptr;
+  decode.prefetch = _prefetch;
+
+  // Baked, nothing to decode
+  if (mapBaked(_name, decode))
+  {
+    m_pending[_name] = decode;
+    return;
+  }
+
+#ifdef BAKED_SKYBOXES
+  qWarning("The %s background is not baked, run tools/skybaker", qPrintable(_name));
+#else
+  // Same order as the cube map faces: +x +y +z -x -y -z
+  QStringList paths;
+  for (const char *face : {"ft", "up", "rt", "bk", "dn", "lf"})
+  {
+    paths << QString(":/sky/%1_%2").arg(_name, QLatin1String(face));
+  }
+
+  decode.faces = QtConcurrent::mapped(paths, &SkyBox::decodeFace);
+  m_pending[_name] = decode;
+#endif
+}
+
+QString SkyBox::bakedPath(const QString &_name)
+{
+  return QString("%1/skies/%2.sky").arg(QCoreApplication::applicationDirPath(), _name);
+}
+
+int SkyBox::faceSize(const QString &_name)
+{
+  // The header of the baked file if there is one, mapBaked() checks the rest
+  QFile baked(bakedPath(_name));
+  SkyFileHeader header;
+  if (baked.open(QIODevice::ReadOnly) &&
+      baked.read(reinterpret_cast<char *>(&header), sizeof(header)) == qint64(sizeof(header)) &&
+      std::memcmp(header.magic, "SKY1", 4) == 0)
+  {
+    return header.faceSize;
+  }
+
+  // Otherwise the size in the header of the first face, -1 if there is none
+  return QImageReader(QString(":/sky/%1_ft").arg(_name)).size().width();
+}
+
+bool SkyBox::mapBaked(const QString &_name, Decode &_decode)
+{
+  const QString path = bakedPath(_name);
+  if (!QFile::exists(path)) return false;
+
+  std::shared_ptr<QFile> file = std::make_shared<QFile>(path);
+  const uchar *data = nullptr;
+  if (file->open(QIODevice::ReadOnly) && file->size() >= qint64(sizeof(SkyFileHeader)))
+  {
+    data = file->map(0, file->size());
+  }
+
+  SkyFileHeader header;
+  if (data != nullptr) std::memcpy(&header, data, sizeof(header));
+
+  if (data == nullptr ||
+      std::memcmp(header.magic, "SKY1", 4) != 0 ||
+      header.format != SKY_FORMAT_RGB8 ||
+      header.faceSize == 0 ||
+      header.levels == 0 || header.levels > 32 ||
+      skyFileBytes(header) != size_t(file->size()))
+  {
+    qWarning("Ignoring the broken baked sky %s", qPrintable(path));
+    return false;
+  }
+
+  _decode.baked = file;
+  _decode.data = data;
+  _decode.header = header;
+  return true;
+}
+
+size_t SkyBox::cubemapBytes(int _size)
+{
+  // Six RGB faces, and a third more for the mip chain
+  return size_t(_size) * _size * 3 * 6 * 4 / 3;
+}
+
+QImage SkyBox::decodeFace(const QString &_path)
+{
+  return QImage(_path).convertToFormat(QImage::Format_RGB888);
+}
+
+SkyBox::Cubemap SkyBox::upload(const QList<QImage> &_faces)
+{
+  static const QOpenGLTexture::CubeMapFace targets[6] = {
+    QOpenGLTexture::CubeMapPositiveX, QOpenGLTexture::CubeMapPositiveY,
+    QOpenGLTexture::CubeMapPositiveZ, QOpenGLTexture::CubeMapNegativeX,
+    QOpenGLTexture::CubeMapNegativeY, QOpenGLTexture::CubeMapNegativeZ
+  };
+
+  Cubemap cubemap = {nullptr, 0, 0};
+  if (_faces.size() != 6) return cubemap;
+  for (const QImage &face : _faces)
+  {
+    if (face.isNull() || face.size() != _faces[0].size()) return cubemap;
+  }
+
+  const int size = _faces[0].width();
+
+  QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::TargetCubeMap);
+  texture->create();
+  texture->setSize(size, size);
+  texture->setFormat(QOpenGLTexture::RGB8_UNorm);
+  texture->setMipLevels(texture->maximumMipLevels());
+  texture->allocateStorage();
+
+  for (int i = 0; i < 6; ++i)
+  {
+    texture->setData(0, 0, targets[i], QOpenGLTexture::RGB, QOpenGLTexture::UInt8, (const void *)_faces[i].constBits(), 0);
+  }
+
+  texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+  texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+  texture->setMagnificationFilter(QOpenGLTexture::Linear);
+
+  // Each level is the one above averaged down, the blurred backgrounds are
+  // read straight from them.
+  texture->generateMipMaps();
+
+  cubemap.texture = texture;
+  cubemap.faceSize = size;
+  cubemap.bytes = cubemapBytes(size);
+  return cubemap;
+}
+
+SkyBox::Cubemap SkyBox::uploadBaked(const Decode &_decode)
+{
+  static const QOpenGLTexture::CubeMapFace targets[6] = {
+    QOpenGLTexture::CubeMapPositiveX, QOpenGLTexture::CubeMapPositiveY,
+    QOpenGLTexture::CubeMapPositiveZ, QOpenGLTexture::CubeMapNegativeX,
+    QOpenGLTexture::CubeMapNegativeY, QOpenGLTexture::CubeMapNegativeZ
+  };
 
-  const QImage posx = QImage(QString(":/sky/%1_ft").arg(_name)).convertToFormat(QImage::Format_RGB888);
-  const QImage posy = QImage(QString(":/sky/%1_up").arg(_name)).convertToFormat(QImage::Format_RGB888);
-  const QImage posz = QImage(QString(":/sky/%1_rt").arg(_name)).convertToFormat(QImage::Format_RGB888);
-  const QImage negx = QImage(QString(":/sky/%1_bk").arg(_name)).convertToFormat(QImage::Format_RGB888);
-  const QImage negy = QImage(QString(":/sky/%1_dn").arg(_name)).convertToFormat(QImage::Format_RGB888);
-  const QImage negz = QImage(QString(":/sky/%1_lf").arg(_name)).convertToFormat(QImage::Format_RGB888);
+  const SkyFileHeader &header = _decode.header;
+  const int size = header.faceSize;
 
+  QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::TargetCubeMap);
+  texture->create();
+  texture->setSize(size, size);
+  texture->setFormat(QOpenGLTexture::RGB8_UNorm);
+  texture->setMipLevels(header.levels);
+  texture->setAutoMipMapGenerationEnabled(false);
+  texture->allocateStorage();
 
-  if (posz.isNull()) qDebug("Null image");
-  qDebug("%d %d %d",posz.width(), posz.height(), posz.depth());
+  // Rows are tightly packed in the file
+  QOpenGLPixelTransferOptions options;
+  options.setAlignment(1);
 
-  m_cubemap_texture->create();
-  m_cubemap_texture->setSize(posx.width(), posx.height(), posx.depth());
-  m_cubemap_texture->setFormat(QOpenGLTexture::RGB8_UNorm);
-  m_cubemap_texture->allocateStorage();
+  // Straight from the mapping, the levels were averaged down by the baker
+  const uchar *face = _decode.data + sizeof(SkyFileHeader);
+  for (uint32_t level = 0; level < header.levels; ++level)
+  {
+    for (int i = 0; i < 6; ++i)
+    {
+      texture->setData(level, 0, targets[i], QOpenGLTexture::RGB, QOpenGLTexture::UInt8, face, &options);
+      face += skyFaceBytes(header.faceSize, level);
+    }
+  }
 
-  m_cubemap_texture->setData(0, 0, QOpenGLTexture::CubeMapPositiveX, QOpenGLTexture::RGB, QOpenGLTexture::UInt8, (const void *)posx.constBits(),0);
-  m_cubemap_texture->setData(0, 0, QOpenGLTexture::CubeMapPositiveY, QOpenGLTexture::RGB, QOpenGLTexture::UInt8, (const void *)posy.constBits(),0);
-  m_cubemap_texture->setData(0, 0, QOpenGLTexture::CubeMapPositiveZ, QOpenGLTexture::RGB, QOpenGLTexture::UInt8, (const void *)posz.constBits(),0);
-  m_cubemap_texture->setData(0, 0, QOpenGLTexture::CubeMapNegativeX, QOpenGLTexture::RGB, QOpenGLTexture::UInt8, (const void *)negx.constBits(),0);
-  m_cubemap_texture->setData(0, 0, QOpenGLTexture::CubeMapNegativeY, QOpenGLTexture::RGB, QOpenGLTexture::UInt8, (const void *)negy.constBits(),0);
-  m_cubemap_texture->setData(0, 0, QOpenGLTexture::CubeMapNegativeZ, QOpenGLTexture::RGB, QOpenGLTexture::UInt8, (const void *)negz.constBits(),0);
+  texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+  texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+  texture->setMagnificationFilter(QOpenGLTexture::Linear);
 
-  m_cubemap_texture->setWrapMode(QOpenGLTexture::ClampToEdge);
-  m_cubemap_texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
-  m_cubemap_texture->setMagnificationFilter(QOpenGLTexture::LinearMipMapLinear);
+  Cubemap cubemap;
+  cubemap.texture = texture;
+  cubemap.faceSize = size;
+  cubemap.bytes = cubemapBytes(size);
+  return cubemap;
+}
 
-  m_cubemap_texture->generateMipMaps();
+void SkyBox::show(const QString &_name)
+{
+  const Cubemap &cubemap = m_cubemaps[_name];
+  m_cubemap_texture = cubemap.texture;
 
+  m_recent.remove(_name);
+  m_recent.push_front(_name);
+
+  m_face_size = std::max(cubemap.faceSize, 1);
+  updateBlurLevel();
+}
+
+void SkyBox::evict()
+{
+  while (m_cache_bytes > m_cache_budget && m_recent.size() > 1)
+  {
+    // Least recently shown that is not on screen
+    auto victim = m_recent.end();
+    for (auto it = m_recent.rbegin(); it != m_recent.rend(); ++it)
+    {
+      if (m_cubemaps[*it].texture != m_cubemap_texture)
+      {
+        victim = std::next(it).base();
+        break;
+      }
+    }
+    if (victim == m_recent.end()) return;
+
+    Cubemap &cubemap = m_cubemaps[*victim];
+    qDebug("Evicting the %s background", qPrintable(*victim));
+    delete cubemap.texture;
+    m_cache_bytes -= cubemap.bytes;
+    m_cubemaps.erase(*victim);
+    m_recent.erase(victim);
+  }
 }
 
 void SkyBox::setBlurIterations(uint _value)
 {
   qDebug("changed blur to %d", _value);
   m_blur_iterations = _value;
+  updateBlurLevel();
+}
+
+void SkyBox::updateBlurLevel()
+{
+  // Every iteration used to be a 3x3 gaussian with taps a 300th of the screen
+  // apart, so the spread grows with the square root of the iterations. The 45
+  // degree camera sees about 0.41 of a face across, which turns the spread into
+  // texels of a face. A mip level that many texels wide blurs about the same.
+  const float iterations = std::max(m_blur_iterations, 1u);
+  const float spread = std::sqrt(iterations / 2.0f) * m_face_size * 0.41f / 300.0f;
+  m_blur_level = std::log2(1.0f + spread);
 }
 
 
 
-void SkyBox::prepare(int _width, int _height, QOpenGLFunctions_4_1_Core* _funcs)
+void SkyBox::prepare(QOpenGLFunctions_4_1_Core* _funcs, ProgramCache &_cache)
 {
     //Creating a cube that goes around the scene.
   GLfloat points[] = {
@@ -103,9 +399,7 @@ void SkyBox::prepare(int _width, int _height, QOpenGLFunctions_4_1_Core* _funcs)
   };
 
   m_sky_program = new QOpenGLShaderProgram;
-  m_sky_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/skybox.vert");
-  m_sky_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/skybox.frag");
-  m_sky_program->link();
+  _cache.build(m_sky_program, ":/shader/skybox.vert", ":/shader/skybox.frag");
 
   m_skybox_vao = new QOpenGLVertexArrayObject;
   m_skybox_vao->create();
@@ -124,132 +418,38 @@ void SkyBox::prepare(int _width, int _height, QOpenGLFunctions_4_1_Core* _funcs)
 
   m_sky_program->setAttributeBuffer("pos", GL_FLOAT, 0, 3);
   m_sky_program->setUniformValue("tSkyBox", 4);
+  m_blur_level_location = m_sky_program->uniformLocation("BlurLevel");
 
   m_skybox_vao->release();
 
   m_sky_program->release();
 
-  m_cubemap_texture = new QOpenGLTexture(QOpenGLTexture::TargetCubeMap);
-  setBackground("badomen");
-
-  // ===========================================================================
-  // Set offscreen rendering
-  // ===========================================================================
-  m_blur_program = new QOpenGLShaderProgram;
-  m_blur_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/bgblur.vert");
-  m_blur_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/bgblur.frag");
-  m_blur_program->link();
-
-  static const float quad[] = {
-    -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
-     1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-     1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
-     1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
-    -1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
-    -1.0f, -1.0f, 0.0f, 0.0f, 0.0f
-  };
-
-  m_quad_vao = new QOpenGLVertexArrayObject;
-
-  m_quad_vao->create();
-  m_quad_vbo.create();
-  m_quad_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-
-  m_quad_vao->bind();
-  m_quad_vbo.bind();
-
-  m_quad_vbo.allocate(quad, 30 * sizeof(GLfloat));
-
-  m_blur_program->setAttributeBuffer("position", GL_FLOAT, 0, 3, 5 * sizeof(GLfloat));
-  m_blur_program->enableAttributeArray("position");
-
-  m_blur_program->setAttributeBuffer("uv", GL_FLOAT, 3 * sizeof(GLfloat), 2, 5 * sizeof(GLfloat));
-  m_blur_program->enableAttributeArray("uv");
-
-  m_quad_vao->release();
-
-  m_painted_sky = new QOpenGLTexture(QOpenGLTexture::Target2D);
-  m_painted_sky->setSize(_width, _height);
-  m_painted_sky->setMinificationFilter(QOpenGLTexture::Linear);
-  m_painted_sky->setMagnificationFilter(QOpenGLTexture::Linear);
-  m_painted_sky->setFormat(QOpenGLTexture::RGB32F);
-  m_painted_sky->allocateStorage(QOpenGLTexture::RGB, QOpenGLTexture::Float32);
-
-  m_fbo = new QOpenGLFramebufferObject(_width, _height);
+  // Filter across the edges of the faces, blurred levels show the seams
+  // otherwise.
+  _funcs->glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
-  _funcs->glBindTexture(GL_TEXTURE_2D, m_painted_sky->textureId());
-  _funcs->glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_painted_sky->textureId(), 0);
-  const GLenum blur_attachments[1] = {GL_COLOR_ATTACHMENT0};
-  _funcs->glDrawBuffers(1, blur_attachments);
-
-  // Finally check if framebuffer object is complete
-  if (_funcs->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    qCritical("gBuffer FBO not complete!");
-
-  m_fbo->bind();
-
-  m_fbo->release();
-
-  m_blur_program->setUniformValue("tInputBG", 0);
+  setBackground("badomen");
 }
 
 void SkyBox::draw(QOpenGLFunctions_4_1_Core* _funcs)
 {
-  m_fbo->bind();
+  // Nothing to draw until the first background is decoded
+  if (m_cubemap_texture == nullptr) return;
 
   m_cubemap_texture->bind(4);
-  m_painted_sky->bind(0);
-
-    m_sky_program->bind();
-
-    QMatrix4x4 V = m_input_manager->getViewMatrix();
-
-    // Extract just the rotation part of the camera view matrix
-    V = QMatrix4x4(V.row(0)[0], V.row(0)[1], V.row(0)[2], 0,
-                   V.row(1)[0], V.row(1)[1], V.row(1)[2], 0,
-                   V.row(2)[0], V.row(2)[1], V.row(2)[2], 0,
-                   0          ,           0,           0, 1);
 
-    m_sky_program->setUniformValue("Projection", m_input_manager->getProjectionMatrix());
-    m_sky_program->setUniformValue("View", V);
-
-    m_skybox_vao->bind();
-      _funcs->glDrawArrays(GL_TRIANGLES, 0, 36);
-    m_skybox_vao->release();
-
-    m_sky_program->release();
-
-   m_fbo->release();
-
-
-
-  for (uint i = 1; i < m_blur_iterations; i++)
-  {
-    m_fbo->bind();
-     m_painted_sky->bind(0);
-     m_blur_program->bind();
-     m_quad_vao->bind();
-       _funcs->glDrawArrays(GL_TRIANGLES, 0, 6);
-     m_quad_vao->release();
-     m_blur_program->release();
-    m_fbo->release();
-
-  }
-
-
-
-   _funcs->glDisable(GL_DEPTH_TEST);
-
-   m_blur_program->bind();
-   m_quad_vao->bind();
-   m_painted_sky->bind(0);
-   _funcs->glDrawArrays(GL_TRIANGLES, 0, 6);
-   m_quad_vao->release();
+  m_sky_program->bind();
 
-   m_blur_program->release();
+  // The matrices come from the camera uniform block
+  m_sky_program->setUniformValue(m_blur_level_location, m_blur_level);
 
-   _funcs->glEnable(GL_DEPTH_TEST);
+  _funcs->glDisable(GL_DEPTH_TEST);
 
+  m_skybox_vao->bind();
+    _funcs->glDrawArrays(GL_TRIANGLES, 0, 36);
+  m_skybox_vao->release();
 
+  _funcs->glEnable(GL_DEPTH_TEST);
 
+  m_sky_program->release();
 }
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file UniformBuffer.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <algorithm>
+#include <cstring>
+
+// Project
+#include "UniformBuffer.h"
+
+UniformBuffer::UniformBuffer()
+  : m_buffer(0)
+  , m_binding(0)
+  , m_dirty(false)
+{
+}
+
+void UniformBuffer::create(
+    QOpenGLFunctions_4_1_Core *_funcs,
+    GLuint _binding,
+    GLsizeiptr _size)
+{
+  m_binding = _binding;
+  m_data.assign(_size, 0);
+  m_dirty = false;
+
+  _funcs->glGenBuffers(1, &m_buffer);
+  _funcs->glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  _funcs->glBufferData(GL_UNIFORM_BUFFER, _size, &m_data[0], GL_DYNAMIC_DRAW);
+  _funcs->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  _funcs->glBindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_buffer);
+}
+
+void UniformBuffer::destroy(QOpenGLFunctions_4_1_Core *_funcs)
+{
+  _funcs->glDeleteBuffers(1, &m_buffer);
+  m_buffer = 0;
+}
+
+void UniformBuffer::attach(
+    QOpenGLFunctions_4_1_Core *_funcs,
+    QOpenGLShaderProgram *_program,
+    const char *_block) const
+{
+  const GLuint index = _funcs->glGetUniformBlockIndex(_program->programId(), _block);
+  if (index == GL_INVALID_INDEX) return;
+
+  _funcs->glUniformBlockBinding(_program->programId(), index, m_binding);
+}
+
+void UniformBuffer::setData(const void *_data, GLsizeiptr _size)
+{
+  if (_size > GLsizeiptr(m_data.size()))
+  {
+    qWarning("Uniform block of %d bytes does not fit in %d.", int(_size), int(m_data.size()));
+    _size = m_data.size();
+  }
+
+  if (std::memcmp(&m_data[0], _data, _size) == 0) return;
+
+  std::memcpy(&m_data[0], _data, _size);
+  m_dirty = true;
+}
+
+bool UniformBuffer::upload(QOpenGLFunctions_4_1_Core *_funcs)
+{
+  if (!m_dirty) return false;
+
+  _funcs->glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  _funcs->glBufferSubData(GL_UNIFORM_BUFFER, 0, m_data.size(), &m_data[0]);
+  _funcs->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  m_dirty = false;
+  return true;
+}
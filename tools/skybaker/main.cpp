@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file main.cpp
+/// @author Ramon Blanquer
+/// @version 0.0.1
+////////////////////////////////////////////////////////////////////////////////
+/// Bakes the skyboxes into .sky files, see SkyFile.h. Every directory of the
+/// input holding <name>_ft, _bk, _up, _dn, _rt and _lf images becomes
+/// <name>.sky in the output directory:
+///
+///   $ skybaker resources/cubemaps skies
+////////////////////////////////////////////////////////////////////////////////
+
+// Native
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Qt
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QSaveFile>
+#include <QStringList>
+
+// Project
+#include "SkyFile.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Halves a tightly packed RGB8 face averaging 2x2 blocks, which is
+/// what glGenerateMipmap does on most drivers.
+/// @param _face Face of width _size.
+/// @param _size Width of the face.
+/// @return The face of the next level.
+////////////////////////////////////////////////////////////////////////////////
+std::vector<unsigned char> downsample(const std::vector<unsigned char> &_face, uint32_t _size)
+{
+  const uint32_t half = std::max(_size / 2, 1u);
+  std::vector<unsigned char> result(half * half * 3);
+
+  for (uint32_t y = 0; y < half; ++y)
+  {
+    for (uint32_t x = 0; x < half; ++x)
+    {
+      // Clamped so that a 1 texel wide level still reads inside the face
+      const uint32_t x0 = std::min(x * 2, _size - 1), x1 = std::min(x * 2 + 1, _size - 1);
+      const uint32_t y0 = std::min(y * 2, _size - 1), y1 = std::min(y * 2 + 1, _size - 1);
+
+      for (uint32_t c = 0; c < 3; ++c)
+      {
+        const uint32_t sum =
+          _face[(y0 * _size + x0) * 3 + c] + _face[(y0 * _size + x1) * 3 + c] +
+          _face[(y1 * _size + x0) * 3 + c] + _face[(y1 * _size + x1) * 3 + c];
+        result[(y * half + x) * 3 + c] = (sum + 2) / 4;
+      }
+    }
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bakes one skybox.
+/// @param _directory Directory with the six images.
+/// @param _output Path of the .sky file.
+/// @return True if it was written.
+////////////////////////////////////////////////////////////////////////////////
+bool bake(const QDir &_directory, const QString &_output)
+{
+  // Same order as the cube map faces: +x +y +z -x -y -z
+  static const char *suffixes[6] = {"ft", "up", "rt", "bk", "dn", "lf"};
+
+  const QString name = _directory.dirName();
+  std::vector<std::vector<unsigned char>> faces(6);
+  uint32_t faceSize = 0;
+
+  for (int f = 0; f < 6; ++f)
+  {
+    const QStringList found = _directory.entryList(QStringList() << QString("%1_%2.*").arg(name, suffixes[f]), QDir::Files);
+    if (found.isEmpty())
+    {
+      std::fprintf(stderr, "%s: missing the %s face\n", qPrintable(name), suffixes[f]);
+      return false;
+    }
+
+    const QImage image = QImage(_directory.filePath(found.first())).convertToFormat(QImage::Format_RGB888);
+    if (image.isNull() || image.width() != image.height() || (faceSize != 0 && uint32_t(image.width()) != faceSize))
+    {
+      std::fprintf(stderr, "%s: the %s face is not a square like the others\n", qPrintable(name), suffixes[f]);
+      return false;
+    }
+    faceSize = image.width();
+
+    // QImage pads its rows to four bytes, the file does not
+    faces[f].resize(faceSize * faceSize * 3);
+    for (uint32_t y = 0; y < faceSize; ++y)
+    {
+      std::memcpy(&faces[f][y * faceSize * 3], image.constScanLine(y), faceSize * 3);
+    }
+  }
+
+  SkyFileHeader header;
+  std::memcpy(header.magic, "SKY1", 4);
+  header.faceSize = faceSize;
+  header.levels = 1;
+  while ((faceSize >> header.levels) > 0) header.levels++;
+  header.format = SKY_FORMAT_RGB8;
+
+  QSaveFile file(_output);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    std::fprintf(stderr, "%s: cannot write %s\n", qPrintable(name), qPrintable(_output));
+    return false;
+  }
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (uint32_t level = 0; level < header.levels; ++level)
+  {
+    const uint32_t size = skyLevelSize(faceSize, level);
+    for (int f = 0; f < 6; ++f)
+    {
+      file.write(reinterpret_cast<const char*>(&faces[f][0]), faces[f].size());
+      if (level + 1 < header.levels) faces[f] = downsample(faces[f], size);
+    }
+  }
+
+  if (!file.commit())
+  {
+    std::fprintf(stderr, "%s: cannot write %s\n", qPrintable(name), qPrintable(_output));
+    return false;
+  }
+
+  std::printf("%s: %u texels, %u levels\n", qPrintable(name), header.faceSize, header.levels);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  QCoreApplication app(argc, argv);
+
+  const QStringList arguments = app.arguments();
+  if (arguments.size() != 3)
+  {
+    std::fprintf(stderr, "usage: skybaker <cubemaps directory> <output directory>\n");
+    return 1;
+  }
+
+  const QDir input(arguments[1]);
+  const QDir output(arguments[2]);
+  if (!QDir().mkpath(output.path()))
+  {
+    std::fprintf(stderr, "cannot create %s\n", qPrintable(output.path()));
+    return 1;
+  }
+
+  bool ok = true;
+  for (const QString &name : input.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name))
+  {
+    ok &= bake(QDir(input.filePath(name)), output.filePath(name + ".sky"));
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+TARGET = skybaker
+TEMPLATE = app
+
+QT += core gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+SOURCES += \
+    main.cpp
+
+INCLUDEPATH += ../../include
+
+HEADERS += \
+    ../../include/SkyFile.h
+
+OBJECTS_DIR = build/obj